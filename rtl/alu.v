@@ -1,6 +1,7 @@
 // -----------------------------------------------------------------------
 //
-// A purely combinatorial RV32I ALU (assumes predecoded steering)
+// A purely combinatorial RV32I ALU, with Zba, Zbb, and Zbs unless
+// NO_BITMANIP (assumes predecoded steering)
 //
 // ISC License
 //
@@ -22,19 +23,18 @@
 /* The width comparisons in Verilator are completely broken. */
 /* verilator lint_off WIDTH */
 
-`define ADDSUB          0
-`define SLL             1
-`define SLT             2
-`define SLTU            3
-`define XOR             4
-`define SR_             5
-`define OR              6
-`define AND             7
+`include "yarvi.h"
 
 /* The function selector of the ALU is kept close to the RISC-V ISA,
    but it assumes a lot of instructions translate their opcodes into
    the ALU appropriate ones and feed the ALU with the relevant operands.
 
+   The bit-manipulation operations are selected with bop (see
+   yarvi.h) and funct3 `XOR so they share the slow side of the result
+   mux with the shifts and logic operations.  The shift amount and
+   bit index come from op2, so the immediate forms need no special
+   casing.  The *W forms of RV64 aren't there.
+
    Further improvement possible:
    - multi-cycle shifter (eg. migrate shifter out of this ALU)
 */
@@ -46,6 +46,7 @@ module alu#(parameter XLEN = 64, parameter MSB = XLEN - 1)
     input wire          ashr,
     input wire  [ 2:0]  funct3,
     input wire          w,
+    input wire  [ 4:0]  bop,
     input wire  [MSB:0] op1,
     input wire  [MSB:0] op2,
 
@@ -64,6 +65,61 @@ module alu#(parameter XLEN = 64, parameter MSB = XLEN - 1)
    assign                lt  = dif[MSB] ^ (op1[MSB] != op2[MSB] && op1[MSB] != dif[MSB]);
    assign                ltu = dif[XLEN];
 
+`ifndef NO_BITMANIP
+   wire [$clog2(XLEN)-1:0] shamt = op2[$clog2(XLEN)-1:0];
+   wire [MSB:0]          onehot = {{MSB{1'd0}}, 1'd1} << shamt;
+   reg  [$clog2(XLEN):0] clz, ctz, cpop;
+   reg  [MSB:0]          rev8, orcb;
+   reg  [MSB:0]          bresult;
+   integer               i;
+
+   always @(*) begin
+      clz  = XLEN;
+      ctz  = XLEN;
+      cpop = 0;
+      for (i = 0; i < XLEN; i = i + 1) begin
+         if (op1[i])
+           clz = MSB - i;
+         if (op1[MSB - i])
+           ctz = MSB - i;
+         cpop = cpop + op1[i];
+      end
+
+      for (i = 0; i < XLEN; i = i + 8) begin
+         rev8[i +: 8] = op1[MSB - i -: 8];
+         orcb[i +: 8] = |op1[i +: 8] ? 8'hFF : 8'h00;
+      end
+
+      case (bop)
+        `ALU_SH1ADD: bresult = {op1[MSB-1:0], 1'd0} + op2;
+        `ALU_SH2ADD: bresult = {op1[MSB-2:0], 2'd0} + op2;
+        `ALU_SH3ADD: bresult = {op1[MSB-3:0], 3'd0} + op2;
+        `ALU_ANDN:   bresult = op1 & ~op2;
+        `ALU_ORN:    bresult = op1 | ~op2;
+        `ALU_XNOR:   bresult = op1 ^ ~op2;
+        `ALU_MIN:    bresult = lt  ? op1 : op2;
+        `ALU_MINU:   bresult = ltu ? op1 : op2;
+        `ALU_MAX:    bresult = lt  ? op2 : op1;
+        `ALU_MAXU:   bresult = ltu ? op2 : op1;
+        `ALU_ROL:    bresult = op1 << shamt | op1 >> (XLEN - shamt);
+        `ALU_ROR:    bresult = op1 >> shamt | op1 << (XLEN - shamt);
+        `ALU_CLZ:    bresult = clz;
+        `ALU_CTZ:    bresult = ctz;
+        `ALU_CPOP:   bresult = cpop;
+        `ALU_SEXTB:  bresult = {{(XLEN-8){op1[7]}}, op1[7:0]};
+        `ALU_SEXTH:  bresult = {{(XLEN-16){op1[15]}}, op1[15:0]};
+        `ALU_ZEXTH:  bresult = {{(XLEN-16){1'd0}}, op1[15:0]};
+        `ALU_REV8:   bresult = rev8;
+        `ALU_ORCB:   bresult = orcb;
+        `ALU_BCLR:   bresult = op1 & ~onehot;
+        `ALU_BSET:   bresult = op1 | onehot;
+        `ALU_BINV:   bresult = op1 ^ onehot;
+        `ALU_BEXT:   bresult = {{MSB{1'd0}}, |(op1 & onehot)};
+        default:     bresult = 'hX;
+      endcase
+   end
+`endif
+
 always @(*) begin
    // Yosys doesn't do timing based synthesis so here we manually
    // balance the cascaded mux, giving the slowest logic (the adder
@@ -73,6 +129,11 @@ always @(*) begin
      `SLTU:   result = {{MSB{1'd0}}, ltu}; // op1 < op2
      `ADDSUB: result = sub ? dif[MSB:0] : sum[MSB:0];
      default:
+`ifndef NO_BITMANIP
+       if (bop != `ALU_BASE)
+         result = bresult;
+       else
+`endif
        case (funct3)
 `ifndef NO_SHIFTS
          // SRAW is unusual in the world of RISC in that it requires
@@ -29,12 +29,13 @@ module top
 
    reg        rd, fwd1, fwd2, rd, sub, ashr;
    reg [2:0]  funct3;
+   reg [4:0]  bop; // Zba/Zbb/Zbs, NO_BITMANIP=1 leaves them out
    reg [MSB:0] rs1, rs2;
    reg [MSB:0] op1, op2;
    reg             w;
 
    reg [20:0] td_r, result_r;
-   always @(posedge clock) {fwd1, fwd2, rd, w, sub, ashr, funct3} <= td;
+   always @(posedge clock) {fwd1, fwd2, rd, w, sub, ashr, funct3, bop} <= td;
 
    wire [MSB:0] result;
    wire [MSB:0] sum;
@@ -42,7 +43,7 @@ module top
    wire         lt;
    wire         ltu;
 
-   alu #(`XLEN) alu(.sub(sub), .ashr(ashr), .funct3(funct3), .w(w),
+   alu #(`XLEN) alu(.sub(sub), .ashr(ashr), .funct3(funct3), .w(w), .bop(bop),
                     .op1(op1), .op2(op2), .result(result), .sum(sum),
                     .eq(eq), .lt(lt), .ltu(ltu));
 
@@ -1,5 +1,6 @@
 // From http://danstrother.com/2010/09/11/inferring-rams-in-fpgas/
 // A parameterized, inferable, true dual-port, dual-clock block RAM in Verilog.
+// Both ports read every cycle and a write also updates the port's output.
 module bram_tdp #(
     parameter DATA = 72,
     parameter ADDR = 10,
@@ -10,10 +11,42 @@ module bram_tdp #(
     input   wire                a_wr,
     input   wire    [ADDR-1:0]  a_addr,
     input   wire    [DATA-1:0]  a_din,
+    output  wire    [DATA-1:0]  a_dout,
+
+    // Port B
+    input   wire                b_clk,
+    input   wire                b_wr,
+    input   wire    [ADDR-1:0]  b_addr,
+    input   wire    [DATA-1:0]  b_din,
+    output  wire    [DATA-1:0]  b_dout
+);
+
+bram_tdp_en #(.DATA(DATA), .ADDR(ADDR), .INIT(INIT), .WRITE_THROUGH(1)) ram
+    (a_clk, 1'd1, a_wr, a_addr, a_din, a_dout,
+     b_clk, 1'd1, b_wr, b_addr, b_din, b_dout);
+endmodule
+
+// The same with read enables, as yarvi's on-chip memory uses it: a
+// port reads when *_en and it isn't writing, and its output holds
+// otherwise (unless WRITE_THROUGH).  INIT, if given, is loaded with
+// $readmemh.
+module bram_tdp_en #(
+    parameter DATA = 72,
+    parameter ADDR = 10,
+    parameter INIT = "",
+    parameter WRITE_THROUGH = 0
+) (
+    // Port A
+    input   wire                a_clk,
+    input   wire                a_en,
+    input   wire                a_wr,
+    input   wire    [ADDR-1:0]  a_addr,
+    input   wire    [DATA-1:0]  a_din,
     output  reg     [DATA-1:0]  a_dout,
 
     // Port B
     input   wire                b_clk,
+    input   wire                b_en,
     input   wire                b_wr,
     input   wire    [ADDR-1:0]  b_addr,
     input   wire    [DATA-1:0]  b_din,
@@ -21,23 +54,33 @@ module bram_tdp #(
 );
 
 // Shared memory
+/* verilator lint_off MULTIDRIVEN */
 reg [DATA-1:0] mem [(2**ADDR)-1:0];
+/* verilator lint_on MULTIDRIVEN */
+
+/* verilator lint_off WIDTH */
+initial
+    if (INIT != "")
+        $readmemh(INIT, mem);
+/* verilator lint_on WIDTH */
 
 // Port A
 always @(posedge a_clk) begin
-    a_dout      <= mem[a_addr];
     if (a_wr) begin
-        a_dout      <= a_din;
         mem[a_addr] <= a_din;
-    end
+        if (WRITE_THROUGH)
+            a_dout  <= a_din;
+    end else if (a_en)
+        a_dout      <= mem[a_addr];
 end
 
 // Port B
 always @(posedge b_clk) begin
-    b_dout      <= mem[b_addr];
     if (b_wr) begin
-        b_dout      <= b_din;
         mem[b_addr] <= b_din;
-    end
+        if (WRITE_THROUGH)
+            b_dout  <= b_din;
+    end else if (b_en)
+        b_dout      <= mem[b_addr];
 end
 endmodule
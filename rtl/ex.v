@@ -46,7 +46,7 @@ module ex(clock, sub, ashr, funct3, w, fwd1, fwd2, imm1, imm2, imm1val, imm2val,
    wire          lt;
    wire          ltu;
 
-   alu #(XLEN) alu(.sub(sub), .ashr(ashr), .funct3(funct3), .w(w),
+   alu #(XLEN) alu(.sub(sub), .ashr(ashr), .funct3(funct3), .w(w), .bop(5'd0),
                    .op1(1?op1:rf[rs1]), .op2(1?op2:rf[rs2]),
                    .result(result), .sum(sum), .eq(eq), .lt(lt),
                    .ltu(ltu));
@@ -62,6 +62,15 @@
 `define SR_             5
 `define OR              6
 `define AND             7
+`define MULDIV          1       // funct7
+`define   MUL               0   // funct3
+`define   MULH              1
+`define   MULHSU            2
+`define   MULHU             3
+`define   DIV               4
+`define   DIVU              5
+`define   REM               6
+`define   REMU              7
 
 `define PRIV            0
 `define   ECALL             0
@@ -69,6 +78,7 @@
 `define   SRET          'h102
 `define   WFI           'h105
 `define   MRET          'h302
+`define   SFENCE_VMA    'h09    // funct7
 `define CSRRW           1
 `define CSRRS           2
 `define CSRRC           3
@@ -76,6 +86,18 @@
 `define CSRRSI          6
 `define CSRRCI          7
 
+`define AMOADD          0       // funct5
+`define AMOSWAP         1
+`define LR              2
+`define SC              3
+`define AMOXOR          4
+`define AMOOR           8
+`define AMOAND         12
+`define AMOMIN         16
+`define AMOMAX         20
+`define AMOMINU        24
+`define AMOMAXU        28
+
 `define opext    [1 : 0]
 `define opcode   [6 : 2]
 `define rd       [11: 7]
@@ -83,6 +105,7 @@
 `define rs1      [19:15]
 `define rs2      [24:20]
 `define funct7   [31:25]
+`define funct5   [31:27]
 
 `define br_negate   [12]
 `define br_unsigned [13]
@@ -130,6 +153,9 @@
 `define CSR_SIP                 'h 144
 
 `define CSR_SATP                'h 180
+  `define SATP_MODE [31]
+  `define SATP_ASID [30:22]
+  `define SATP_PPN  [21:0]
 
 // User-level, counter/timers
 `define CSR_CYCLE               'h C00
@@ -180,6 +206,7 @@
 
 // uppercase are writeable: meip 0 SEIP ueip mtip 0 STIP utip msip 0 SSIP usip
 `define CSR_MIP_WMASK           12'b 001000100010
+`define SSTATUS_WMASK           32'h 000C0122   // SIE SPIE SPP SUM MXR
 
 `define CSR_PMPCFG0             'h 3A0
 `define CSR_PMPADDR0            'h 3B0
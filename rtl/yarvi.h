@@ -56,9 +56,154 @@
 `define TIMEOUT 16000
 `endif
 
+// With DCACHE, loads and stores go through a direct mapped write-back
+// D$ on the same port, with up to DC_MSHRS misses outstanding.
+`ifndef DC_WORDS_LG2
 `define DC_WORDS_LG2 13 // 32 KiB
+`endif
 `define DC_WORDS (1 << `DC_WORDS_LG2)
-`define DC_LINE_WORDS_LG2 1 // 2^1 64-bit words = 16 byte line size
+`ifndef DC_LINE_WORDS_LG2
+`define DC_LINE_WORDS_LG2 2 // 2^2 32-bit words = 16 byte line size
+`endif
+`define DC_LINE_WORDS (1 << `DC_LINE_WORDS_LG2)
+`define DC_LINES_LG2 (`DC_WORDS_LG2 - `DC_LINE_WORDS_LG2)
+`ifndef DC_MSHRS_LG2
+`define DC_MSHRS_LG2 1 // 2 MSHRs
+`endif
+`define DC_MSHRS (1 << `DC_MSHRS_LG2)
+// and, unless NO_PREFETCH, a stride prefetcher for loads
+`ifndef DC_PF_LG2
+`define DC_PF_LG2 4 // 16 load pcs tracked
+`endif
+`ifndef DC_PF_DISTANCE_LG2
+`define DC_PF_DISTANCE_LG2 2 // prefetch 4 strides ahead
+`endif
+
+// With ICACHE, fetch goes through a direct mapped I$ refilled over the
+// AXI4 port (the mem_* ports of yarvi) instead of the on-chip code
+// memory.
+`ifndef IC_WORDS_LG2
+`define IC_WORDS_LG2 12 // 16 KiB
+`endif
+`ifndef IC_LINE_WORDS_LG2
+`define IC_LINE_WORDS_LG2 3 // 2^3 32-bit words = 32 byte line size
+`endif
+`define IC_LINES_LG2 (`IC_WORDS_LG2 - `IC_LINE_WORDS_LG2)
+
+// With MMU, Sv32 translation through small fully associative ITLB
+// and DTLB, refilled by a hardware page table walker reading the
+// on-chip memory, so not with DCACHE for now.
+`ifndef TLB_ENTRIES_LG2
+`define TLB_ENTRIES_LG2 2 // 4 entries each
+`endif
+`ifdef MMU
+`ifdef DCACHE
+`MMU_does_not_support_DCACHE_yet
+`endif
+`endif
+
+// With TAGE, conditional branches are predicted by yarvi_tage instead
+// of YAGS: four tagged tables of 1 << TAGE_LG2 entries of 12 bits and a
+// small loop predictor.
+`ifndef TAGE_LG2
+`define TAGE_LG2 9 // 4 x 512 x 12 = 24 Kib, YAGS is 32 Kib
+`endif
+`define TAGE_TAG_BITS 8
+`define TAGE_META_BITS (14 + 4 * (`TAGE_LG2 + `TAGE_TAG_BITS))
+
+// With FTQ, the branch predictor is pipelined over two stages and runs
+// ahead of fetch through a fetch target queue.
+`ifndef FTQ_LG2
+`define FTQ_LG2 2 // 4 entries
+`endif
+
+// The BTB has 1 << BTB_WAYS_LG2 ways.  BTB_FULL_TARGET or
+// BTB_DELTA_TARGET extend the reach of its targets beyond the 128 KiB
+// block of the branch.
+`ifndef BTB_WAYS_LG2
+`define BTB_WAYS_LG2 0 // directly mapped
+`endif
+`define BTB_WAYS (1 << `BTB_WAYS_LG2)
+`ifdef BTB_FULL_TARGET
+`ifdef BTB_DELTA_TARGET
+`BTB_FULL_TARGET_and_BTB_DELTA_TARGET_are_exclusive
+`endif
+`endif
+
+// Unless NO_MULDIV, RV32M with a pipelined multiplier and a
+// multi-cycle divider (yarvi_muldiv.v)
+`ifndef NO_MULDIV
+`define MISA_M (32'd 1 << ("M"-"A"))
+`else
+`define MISA_M 32'd 0
+`endif
+
+// With RVC, the C extension: instructions are 16 or 32 bits and
+// halfword aligned, so INSN_LSB is the lowest pc bit that matters.
+// The fetch aligner needs the classic front end.
+`ifdef RVC
+`ifdef FTQ
+`RVC_and_FTQ_are_exclusive
+`endif
+`define MISA_C (32'd 1 << ("C"-"A"))
+`define INSN_LSB 1
+`else
+`define MISA_C 32'd 0
+`define INSN_LSB 2
+`endif
+
+// Unless NO_BITMANIP, Zba, Zbb, and Zbs, in the ALU.  Decode in S4
+// steers them to the ALU with one of these and funct3 `XOR, the
+// path the base logic operations take, off the adder's.
+`ifndef NO_BITMANIP
+`define MISA_B (32'd 1 << ("B"-"A"))
+`else
+`define MISA_B 32'd 0
+`endif
+`define ALU_BASE    5'd 0  // funct3 selects an RV32I operation
+`define ALU_SH1ADD  5'd 1
+`define ALU_SH2ADD  5'd 2
+`define ALU_SH3ADD  5'd 3
+`define ALU_ANDN    5'd 4
+`define ALU_ORN     5'd 5
+`define ALU_XNOR    5'd 6
+`define ALU_MIN     5'd 7
+`define ALU_MINU    5'd 8
+`define ALU_MAX     5'd 9
+`define ALU_MAXU    5'd 10
+`define ALU_ROL     5'd 11
+`define ALU_ROR     5'd 12
+`define ALU_CLZ     5'd 13
+`define ALU_CTZ     5'd 14
+`define ALU_CPOP    5'd 15
+`define ALU_SEXTB   5'd 16
+`define ALU_SEXTH   5'd 17
+`define ALU_ZEXTH   5'd 18
+`define ALU_REV8    5'd 19
+`define ALU_ORCB    5'd 20
+`define ALU_BCLR    5'd 21
+`define ALU_BSET    5'd 22
+`define ALU_BINV    5'd 23
+`define ALU_BEXT    5'd 24
+
+// The AMOs other than LR and SC, which read, modify, and write memory
+`define IS_AMO_RMW(i) (i`opcode == `AMO && i`funct5 != `LR && i`funct5 != `SC)
+
+// Predecode classes, matching the BTB types for the ones predicted
+// taken on a BTB miss (backward branches, JAL, and returns)
+`define PD_OTHER   3'd0
+`define PD_RETURN  3'd1
+`define PD_BR_FWD  3'd2
+`define PD_BR_BACK 3'd3
+`define PD_JUMP    3'd6
+`define PD_CALL    3'd7
+
+`ifdef ICACHE
+`define MEM_BUS
+`endif
+`ifdef DCACHE
+`define MEM_BUS
+`endif
 
 
 // The execution environment really should explicitly provide the configuration,
@@ -33,8 +33,6 @@
 //  * add more accounting to enable "IPC stacks", that is, counting of
 //    cycles wasted due to all the reasons above.
 //
-//  * Load-hit-store: investigate forwarding
-//
 //  * Load-use:
 //    - store data can be forwarded from sub-word load only one cycle
 //      penalty
@@ -68,8 +66,9 @@ We have eight stages:
   ^----- pipeline restarts ------/
 
 Showing the data loop and the two control loops.  There is a 7 cycle
-mispredict penalty, same for load-hit-store.  Load has a 2 cycle
-latency and can incur up to 2 stall cycles.
+mispredict penalty.  Load has a 2 cycle latency and can incur up to 2
+stall cycles.  Stores in flight are forwarded to loads (see the memory
+pipeline).
 
 PC: PC generation/branch prediction
 IF1: start instruction fetch
@@ -91,8 +90,14 @@ causes the clear of all valid bits.
 The pipeline might be invalidated or restarted for several reasons:
  - fetch mispredicted a branch and fed us the wrong instructions.
  - we need a value that is still being loaded from memory
- - instruction traps, like misaligned loads/stores
+ - instruction traps, like misaligned loads/stores outside memory
  - interrupts (which are taken in CM)
+ - a load or store crossing a word restarts itself for the second word
+ - an instruction or a load/store missed in the TLB (with MMU) and must
+   wait for the page table walk
+ - an instruction missed in the I$ (with ICACHE) and must be refetched
+ - an instruction needs a register that a D$ miss (with DCACHE) hasn't
+   delivered yet, or the D$ can't take a miss right now
 
 *************************************************************************/
 
@@ -102,6 +107,35 @@ The pipeline might be invalidated or restarted for several reasons:
 `include "yarvi.h"
 `default_nettype none
 
+`ifdef __ICARUS__
+`define HAS_PLUSARGS 1
+`endif
+
+`ifdef VERILATOR
+`define HAS_PLUSARGS 1
+`endif
+
+`ifdef YOSYS
+// Doesn't appear to support $value$plusargs
+`endif
+
+`ifdef ALTERA_RESERVED_QIS
+// Doesn't appear to support $value$plusargs
+`endif
+
+// The memory image, loaded from +INIT0..3 where plusargs work
+`ifdef HAS_PLUSARGS
+`define INIT_LANE0 ""
+`define INIT_LANE1 ""
+`define INIT_LANE2 ""
+`define INIT_LANE3 ""
+`else
+`define INIT_LANE0 "init_mem.0.hex"
+`define INIT_LANE1 "init_mem.1.hex"
+`define INIT_LANE2 "init_mem.2.hex"
+`define INIT_LANE3 "init_mem.3.hex"
+`endif
+
 module yarvi
   ( input  wire             clock
   , input  wire             reset
@@ -110,23 +144,63 @@ module yarvi
   , output reg [ 1:0]       retire_priv
   , output reg [`VMSB:0]    retire_pc
   , output reg [31:0]       retire_insn
+  , output reg              retire_rvc     // a 16-bit instruction (expanded in retire_insn)
   , output reg [ 4:0]       retire_rd
   , output reg [`XMSB:0]    retire_wb_val
+  , output reg [`XMSB:0]    retire_addr
+
+`ifdef MEM_BUS
+  // External memory, AXI4 (see the memory bus below)
+  , output reg              mem_arvalid = 0
+  , input  wire             mem_arready
+  , output reg [`XMSB:0]    mem_araddr
+  , output reg [   7:0]     mem_arlen
+  , output wire [   2:0]    mem_arsize
+  , output wire [   1:0]    mem_arburst
+  , input  wire             mem_rvalid
+  , output wire             mem_rready
+  , input  wire [  31:0]    mem_rdata
+/* verilator lint_off UNUSED */
+  , input  wire [   1:0]    mem_rresp // XXX bus errors aren't reported
+/* verilator lint_on UNUSED */
+  , input  wire             mem_rlast
+  , output reg              mem_awvalid = 0
+  , input  wire             mem_awready
+  , output reg [`XMSB:0]    mem_awaddr
+  , output wire [   7:0]    mem_awlen
+  , output wire [   2:0]    mem_awsize
+  , output wire [   1:0]    mem_awburst
+  , output reg              mem_wvalid = 0
+  , input  wire             mem_wready
+  , output wire [  31:0]    mem_wdata
+  , output wire [   3:0]    mem_wstrb
+  , output wire             mem_wlast
+  , input  wire             mem_bvalid
+  , output wire             mem_bready
+/* verilator lint_off UNUSED */
+  , input  wire [   1:0]    mem_bresp
+/* verilator lint_on UNUSED */
+`endif
+
   , output reg [   31:0]    debug);
 
 
 
 
    /* Processor architectual state (excluding pc) */
-   /* Data & code memory, 2R1W */
-   reg  [    7:0] data0[(1 << (`PMSB-1)) - 1:0];
-   reg  [    7:0] data1[(1 << (`PMSB-1)) - 1:0];
-   reg  [    7:0] data2[(1 << (`PMSB-1)) - 1:0];
-   reg  [    7:0] data3[(1 << (`PMSB-1)) - 1:0];
-   reg  [    7:0] code0[(1 << (`PMSB-1)) - 1:0];
+   /* Memory; without DCACHE it's the unified on-chip memory below */
+`ifdef DCACHE
+   reg  [    7:0] data0[`DC_WORDS - 1:0]; // D$ data
+   reg  [    7:0] data1[`DC_WORDS - 1:0];
+   reg  [    7:0] data2[`DC_WORDS - 1:0];
+   reg  [    7:0] data3[`DC_WORDS - 1:0];
+`ifndef ICACHE
+   reg  [    7:0] code0[(1 << (`PMSB-1)) - 1:0]; // for fetch, written by stores too
    reg  [    7:0] code1[(1 << (`PMSB-1)) - 1:0];
    reg  [    7:0] code2[(1 << (`PMSB-1)) - 1:0];
    reg  [    7:0] code3[(1 << (`PMSB-1)) - 1:0];
+`endif
+`endif
    reg  [`XMSB:0] regs[0:31];
    reg  [    1:0] priv;
    reg  [    4:0] csr_fflags;
@@ -145,11 +219,11 @@ module yarvi
    reg  [   11:0] csr_medeleg;
    reg  [`XMSB:0] csr_stvec;
 // reg  [`XMSB:0] csr_scounteren;
-// reg  [`XMSB:0] csr_sscratch;
+   reg  [`XMSB:0] csr_sscratch;
    reg  [`XMSB:0] csr_sepc;
    reg  [`XMSB:0] csr_scause;
    reg  [`XMSB:0] csr_stval;
-// reg  [`XMSB:0] csr_satp;
+   reg  [`XMSB:0] csr_satp;
    reg  [   63:0] mtime;
    reg  [   63:0] mtimecmp;
 
@@ -204,7 +278,7 @@ module yarvi
    //       case (s0_btb_type[2:1] & {2{btb_hit))
    //       0:    npc = pc_sequential
    //       1, 3: npc = btb-target;
-   //       2:    npc = ras0;
+   //       2:    npc = ras_top;
    //       endcase
    //
    // That is, the LSB is not relevant for the mux but only for the
@@ -218,113 +292,573 @@ module yarvi
 `define BTB_TYPE_JUMP   3'd6
 `define BTB_TYPE_CALL   3'd7
 
-   // The BTB stores the type and part of the target address.  The
-   // remaining bits are copied from the PC (we could do better, eg.
-   // use a delta if timing allows).
+   // The BTB stores the type and part of the target address.  By
+   // default the remaining bits are copied from the PC, so a target in
+   // another 128 KiB block mispredicts every time.  With
+   // BTB_DELTA_TARGET the target is instead a signed distance from the
+   // PC (an adder in S0) and with BTB_FULL_TARGET it's all there.
+   // The distance is from the word, as with RVC S0 can fetch from the
+   // middle of one.
    //
    // The BTB also stores a partial tag.  For timing, the BTB is
-   // directly mapped.
+   // directly mapped by default.  With BTB_WAYS_LG2 > 0 it's set
+   // associative and the tag compares pick the way ahead of the next
+   // PC mux.  A miss allocates the way not recently used or, with
+   // BTB_REPLACE_RANDOM, a pseudo random way.
    //
    // Parameters:
-   // - entries in the BTB (thus, the width of the index)
+   // - sets in the BTB (thus, the width of the index) and ways
    // - width of target information
    // - width of tag
 
-`define BTB_INDEX_MSB   9 // 1,024 entries
+`define BTB_INDEX_MSB   9 // 1,024 sets
 `define BTB_TAG_MSB     4 // 5 bit tag, 5 + 10 = 15, 32 Kinsn coverage
-`define BTB_TARGET_MSB 14 // 2¹⁵ insn = 128 KiB coverage
-   // 1K * (15 + 5 + 2) = 22 Kib
+`ifdef BTB_FULL_TARGET
+`define BTB_TARGET_MSB (`VMSB - `INSN_LSB)
+`define BTB_TARGET(pc, t) {t,{`INSN_LSB{1'd0}}}
+`define BTB_ENCODE(pc, a) a[`VMSB:`INSN_LSB]
+`elsif BTB_DELTA_TARGET
+`define BTB_TARGET_MSB 14 // ± 2¹⁴ insn = ± 64 KiB coverage (half with RVC)
+`define BTB_TARGET(pc, t) ({pc[`VMSB:2],2'd0} + {{(`VMSB - `BTB_TARGET_MSB - `INSN_LSB){t[`BTB_TARGET_MSB]}},t,{`INSN_LSB{1'd0}}})
+`define BTB_ENCODE(pc, a) ((a - {pc[`VMSB:2],2'd0}) >> `INSN_LSB)
+`else
+`define BTB_TARGET_MSB 14 // 2¹⁵ insn = 128 KiB coverage (half with RVC)
+`define BTB_TARGET(pc, t) {pc[`VMSB:`BTB_TARGET_MSB+`INSN_LSB+1],t,{`INSN_LSB{1'd0}}}
+`define BTB_ENCODE(pc, a) (a >> `INSN_LSB)
+`endif
+   // 1K * (15 + 5 + 2) = 22 Kib per way
+
+   reg [              2:0] btb_type[(2 << (`BTB_INDEX_MSB + `BTB_WAYS_LG2)) - 1:0];
+   reg [`BTB_TAG_MSB   :0] btb_tag[(2 << (`BTB_INDEX_MSB + `BTB_WAYS_LG2)) - 1:0];
+   reg [`BTB_TARGET_MSB:0] btb_target[(2 << (`BTB_INDEX_MSB + `BTB_WAYS_LG2)) - 1:0];
+`ifdef RVC
+   // The halfword of the word the instruction ends in (see the aligner)
+   reg                     btb_half[(2 << (`BTB_INDEX_MSB + `BTB_WAYS_LG2)) - 1:0];
+`endif
+`ifdef BTB_REPLACE_RANDOM
+   reg [              7:0] btb_lfsr = 1;
+`else
+   reg [`BTB_WAYS-1    :0] btb_nru[(2 << `BTB_INDEX_MSB) - 1:0];
+`endif
+
+   // All ways of the set at btb_raddr are read and compared the next
+   // cycle with btb_rpc, the PC that was fetched from there.  With RVC
+   // an entry for a halfword before the one fetched from doesn't hit.
+   wire [`VMSB         :0] btb_raddr;
+   wire [`VMSB         :0] btb_rpc;
+   reg [              2:0] btb_rd_way_type[`BTB_WAYS-1:0];
+   reg [`BTB_TAG_MSB   :0] btb_rd_way_tag[`BTB_WAYS-1:0];
+   reg [`BTB_TARGET_MSB:0] btb_rd_way_target[`BTB_WAYS-1:0];
+   reg                     btb_rd_hit;
+   reg [`BTB_WAYS_LG2  :0] btb_rd_way;
+   reg [              2:0] btb_rd_type;
+   reg [`BTB_TARGET_MSB:0] btb_rd_target;
+`ifdef RVC
+   reg                     btb_rd_way_half[`BTB_WAYS-1:0];
+   reg                     btb_rd_half;
+`endif
+   integer                 btb_r, btb_w;
+
+   always @(posedge clock)
+     for (btb_r = 0; btb_r < `BTB_WAYS; btb_r = btb_r + 1) begin
+        btb_rd_way_type[btb_r]   <= btb_type[btb_raddr[`BTB_INDEX_MSB+2:2] + (btb_r << (`BTB_INDEX_MSB + 1))];
+        btb_rd_way_tag[btb_r]    <= btb_tag[btb_raddr[`BTB_INDEX_MSB+2:2] + (btb_r << (`BTB_INDEX_MSB + 1))];
+        btb_rd_way_target[btb_r] <= btb_target[btb_raddr[`BTB_INDEX_MSB+2:2] + (btb_r << (`BTB_INDEX_MSB + 1))];
+`ifdef RVC
+        btb_rd_way_half[btb_r]   <= btb_half[btb_raddr[`BTB_INDEX_MSB+2:2] + (btb_r << (`BTB_INDEX_MSB + 1))];
+`endif
+     end
+
+   always @(*) begin
+      btb_rd_hit    = 0;
+      btb_rd_way    = 0;
+      btb_rd_type   = btb_rd_way_type[0];
+      btb_rd_target = btb_rd_way_target[0];
+`ifdef RVC
+      btb_rd_half   = btb_rd_way_half[0];
+      for (btb_w = 0; btb_w < `BTB_WAYS; btb_w = btb_w + 1)
+        if (btb_rpc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3] == btb_rd_way_tag[btb_w] &&
+            btb_rd_way_half[btb_w] >= btb_rpc[1]) begin
+           btb_rd_hit    = 1;
+           btb_rd_way    = btb_w;
+           btb_rd_type   = btb_rd_way_type[btb_w];
+           btb_rd_target = btb_rd_way_target[btb_w];
+           btb_rd_half   = btb_rd_way_half[btb_w];
+        end
+`else
+      for (btb_w = 0; btb_w < `BTB_WAYS; btb_w = btb_w + 1)
+        if (btb_rpc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3] == btb_rd_way_tag[btb_w]) begin
+           btb_rd_hit    = 1;
+           btb_rd_way    = btb_w;
+           btb_rd_type   = btb_rd_way_type[btb_w];
+           btb_rd_target = btb_rd_way_target[btb_w];
+        end
+`endif
+   end
+
+   // The RAS is a circular buffer, so overflow overwrites the oldest
+   // entry and underflow wraps.  Every prediction carries the top of
+   // stack pointer and value it saw down the pipeline and a restart
+   // puts them back, with the push or pop of the instruction in S5
+   // applied, undoing the wrong path pushes and pops.  The top entry is
+   // kept in a register so the S0 mux doesn't go through the RAM.
 
-   reg [              2:0] btb_type[(2 << `BTB_INDEX_MSB) - 1:0];
-   reg [`BTB_TAG_MSB   :0] btb_tag[(2 << `BTB_INDEX_MSB) - 1:0];
-   reg [`BTB_TARGET_MSB:0] btb_target[(2 << `BTB_INDEX_MSB) - 1:0];
-   reg [`VMSB          :0] ras0 = 'h110, ras1 = 'h220, ras2 = 'h440;
+`define RAS_INDEX_MSB   3 // 16 entries
+
+   reg [`VMSB          :0] ras[(2 << `RAS_INDEX_MSB) - 1:0];
+   reg [`RAS_INDEX_MSB :0] ras_tos = 0;
+   reg [`VMSB          :0] ras_top = 'h110;
 
 `define YAGS_TAG_MSB    5 // 6-bit tags
 `define YAGS_INDEX_MSB 11 // 12-bit index, 4096 entries
 
-   // YAGS corrector
+   // YAGS corrector, or with TAGE, yarvi_tage in its place.  What the
+   // pipeline carries as the YAGS index is then the TAGE meta data.
+`ifdef TAGE
+`define BR_HISTORY_MSB 63
+`define BP_META_MSB (`TAGE_META_BITS - 1)
+   wire                    tage_hit;
+   wire [              1:0] tage_dir;
+   wire [`BP_META_MSB  :0] tage_meta;
+`else
+`define BR_HISTORY_MSB `YAGS_INDEX_MSB
+`define BP_META_MSB    `YAGS_INDEX_MSB
    reg [`YAGS_TAG_MSB  :0] yags_tag[(2 << `YAGS_INDEX_MSB) - 1:0];
    reg [              1:0] yags_direction[(2 << `YAGS_INDEX_MSB) - 1:0];
-   reg [`YAGS_INDEX_MSB:0] br_history = 0;
+`endif
+   // The global branch history is shifted speculatively as branches
+   // are predicted.  A restart from S6 takes the retired copy,
+   // rbr_history, which is exact for the restarting instruction.  The
+   // front end carries each instruction's checkpoint (s1/s2_br_history)
+   // for the S2 redirect, which doesn't have that.  The same goes for
+   // path_history.
+   reg [`BR_HISTORY_MSB:0] br_history = 0;
+
+   // Indirect target cache (ITTAGE-lite): a tagged table of full
+   // targets indexed by the pc and a hash of the recent path (the
+   // targets of taken jumps and calls).  A hit overrides the BTB target
+   // of a jump or call, so an indirect jump can have a target per path
+   // leading to it.  It's only written by mispredicted indirect jumps
+   // and calls (a JALR that isn't a return) so JALs never hit.  A 2-bit
+   // confidence keeps a target from being replaced by a one-off.  The
+   // tag folds in the low pc bits to keep the JALs in the BTB from
+   // hitting entries of nearby JALRs.
+
+`define ITC_INDEX_MSB   7 // 256 entries
+`define ITC_TAG_MSB     7 // 8-bit tags
+   // 256 * (8 + 30 + 2) = 10 Kib
+
+   reg [`ITC_TAG_MSB   :0] itc_tag[(2 << `ITC_INDEX_MSB) - 1:0];
+   reg [`VMSB   :`INSN_LSB] itc_target[(2 << `ITC_INDEX_MSB) - 1:0];
+   reg [              1:0] itc_conf[(2 << `ITC_INDEX_MSB) - 1:0];
+   reg [`ITC_INDEX_MSB :0] path_history = 0;
 
    wire                    restart;
    wire [`VMSB         :0] restart_pc;
    wire                    s3_stall;
+   wire                    s2_stall; // S0-S2 wait, for s3_stall or the aligner
+
+   // The static prediction from the predecode bits in S2 (see S2)
+   wire                    pd_redirect;
+   wire [`VMSB         :0] pd_target;
+   wire [             2:0] pd_type;
+   wire [`VMSB         :0] pd_pc;
+   wire [`RAS_INDEX_MSB:0] pd_ras_tos;
+   wire [`VMSB         :0] pd_ras_top;
+   wire [`BR_HISTORY_MSB:0] pd_br_history;
+   wire [`ITC_INDEX_MSB:0] pd_path_history;
+   wire                    fetch_hold; // I$ refilling or fetch port busy, fetch waits
 
    reg                     btb_update = 0;
-   reg [`BTB_INDEX_MSB :0] btb_update_idx;
+   reg                     btb_touch = 0;  // hit by the instruction in S6
+   reg [`BTB_INDEX_MSB+`BTB_WAYS_LG2:0] btb_update_idx; // way and set
    reg [              2:0] btb_update_type;
    reg [`BTB_TAG_MSB   :0] btb_update_tag;
    reg [`BTB_TARGET_MSB:0] btb_update_target;
+`ifdef RVC
+   reg                     btb_update_half;
+`endif
+
+   reg                     itc_update = 0;
+   reg                     itc_update_replace;
+   reg [`ITC_INDEX_MSB :0] itc_update_idx;
+   reg [`ITC_TAG_MSB   :0] itc_update_tag;
+   reg [`VMSB   :`INSN_LSB] itc_update_target;
+   reg [              1:0] itc_update_conf;
 
    reg                     yags_update = 0;
-   reg [`YAGS_INDEX_MSB:0] yags_update_idx;
+   reg [`BP_META_MSB   :0] yags_update_idx;
+`ifdef TAGE
+   reg [`VMSB          :0] yags_update_pc;
+   reg                     yags_update_taken;
+   reg                     yags_update_base;
+`else
    reg [              1:0] yags_update_direction;
    reg [`YAGS_TAG_MSB  :0] yags_update_tag;
+`endif
+
+`ifdef FTQ
+   // Decoupled predictor
+   //
+   // The prediction is pipelined over two stages, B1 and B2, which run
+   // ahead of fetch and push into a fetch target queue that S0 takes
+   // from, so neither the YAGS lookup nor the fetch stalls are in the
+   // next PC loop.  B1 predicts from the BTB alone (with the BTB
+   // bimodal counters for branches and the RAS for returns) which is
+   // enough to go on the next cycle.  B2 has the YAGS lookup for the
+   // same pc and, if it disagrees with B1 on a branch, overrides it and
+   // redirects B1, costing one predictor bubble which the queue usually
+   // hides.  The RAS is updated as an instruction leaves B1, br_history
+   // as it leaves B2.
+   //
+   // With an empty queue S0 takes B2 directly, so a restart costs one
+   // cycle more than the single cycle predictor.
+
+   // B1
+   reg  [`VMSB         :0] bp1_pc;
+   reg  [`VMSB         :0] bp1_pred;   // the fast prediction
+   reg  [`VMSB         :0] bp1_npc;    // what B1 does next
+   wire [             2:0] bp1_btb_type = btb_rd_type;
+   wire                    bp1_btb_hit = btb_rd_hit;
+   wire [`BTB_WAYS_LG2 :0] bp1_btb_way = btb_rd_way;
+   wire [`VMSB         :0] bp1_target = `BTB_TARGET(bp1_pc, btb_rd_target);
+   assign                  btb_raddr = bp1_npc;
+   assign                  btb_rpc = bp1_pc;
+
+   // B2
+   reg                     bp2_valid = 0;
+   reg  [`VMSB         :0] bp2_pc;
+   reg  [`VMSB         :0] bp2_pred;
+   reg  [`VMSB         :0] bp2_target;
+   reg [              2:0] bp2_btb_type;
+   reg                     bp2_btb_hit;
+   reg [`BTB_WAYS_LG2  :0] bp2_btb_way;
+   reg [`RAS_INDEX_MSB :0] bp2_ras_tos;
+   reg [`VMSB          :0] bp2_ras_top;
+`ifdef TAGE
+   wire [`BP_META_MSB  :0] bp2_yags_idx = tage_meta;
+   wire [              1:0] bp2_yags_dir = tage_dir;
+   wire                    bp2_yags_hit = tage_hit;
+`else
+   reg [`BP_META_MSB   :0] bp2_yags_idx;
+   reg [`YAGS_TAG_MSB  :0] bp2_yags_tag;
+   reg [              1:0] bp2_yags_dir;
+   wire                    bp2_yags_hit = bp2_pc[`YAGS_TAG_MSB+`YAGS_INDEX_MSB+3:`YAGS_INDEX_MSB+3] == bp2_yags_tag;
+`endif
+   reg [`ITC_INDEX_MSB :0] bp2_itc_idx;
+   reg [`ITC_TAG_MSB   :0] bp2_itc_tag;
+   reg [`VMSB          :2] bp2_itc_target;
+   reg [              1:0] bp2_itc_conf;
+   wire                    bp2_itc_hit = (bp2_pc[`ITC_TAG_MSB+`ITC_INDEX_MSB+3:`ITC_INDEX_MSB+3] ^ bp2_pc[`ITC_TAG_MSB+2:2]) == bp2_itc_tag;
+   wire                    bp2_branch = bp2_btb_hit && !bp2_btb_type[2];
+   wire                    bp2_jump = bp2_btb_hit && bp2_btb_type[2:1] == 3;
+   wire                    bp2_taken = bp2_yags_hit ? bp2_yags_dir[1] : bp2_btb_type[1];
+   wire [`VMSB         :0] bp2_npc = bp2_branch ? (bp2_taken ? bp2_target : bp2_pc + 4) :
+                                     bp2_jump && bp2_itc_hit ? {bp2_itc_target,2'd0} : bp2_pred;
+   wire                    bp2_override = bp2_branch ? bp2_taken != bp2_btb_type[1] :
+                                          bp2_jump && bp2_itc_hit && bp2_itc_target != bp2_pred[`VMSB:2];
+
+   // The fetch target queue
+   reg  [`VMSB         :0] ftq_pc[(1 << `FTQ_LG2) - 1:0];
+   reg  [`VMSB         :0] ftq_npc[(1 << `FTQ_LG2) - 1:0];
+   reg [              2:0] ftq_btb_type[(1 << `FTQ_LG2) - 1:0];
+   reg                     ftq_btb_hit[(1 << `FTQ_LG2) - 1:0];
+   reg [`BTB_WAYS_LG2  :0] ftq_btb_way[(1 << `FTQ_LG2) - 1:0];
+   reg [`BP_META_MSB   :0] ftq_yags_idx[(1 << `FTQ_LG2) - 1:0];
+   reg                     ftq_yags_hit[(1 << `FTQ_LG2) - 1:0];
+   reg [              1:0] ftq_yags_dir[(1 << `FTQ_LG2) - 1:0];
+   reg [`RAS_INDEX_MSB :0] ftq_ras_tos[(1 << `FTQ_LG2) - 1:0];
+   reg [`VMSB          :0] ftq_ras_top[(1 << `FTQ_LG2) - 1:0];
+   reg [`ITC_INDEX_MSB :0] ftq_itc_idx[(1 << `FTQ_LG2) - 1:0];
+   reg                     ftq_itc_hit[(1 << `FTQ_LG2) - 1:0];
+   reg [              1:0] ftq_itc_conf[(1 << `FTQ_LG2) - 1:0];
+   reg [`BR_HISTORY_MSB:0] ftq_br_history[(1 << `FTQ_LG2) - 1:0];
+   reg [`ITC_INDEX_MSB :0] ftq_path_history[(1 << `FTQ_LG2) - 1:0];
+   reg [`FTQ_LG2-1     :0] ftq_rp = 0, ftq_wp = 0;
+   reg [`FTQ_LG2       :0] ftq_n = 0;
+   wire                    ftq_empty = ftq_n == 0;
+
+   // S0 is the head of the queue, or B2 when it's empty
+   wire                    s0_valid = !ftq_empty | bp2_valid;
+   wire                    s0_take = s0_valid & !s2_stall & !fetch_hold & !restart;
+   wire                    bp2_accept = bp2_valid & !restart & !pd_redirect & (ftq_n != (1 << `FTQ_LG2) | s0_take);
+   wire                    ftq_push = bp2_accept & !(ftq_empty & s0_take);
+   wire                    ftq_pop = s0_take & !ftq_empty;
+   wire                    bp_adv = !bp2_valid | bp2_accept;
+   wire                    bp_redirect = bp2_override & bp2_accept;
+
+   reg  [`VMSB         :0] s0_pc;
+   reg  [`VMSB         :0] s0_npc;
+   reg [              2:0] s0_btb_type;
+   reg                     s0_btb_hit;
+   reg [`BTB_WAYS_LG2  :0] s0_btb_way;
+   reg [`BP_META_MSB   :0] s0_yags_idx;
+   reg                     s0_yags_hit;
+   reg [              1:0] s0_yags_dir;
+   reg [`RAS_INDEX_MSB :0] s0_ras_tos;
+   reg [`VMSB          :0] s0_ras_top;
+   reg [`ITC_INDEX_MSB :0] s0_itc_idx;
+   reg                     s0_itc_hit;
+   reg [              1:0] s0_itc_conf;
+   reg [`BR_HISTORY_MSB:0] s0_br_history;
+   reg [`ITC_INDEX_MSB :0] s0_path_history;
+
+   always @(*) begin
+      case (bp1_btb_type[2:1] & {2{bp1_btb_hit}})
+        0:       bp1_pred = bp1_pc + 4;
+        2:       bp1_pred = ras_top;
+        default: bp1_pred = bp1_target;
+      endcase
+
+      bp1_npc = bp1_pred;
+      if (!bp_adv)
+        bp1_npc = bp1_pc;
+      if (bp_redirect)
+        bp1_npc = bp2_npc;
+      if (pd_redirect)
+        bp1_npc = pd_target;
+      if (restart)
+        bp1_npc = restart_pc;
+
+      if (ftq_empty) begin
+         s0_pc       = bp2_pc;
+         s0_npc      = bp2_npc;
+         s0_btb_type = bp2_btb_type;
+         s0_btb_hit  = bp2_btb_hit;
+         s0_btb_way  = bp2_btb_way;
+         s0_yags_idx = bp2_yags_idx;
+         s0_yags_hit = bp2_yags_hit;
+         s0_yags_dir = bp2_yags_dir;
+         s0_ras_tos  = bp2_ras_tos;
+         s0_ras_top  = bp2_ras_top;
+         s0_itc_idx  = bp2_itc_idx;
+         s0_itc_hit  = bp2_itc_hit;
+         s0_itc_conf = bp2_itc_conf;
+         s0_br_history = br_history;
+         s0_path_history = path_history;
+      end else begin
+         s0_pc       = ftq_pc[ftq_rp];
+         s0_npc      = ftq_npc[ftq_rp];
+         s0_btb_type = ftq_btb_type[ftq_rp];
+         s0_btb_hit  = ftq_btb_hit[ftq_rp];
+         s0_btb_way  = ftq_btb_way[ftq_rp];
+         s0_yags_idx = ftq_yags_idx[ftq_rp];
+         s0_yags_hit = ftq_yags_hit[ftq_rp];
+         s0_yags_dir = ftq_yags_dir[ftq_rp];
+         s0_ras_tos  = ftq_ras_tos[ftq_rp];
+         s0_ras_top  = ftq_ras_top[ftq_rp];
+         s0_itc_idx  = ftq_itc_idx[ftq_rp];
+         s0_itc_hit  = ftq_itc_hit[ftq_rp];
+         s0_itc_conf = ftq_itc_conf[ftq_rp];
+         s0_br_history = ftq_br_history[ftq_rp];
+         s0_path_history = ftq_path_history[ftq_rp];
+      end
+   end
+
+   reg s0_restart = 1;
+   always @(posedge clock) begin
+      s0_restart     <= restart;
+      bp1_pc         <= bp1_npc;
+
+      if (bp_adv | restart | pd_redirect) begin
+         bp2_valid    <= !restart & !bp_redirect & !pd_redirect;
+         bp2_pc       <= bp1_pc;
+         bp2_pred     <= bp1_pred;
+         bp2_target   <= bp1_target;
+         bp2_btb_type <= bp1_btb_type;
+         bp2_btb_hit  <= bp1_btb_hit;
+         bp2_btb_way  <= bp1_btb_way;
+         bp2_ras_tos  <= ras_tos;
+         bp2_ras_top  <= ras_top;
+         bp2_itc_idx    <= bp1_pc[`ITC_INDEX_MSB+2:2] ^ path_history;
+         bp2_itc_tag    <= itc_tag[bp1_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+         bp2_itc_target <= itc_target[bp1_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+         bp2_itc_conf   <= itc_conf[bp1_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+`ifndef TAGE
+         bp2_yags_idx <= bp1_pc[`YAGS_INDEX_MSB+2:2] ^ br_history;
+         bp2_yags_tag <= yags_tag[bp1_pc[`YAGS_INDEX_MSB+2:2] ^ br_history];
+         bp2_yags_dir <= yags_direction[bp1_pc[`YAGS_INDEX_MSB+2:2] ^ br_history];
+`endif
+      end
+
+      if (ftq_push) begin
+         ftq_pc[ftq_wp]       <= bp2_pc;
+         ftq_npc[ftq_wp]      <= bp2_npc;
+         ftq_btb_type[ftq_wp] <= bp2_btb_type;
+         ftq_btb_hit[ftq_wp]  <= bp2_btb_hit;
+         ftq_btb_way[ftq_wp]  <= bp2_btb_way;
+         ftq_yags_idx[ftq_wp] <= bp2_yags_idx;
+         ftq_yags_hit[ftq_wp] <= bp2_yags_hit;
+         ftq_yags_dir[ftq_wp] <= bp2_yags_dir;
+         ftq_ras_tos[ftq_wp]  <= bp2_ras_tos;
+         ftq_ras_top[ftq_wp]  <= bp2_ras_top;
+         ftq_itc_idx[ftq_wp]  <= bp2_itc_idx;
+         ftq_itc_hit[ftq_wp]  <= bp2_itc_hit;
+         ftq_itc_conf[ftq_wp] <= bp2_itc_conf;
+         ftq_br_history[ftq_wp] <= br_history;
+         ftq_path_history[ftq_wp] <= path_history;
+         ftq_wp               <= ftq_wp + 1'd1;
+      end
+      if (ftq_pop)
+        ftq_rp <= ftq_rp + 1'd1;
+      ftq_n <= ftq_n + ftq_push - ftq_pop;
+
+      if (restart) begin
+         ftq_rp <= 0;
+         ftq_wp <= 0;
+         ftq_n  <= 0;
+         br_history <= rbr_history;
+         path_history <= rpath_history;
+         ras_tos <= rras_tos;
+         ras_top <= rras_we ? rras_top : ras[rras_tos];
+         if (rras_we)
+           ras[rras_tos] <= rras_top;
+`ifndef QUIET
+         $display("           RAS now: [%d] %x History %x", rras_tos,
+                  rras_we ? rras_top : ras[rras_tos], rbr_history);
+`endif
+      end else if (pd_redirect) begin
+         ftq_rp <= 0;
+         ftq_wp <= 0;
+         ftq_n  <= 0;
+         br_history <= pd_br_history;
+         path_history <= pd_path_history;
+         // Back to the RAS of the instruction in S2, plus its own push or pop
+         case (pd_type)
+           `PD_CALL: begin
+              ras_tos <= pd_ras_tos + 1'd1;
+              ras[pd_ras_tos + 1'd1] <= pd_pc + 4;
+              ras_top <= pd_pc + 4;
+           end
+           `PD_RETURN: begin
+              ras_tos <= pd_ras_tos - 1'd1;
+              ras_top <= ras[pd_ras_tos - 1'd1];
+           end
+           default: begin
+              ras_tos <= pd_ras_tos;
+              ras_top <= pd_ras_top;
+              ras[pd_ras_tos] <= pd_ras_top;
+           end
+         endcase
+      end else begin
+         if (bp_adv & !bp_redirect & bp1_btb_hit)
+           case (bp1_btb_type)
+             `BTB_TYPE_CALL: begin
+                ras_tos <= ras_tos + 1'd1;
+                ras[ras_tos + 1'd1] <= bp1_pc + 4;
+                ras_top <= bp1_pc + 4;
+             end
+             `BTB_TYPE_RETURN, `BTB_TYPE_RETURN + 3'd1: begin
+                ras_tos <= ras_tos - 1'd1;
+                ras_top <= ras[ras_tos - 1'd1];
+             end
+             default: begin end
+           endcase
 
+         if (bp2_accept & bp2_branch)
+           br_history <= (br_history << 1) | bp2_taken;
+         if (bp2_accept & bp2_jump)
+           path_history <= (path_history << 2) ^ bp2_npc[`ITC_INDEX_MSB+2:2];
+`ifndef QUIET
+         if (bp_redirect)
+           $display("PREDICT: %x YAGS[%x] overrides BTB, %s BRANCH to %x", bp2_pc, bp2_yags_idx,
+                    bp2_taken ? "TAKEN" : "NOT-taken", bp2_npc);
+`endif
+      end
+   end
+`else
+   wire                    s0_valid = 1;
    reg                     s0_yags_hit;
-   reg [`YAGS_INDEX_MSB:0] s0_yags_idx;
+   reg [`BP_META_MSB   :0] s0_yags_idx;
+`ifndef TAGE
    reg [`YAGS_TAG_MSB  :0] s0_yags_tag;
+`endif
    reg [              1:0] s0_yags_dir;
 
    reg  [`VMSB         :0] s0_pc;
    reg  [`VMSB         :0] s0_npc;
-   reg [              2:0] s0_btb_type;
-   reg [`BTB_TAG_MSB   :0] s0_btb_tag;
-   reg [`BTB_TARGET_MSB:0] s0_btb_target;
-   reg                     s0_btb_hit;
+   wire [             2:0] s0_btb_type = btb_rd_type;
+   wire                    s0_btb_hit = btb_rd_hit;
+   wire [`BTB_WAYS_LG2 :0] s0_btb_way = btb_rd_way;
+   wire [`VMSB         :0] s0_btb_target = `BTB_TARGET(s0_pc, btb_rd_target);
+   assign                  btb_raddr = s0_npc;
+   assign                  btb_rpc = s0_pc;
+`ifdef RVC
+   // With RVC fetch continues with the next word, and a call returns to
+   // the halfword after the one the BTB entry says it ends in
+   wire                    s0_btb_half = btb_rd_half;
+   wire [`VMSB         :0] s0_seq_pc = {s0_pc[`VMSB:2],2'd0} + 4;
+   wire [`VMSB         :0] s0_ret_pc = {s0_pc[`VMSB:2],s0_btb_half,1'd0} + 2;
+`else
+   wire [`VMSB         :0] s0_seq_pc = s0_pc + 4;
+   wire [`VMSB         :0] s0_ret_pc = s0_pc + 4;
+`endif
 
    reg [              2:0] s0_prediction;
 
+   reg [`ITC_INDEX_MSB :0] s0_itc_idx;
+   reg [`ITC_TAG_MSB   :0] s0_itc_tag;
+   reg [`VMSB   :`INSN_LSB] s0_itc_target;
+   reg [              1:0] s0_itc_conf;
+   reg                     s0_itc_hit;
+
    always @(*) begin
-      s0_btb_hit  = s0_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3]    == s0_btb_tag;
+      s0_itc_hit  = (s0_pc[`ITC_TAG_MSB+`ITC_INDEX_MSB+3:`ITC_INDEX_MSB+3] ^ s0_pc[`ITC_TAG_MSB+2:2]) == s0_itc_tag;
+`ifdef TAGE
+      s0_yags_hit = tage_hit;
+      s0_yags_dir = tage_dir;
+      s0_yags_idx = tage_meta;
+`else
       s0_yags_hit = s0_pc[`YAGS_TAG_MSB+`YAGS_INDEX_MSB+3:`YAGS_INDEX_MSB+3] == s0_yags_tag;
+`endif
 
       casez ({s0_btb_hit,s0_btb_type,s0_yags_hit,s0_yags_dir})
         // BTB says return => ignore YAGS and follow RAS
         {1'd1,`BTB_TYPE_RETURN, 3'd?}: begin
           s0_prediction = `BTB_TYPE_RETURN;
-          s0_npc = ras0;
+          s0_npc = ras_top;
         end
 
-        // BTB says jump => ignore YAGS and follow BTB target
+        // BTB says jump => ignore YAGS and follow the ITC or BTB target
         {1'd1,`BTB_TYPE_JUMP, 3'd?}: begin
           s0_prediction = `BTB_TYPE_JUMP;
-          s0_npc = {s0_pc[`XMSB:`BTB_TARGET_MSB+3],s0_btb_target,2'd0};
+          s0_npc = s0_itc_hit ? {s0_itc_target,{`INSN_LSB{1'd0}}} : s0_btb_target;
         end
 
-        // BTB says call => ignore YAGS and follow BTB target
+        // BTB says call => ignore YAGS and follow the ITC or BTB target
         {1'd1,`BTB_TYPE_CALL, 3'd?}: begin
           s0_prediction = `BTB_TYPE_CALL;
-          s0_npc = {s0_pc[`XMSB:`BTB_TARGET_MSB+3],s0_btb_target,2'd0};
+          s0_npc = s0_itc_hit ? {s0_itc_target,{`INSN_LSB{1'd0}}} : s0_btb_target;
         end
 
         // BTB says taken and YAGS miss => follow BTB target
         {1'd1,`BTB_TYPE_BR_S_T, 1'd0,2'd?}, {1'd1,`BTB_TYPE_BR_W_T, 1'd0,2'd?}: begin
            s0_prediction = `BTB_TYPE_BR_W_T;
-           s0_npc = {s0_pc[`XMSB:`BTB_TARGET_MSB+3],s0_btb_target,2'd0};
+           s0_npc = s0_btb_target;
         end
 
         // BTB says it's a branch and YAGS says taken => follow BTB target
         {1'd1,3'b0??, 1'd1, 2'b1?}: begin
           s0_prediction = `BTB_TYPE_BR_W_T;
-          s0_npc = {s0_pc[`XMSB:`BTB_TARGET_MSB+3],s0_btb_target,2'd0};
+          s0_npc = s0_btb_target;
         end
 
         // Otherwise sequential
         default: begin
           s0_prediction = `BTB_TYPE_BR_W_N;
-          s0_npc = s0_pc + 4;
+          s0_npc = s0_seq_pc;
         end
       endcase
 
 
-      // XXX It should be possible to fold the reset case into the ras0 case
+      // XXX It should be possible to fold the reset case into the RAS case
       // and also stall if using skid buffers
-      if (s3_stall)
+      if (s2_stall | fetch_hold)
         s0_npc = s0_pc;
 
+      if (pd_redirect)
+        s0_npc = pd_target;
+
       if (restart)
         s0_npc = restart_pc;
    end
@@ -333,67 +867,83 @@ module yarvi
    always @(posedge clock) begin
       s0_restart    <= restart;
       s0_pc         <= s0_npc;
-      s0_btb_tag    <= btb_tag[s0_npc[`BTB_INDEX_MSB+2:2]];
-      s0_btb_target <= btb_target[s0_npc[`BTB_INDEX_MSB+2:2]];
-      s0_btb_type   <= btb_type[s0_npc[`BTB_INDEX_MSB+2:2]];
 
+      s0_itc_idx    <= s0_pc[`ITC_INDEX_MSB+2:2] ^ path_history;
+      s0_itc_tag    <= itc_tag[s0_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+      s0_itc_target <= itc_target[s0_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+      s0_itc_conf   <= itc_conf[s0_pc[`ITC_INDEX_MSB+2:2] ^ path_history];
+
+`ifndef TAGE
       s0_yags_idx   <= s0_pc[`YAGS_INDEX_MSB+2:2] ^ br_history;
       s0_yags_tag   <= yags_tag[s0_pc[`YAGS_INDEX_MSB+2:2] ^ br_history];
       s0_yags_dir   <= yags_direction[s0_pc[`YAGS_INDEX_MSB+2:2] ^ br_history];
-
-      if (yags_update) begin
-         yags_tag[yags_update_idx] <= yags_update_tag;
-         yags_direction[yags_update_idx] <= yags_update_direction;
-`ifndef QUIET
-         $display("UPDATE_: YAGS[%x]=%x:%d -> %x:%d", yags_update_idx,
-                  yags_tag[yags_update_idx],
-                  yags_direction[yags_update_idx],
-                  yags_update_tag,
-                  yags_update_direction);
 `endif
-      end
 
       if (restart) begin
          br_history <= rbr_history;
-         ras0 <= rras0;
-         ras1 <= rras1;
-         ras2 <= rras2;
+         path_history <= rpath_history;
+         ras_tos <= rras_tos;
+         ras_top <= rras_we ? rras_top : ras[rras_tos];
+         if (rras_we)
+           ras[rras_tos] <= rras_top;
 `ifndef QUIET
-         $display("           RAS now: %x %x %x History %x", rras0, rras1, rras2, rbr_history);
+         $display("           RAS now: [%d] %x History %x", rras_tos,
+                  rras_we ? rras_top : ras[rras_tos], rbr_history);
 `endif
+      end else if (pd_redirect) begin
+         br_history <= pd_br_history;
+         path_history <= pd_path_history;
+         // Back to the RAS of the instruction in S2, plus its own push or pop
+         case (pd_type)
+           `PD_CALL: begin
+              ras_tos <= pd_ras_tos + 1'd1;
+              ras[pd_ras_tos + 1'd1] <= pd_pc + 4;
+              ras_top <= pd_pc + 4;
+           end
+           `PD_RETURN: begin
+              ras_tos <= pd_ras_tos - 1'd1;
+              ras_top <= ras[pd_ras_tos - 1'd1];
+           end
+           default: begin
+              ras_tos <= pd_ras_tos;
+              ras_top <= pd_ras_top;
+              ras[pd_ras_tos] <= pd_ras_top;
+           end
+         endcase
       end
 
-      if (!s3_stall & !restart & s0_btb_hit)
+      if (!s2_stall & !fetch_hold & !restart & !pd_redirect & s0_btb_hit)
          case (s0_prediction)
            `BTB_TYPE_CALL: begin
 `ifndef QUIET
-              $display("PREDICT: %x (%d) CALL to %x RAS: %x %x %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc,
-                       s0_pc + 4, ras0, ras1);
+              $display("PREDICT: %x (%d) CALL to %x RAS: [%d] %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc,
+                       ras_tos + 1'd1, s0_ret_pc);
 `endif
-              // Old ras2 lost
-              ras2 <= ras1;
-              ras1 <= ras0;
-              ras0 <= s0_pc + 4;
+              ras_tos <= ras_tos + 1'd1;
+              ras[ras_tos + 1'd1] <= s0_ret_pc;
+              ras_top <= s0_ret_pc;
+              path_history <= (path_history << 2) ^ s0_npc[`ITC_INDEX_MSB+2:2];
            end
            `BTB_TYPE_RETURN: begin
 `ifndef QUIET
-              $display("PREDICT: %x (%d) RETURN to %x RAS: %x %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc, ras1, ras2);
+              $display("PREDICT: %x (%d) RETURN to %x RAS: [%d] %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc,
+                       ras_tos - 1'd1, ras[ras_tos - 1'd1]);
 `endif
-              ras0 <= ras1;
-              ras1 <= ras2;
-              // keep ras2
-              ras2 <= 0; // XXX just to make debugging easier
+              ras_tos <= ras_tos - 1'd1;
+              ras_top <= ras[ras_tos - 1'd1];
            end
            `BTB_TYPE_JUMP: begin
 `ifndef QUIET
-              $display("PREDICT: %x (%d) JUMP to %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc);
+              $display("PREDICT: %x (%d) JUMP to %x%s", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2], s0_npc,
+                       s0_itc_hit ? " (ITC)" : "");
 `endif
+              path_history <= (path_history << 2) ^ s0_npc[`ITC_INDEX_MSB+2:2];
            end
            `BTB_TYPE_BR_S_T, `BTB_TYPE_BR_W_T: begin
 `ifndef QUIET
               if (s0_yags_hit)
-                $display("PREDICT: %x (%d) YAGS[%x]=%x:%x said %s TAKEN BRANCH to %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2],
-                         s0_yags_idx, s0_yags_tag, s0_yags_dir,
+                $display("PREDICT: %x (%d) YAGS[%x]=%x said %s TAKEN BRANCH to %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2],
+                         s0_yags_idx, s0_yags_dir,
                          s0_btb_type == `BTB_TYPE_BR_S_T ? "STRONGLY" : "WEAKLY", s0_npc);
               else
                 $display("PREDICT: %x (%d) BM said %s TAKEN BRANCH to %x", s0_pc, s0_pc[`BTB_INDEX_MSB+2:2],
@@ -412,20 +962,67 @@ module yarvi
            end
            default: begin /* can't happen */ end
          endcase
+   end
+
+   wire [`RAS_INDEX_MSB :0] s0_ras_tos = ras_tos;
+   wire [`VMSB          :0] s0_ras_top = ras_top;
+   wire [`BR_HISTORY_MSB:0] s0_br_history = br_history;
+   wire [`ITC_INDEX_MSB :0] s0_path_history = path_history;
+`endif
+
+`ifndef BTB_REPLACE_RANDOM
+   wire [`BTB_WAYS-1   :0] btb_update_way_bit = 1 << (btb_update_idx >> (`BTB_INDEX_MSB + 1));
+   wire [`BTB_WAYS-1   :0] btb_nru_touched = btb_nru[btb_update_idx[`BTB_INDEX_MSB:0]] | btb_update_way_bit;
+`endif
+
+   // The predictor table writes from S6
+   always @(posedge clock) begin
+      if (itc_update) begin
+         if (itc_update_replace) begin
+            itc_tag[itc_update_idx] <= itc_update_tag;
+            itc_target[itc_update_idx] <= itc_update_target;
+         end
+         itc_conf[itc_update_idx] <= itc_update_conf;
+      end
+
+`ifndef TAGE
+      if (yags_update) begin
+         yags_tag[yags_update_idx] <= yags_update_tag;
+         yags_direction[yags_update_idx] <= yags_update_direction;
+`ifndef QUIET
+         $display("UPDATE_: YAGS[%x]=%x:%d -> %x:%d", yags_update_idx,
+                  yags_tag[yags_update_idx],
+                  yags_direction[yags_update_idx],
+                  yags_update_tag,
+                  yags_update_direction);
+`endif
+      end
+`endif
+
+`ifdef BTB_REPLACE_RANDOM
+      btb_lfsr <= {btb_lfsr[6:0], btb_lfsr[7] ^ btb_lfsr[5] ^ btb_lfsr[4] ^ btb_lfsr[3]};
+`else
+      // Mark the way used, and once all are, start over with just it
+      if (btb_update | btb_touch)
+        btb_nru[btb_update_idx[`BTB_INDEX_MSB:0]] <= &btb_nru_touched ? btb_update_way_bit : btb_nru_touched;
+`endif
 
       if (btb_update) begin
          btb_type[btb_update_idx] <= btb_update_type;
          btb_tag[btb_update_idx] <= btb_update_tag;
          btb_target[btb_update_idx] <= btb_update_target;
+`ifdef RVC
+         btb_half[btb_update_idx] <= btb_update_half;
+`endif
 
 `ifndef QUIET
          if (btb_update_type == `BTB_TYPE_RETURN)
            $display("UPDATE_: %x (%d) RETURN",
-                    {s7_pc[`XMSB:`BTB_TAG_MSB+`BTB_INDEX_MSB+4],btb_update_tag,btb_update_idx,2'd0},
+                    {s7_pc[`XMSB:`BTB_TAG_MSB+`BTB_INDEX_MSB+4],btb_update_tag,btb_update_idx[`BTB_INDEX_MSB:0],2'd0},
                     btb_update_idx);
          else
            $display("UPDATE_: %x (%d) %-s to %x",
-                    {s7_pc[`XMSB:`BTB_TAG_MSB+`BTB_INDEX_MSB+4],btb_update_tag,btb_update_idx,2'd0},
+                    {s7_pc[`XMSB:`BTB_TAG_MSB+`BTB_INDEX_MSB+4],btb_update_tag,btb_update_idx[`BTB_INDEX_MSB:0],2'd0},
                     btb_update_idx,
                     btb_update_type == `BTB_TYPE_CALL ? "CALL" :
                     btb_update_type == `BTB_TYPE_JUMP ? "JUMP" :
@@ -433,32 +1030,262 @@ module yarvi
                     btb_update_type == `BTB_TYPE_BR_S_N ? "BR-strong-nontaken" :
                     btb_update_type == `BTB_TYPE_BR_W_T ? "BR-weak-taken" :
                     btb_update_type == `BTB_TYPE_BR_W_N ? "BR-weak-nontaken" : "???",
-                    {s7_pc[`XMSB:`BTB_TARGET_MSB+3],btb_update_target,2'd0});
+                    `BTB_TARGET(s6_pc, btb_update_target));
+`endif
+      end
+   end
+
+
+`ifdef TAGE
+   yarvi_tage #(`TAGE_LG2, `TAGE_TAG_BITS, `BR_HISTORY_MSB + 1) tage
+     ( .clock         (clock)
+     , .restart       (restart)
+`ifdef FTQ
+     , .lookup        (bp_adv | restart | pd_redirect)
+     , .lookup_pc     (bp1_pc)
+     , .history       (br_history)
+     , .pc            (bp2_pc)
+     , .advance       (bp2_accept & bp2_branch)
+     , .advance_taken (bp2_taken)
+`else
+     , .lookup        (1'd1)
+     , .lookup_pc     (s0_pc)
+     , .history       (br_history)
+     , .pc            (s0_pc)
+     , .advance       (!s2_stall & !fetch_hold & !restart & !pd_redirect & s0_btb_hit & !s0_btb_type[2])
+     , .advance_taken (s0_prediction == `BTB_TYPE_BR_W_T)
+`endif
+     , .hit           (tage_hit)
+     , .dir           (tage_dir)
+     , .meta          (tage_meta)
+     , .update        (yags_update)
+     , .update_meta   (yags_update_idx)
+     , .update_pc     (yags_update_pc)
+     , .update_taken  (yags_update_taken)
+     , .update_base   (yags_update_base));
+`endif
+
+
+
+   // Instruction cache
+   //
+   // Direct mapped, read in S1 along with the tag which is compared as
+   // the instruction moves to S2.  An instruction that misses carries
+   // on down the pipeline as a NOP and restarts itself from S6, like a
+   // mispredict, while the line is refilled, starting from the miss
+   // in S2.  S0 is held until the refill is done so the refetch hits.
+   // One line is refilled at a time; misses seen in the meantime are
+   // dropped and will just miss again.
+   //
+   // Stores don't update the I$.  With ICACHE alone they go to the
+   // data memory only, so code can't be modified.  With DCACHE too,
+   // FENCE.I waits for the D$ to write back its dirty lines (see
+   // dc_clean) and then invalidates the I$, dropping a refill in
+   // flight, so the refills see the stores.
+`ifdef ICACHE
+   reg  [31:0]                      ic_data[(1 << `IC_WORDS_LG2) - 1:0];
+   reg  [ 2:0]                      ic_pd[(1 << `IC_WORDS_LG2) - 1:0]; // predecode bits
+   reg  [`VMSB:`IC_WORDS_LG2+2]     ic_tag[(1 << `IC_LINES_LG2) - 1:0];
+   reg  [(1 << `IC_LINES_LG2) - 1:0] ic_valid = 0;
+   reg                              ic_busy = 0;
+   reg                              ic_drop = 0; // FENCE.I during the refill
+   reg                              ic_ar_req = 0;
+   reg  [`VMSB:0]                   ic_ar_addr;
+   reg  [`IC_LINE_WORDS_LG2-1:0]    ic_fill_word;
+   wire [`IC_LINES_LG2-1:0]         ic_fill_line = ic_ar_addr[`IC_WORDS_LG2+1:`IC_LINE_WORDS_LG2+2];
+   wire                             ic_ar_grant;
+   wire [ 2:0]                      ic_fill_pd;
+
+   yarvi_predecode yarvi_predecode_fill(mem_rdata, ic_fill_pd);
+
+   assign fetch_hold = ic_busy | ptw_busy;
+
+   always @(posedge clock) begin
+      if (ic_ar_grant)
+        ic_ar_req <= 0;
+
+      if (!ic_busy) begin
+         if (s2_valid & s2_ic_miss) begin
+            ic_busy      <= 1;
+            ic_ar_req    <= 1;
+            ic_ar_addr   <= {s2_ppc[`VMSB:`IC_LINE_WORDS_LG2+2], {(`IC_LINE_WORDS_LG2+2){1'd0}}};
+            ic_fill_word <= 0;
+            ic_drop      <= 0;
+            ic_valid[s2_ppc[`IC_WORDS_LG2+1:`IC_LINE_WORDS_LG2+2]] <= 0;
+`ifndef QUIET
+            $display("I$ MISS: %x", s2_ppc);
 `endif
+         end
+      end else if (mem_rvalid & !mem_rd_dc) begin
+         ic_data[{ic_fill_line, ic_fill_word}] <= mem_rdata;
+         ic_pd[{ic_fill_line, ic_fill_word}]   <= ic_fill_pd;
+         ic_fill_word <= ic_fill_word + 1;
+         if (mem_rlast) begin
+            ic_tag[ic_fill_line]   <= ic_ar_addr[`VMSB:`IC_WORDS_LG2+2];
+            ic_valid[ic_fill_line] <= !ic_drop;
+            ic_busy                <= 0;
+         end
+      end
+
+      if (s6_fence_i && dc_clean) begin
+         ic_valid <= 0;
+         ic_drop  <= ic_busy & !(mem_rvalid & !mem_rd_dc & mem_rlast);
+      end
+
+      if (reset) begin
+         ic_valid     <= 0;
+         ic_busy      <= 0;
+         ic_drop      <= 0;
+         ic_ar_req    <= 0;
       end
    end
+`elsif DCACHE
+   assign fetch_hold = 0;
+`else
+   assign fetch_hold = ram_a_busy | ptw_busy;
+`endif
+
+
+
+   // Virtual memory
+   //
+   // With MMU, Sv32 translation in S0 for fetch, through the ITLB, and
+   // in S5 for loads and stores, through the DTLB (see the page table
+   // walker below), for S and U mode and M mode with MPRV.  Everything
+   // after S0 fetches from s0_ppc.  The I$ is physically indexed and
+   // tagged.
+   //
+   // An instruction that misses in the ITLB carries on as a NOP and
+   // replays from S5 like an I$ miss, one with a fetch page fault
+   // carries on as a NOP and traps in S6.  A and D aren't updated in
+   // hardware; an access finding either clear faults.
+   wire [`VMSB:0]          s0_ppc;
+`ifdef MMU
+   wire [1:0]              mmu_d_priv = csr_mstatus`MPRV ? csr_mstatus`MPP : priv;
+   wire                    mmu_i_on = csr_satp`SATP_MODE && priv != `PRV_M;
+   wire                    mmu_d_on = csr_satp`SATP_MODE && mmu_d_priv != `PRV_M;
+   wire                    s0_itlb_hit;
+   wire [`VMSB:0]          s0_itlb_pa;
+/* verilator lint_off UNUSED */
+   wire [7:0]              s0_itlb_flags; // D A G U X W R V
+/* verilator lint_on UNUSED */
+   wire                    s0_itlb_af;
+   wire                    s0_itlb_miss = mmu_i_on && !s0_itlb_hit;
+   wire                    s0_ipf = (mmu_i_on && s0_itlb_hit &&
+                                     (!s0_itlb_flags[0] || !s0_itlb_flags[3] || !s0_itlb_flags[6] ||
+                                      s0_itlb_flags[4] != (priv == `PRV_U)));
+   wire                    s0_iaf = mmu_i_on && s0_itlb_af; // and s0_ipf
+
+   yarvi_tlb #(`TLB_ENTRIES_LG2) itlb
+     ( .clock          (clock)
+     , .asid           (csr_satp`SATP_ASID)
+     , .va             (s0_pc)
+     , .hit            (s0_itlb_hit)
+     , .pa             (s0_itlb_pa)
+     , .flags          (s0_itlb_flags)
+     , .access_fault   (s0_itlb_af)
+     , .fill           (ptw_done & !ptw_d)
+     , .fill_fault     (ptw_bad)
+     , .fill_access    (ptw_access)
+     , .fill_va        (ptw_va)
+     , .fill_mega      (ptw_level)
+     , .fill_asid      (ptw_asid)
+     , .fill_ppn       (ptw_pte[29:10])
+     , .fill_flags     (ptw_pte[7:0])
+     , .clear_fault    (s6_trap)
+     , .flush          (tlb_flush)
+     , .flush_all_va   (s6_insn`rs1 == 0 || reset)
+     , .flush_va       (s6_rs1)
+     , .flush_all_asid (s6_insn`rs2 == 0 || reset)
+     , .flush_asid     (s6_rs2[8:0]));
+
+   assign s0_ppc = mmu_i_on ? s0_itlb_pa : s0_pc;
+`else
+   wire                    s0_itlb_miss = 0;
+   wire                    s0_ipf = 0;
+   wire                    s0_iaf = 0;
+   assign s0_ppc = s0_pc;
+`endif
 
 
 
    // S1 - Start instruction fetch
-   wire                    s1_valid = !s0_restart & !restart;
+   reg                     s1_dup = 0; // copy of an S0 held by fetch_hold, or no S0
+   wire                    s1_valid = !s0_restart & !restart & !s1_dup;
    reg [`VMSB          :0] s1_pc;
    reg [`VMSB          :0] s1_npc;
+`ifdef ICACHE
+   reg [31             :0] s1_insn;
+`elsif DCACHE
    reg [31             :0] s1_insn;
+`else
+   wire [31            :0] s1_insn = ram_a_dout; // read as S0 moves on
+`endif
+   // The predecode bits come from the I$, or else from the word fetched
+`ifdef ICACHE
+   reg [              2:0] s1_pd;
+`else
+   wire [             2:0] s1_pd;
+   yarvi_predecode yarvi_predecode_s1(s1_insn, s1_pd);
+`endif
+`ifdef ICACHE
+   reg [`VMSB:`IC_WORDS_LG2+2] s1_ic_tag;
+   reg                     s1_ic_valid;
+   reg [`VMSB          :0] s1_ppc;
+`endif
+   reg                     s1_itlb_miss = 0;
+   reg                     s1_ipf = 0;
+   reg                     s1_iaf = 0;
    reg [              2:0] s1_btb_type;
    reg                     s1_btb_hit;
-   reg [`YAGS_INDEX_MSB:0] s1_yags_idx;
+   reg [`BTB_WAYS_LG2  :0] s1_btb_way;
+   reg [`BP_META_MSB   :0] s1_yags_idx;
    reg                     s1_yags_hit;
    reg [1              :0] s1_yags_dir;
-   always @(posedge clock) if (!s3_stall | restart) begin
+   reg [`RAS_INDEX_MSB :0] s1_ras_tos;
+   reg [`VMSB          :0] s1_ras_top;
+   reg [`ITC_INDEX_MSB :0] s1_itc_idx;
+   reg                     s1_itc_hit;
+   reg [              1:0] s1_itc_conf;
+   reg [`BR_HISTORY_MSB:0] s1_br_history;
+   reg [`ITC_INDEX_MSB :0] s1_path_history;
+`ifdef RVC
+   reg                     s1_taken;
+   reg                     s1_btb_half;
+`endif
+   always @(posedge clock) if (!s2_stall | restart) begin
+      s1_dup        <= fetch_hold | !s0_valid | pd_redirect;
       s1_pc         <= s0_pc;
       s1_npc        <= s0_npc;
-      s1_insn       <= {code3[s0_pc[`PMSB:2]],code2[s0_pc[`PMSB:2]],code1[s0_pc[`PMSB:2]],code0[s0_pc[`PMSB:2]]};
+      s1_itlb_miss  <= s0_itlb_miss;
+      s1_ipf        <= s0_ipf;
+      s1_iaf        <= s0_iaf;
+`ifdef ICACHE
+      s1_ppc        <= s0_ppc;
+      s1_insn       <= ic_data[s0_ppc[`IC_WORDS_LG2+1:2]];
+      s1_pd         <= ic_pd[s0_ppc[`IC_WORDS_LG2+1:2]];
+      s1_ic_tag     <= ic_tag[s0_ppc[`IC_WORDS_LG2+1:`IC_LINE_WORDS_LG2+2]];
+      s1_ic_valid   <= ic_valid[s0_ppc[`IC_WORDS_LG2+1:`IC_LINE_WORDS_LG2+2]];
+`elsif DCACHE
+      s1_insn       <= {code3[s0_ppc[`PMSB:2]],code2[s0_ppc[`PMSB:2]],code1[s0_ppc[`PMSB:2]],code0[s0_ppc[`PMSB:2]]};
+`endif
       s1_btb_type   <= s0_btb_type;
       s1_btb_hit    <= s0_btb_hit;
+      s1_btb_way    <= s0_btb_way;
       s1_yags_idx   <= s0_yags_idx;
       s1_yags_hit   <= s0_yags_hit;
       s1_yags_dir   <= s0_yags_dir;
+      s1_ras_tos    <= s0_ras_tos;
+      s1_ras_top    <= s0_ras_top;
+      s1_itc_idx    <= s0_itc_idx;
+      s1_itc_hit    <= s0_itc_hit;
+      s1_itc_conf   <= s0_itc_conf;
+      s1_br_history <= s0_br_history;
+      s1_path_history <= s0_path_history;
+`ifdef RVC
+      s1_taken      <= s0_prediction != `BTB_TYPE_BR_W_N;
+      s1_btb_half   <= s0_btb_half;
+`endif
    end
 
 
@@ -469,23 +1296,190 @@ module yarvi
    reg [`VMSB          :0] s2_pc;
    reg [`VMSB          :0] s2_npc;
    reg [31             :0] s2_insn;
+/* verilator lint_off UNUSED */
+   reg [              2:0] s2_pd; // not needed with RVC
+/* verilator lint_on UNUSED */
+   reg                     s2_ic_miss = 0;
+   reg                     s2_itlb_miss = 0;
+   reg                     s2_ipf = 0;
+   reg                     s2_iaf = 0;
+`ifdef ICACHE
+   reg [`VMSB          :0] s2_ppc;
+`endif
    reg [              2:0] s2_btb_type;
    reg                     s2_btb_hit;
-   reg [`YAGS_INDEX_MSB:0] s2_yags_idx;
+   reg [`BTB_WAYS_LG2  :0] s2_btb_way;
+   reg [`BP_META_MSB   :0] s2_yags_idx;
    reg                     s2_yags_hit;
    reg [1              :0] s2_yags_dir;
-   always @(posedge clock) if (!s3_stall | restart) begin
-      s2_valid_r    <= s1_valid;
+   reg [`RAS_INDEX_MSB :0] s2_ras_tos;
+   reg [`VMSB          :0] s2_ras_top;
+   reg [`ITC_INDEX_MSB :0] s2_itc_idx;
+   reg                     s2_itc_hit;
+   reg [              1:0] s2_itc_conf;
+   reg [`BR_HISTORY_MSB:0] s2_br_history;
+   reg [`ITC_INDEX_MSB :0] s2_path_history;
+`ifdef RVC
+   reg                     s2_taken;
+   reg                     s2_btb_half;
+`endif
+   always @(posedge clock) if (!s2_stall | restart) begin
+      s2_valid_r    <= s1_valid & !pd_redirect;
       s2_pc         <= s1_pc;
       s2_npc        <= s1_npc;
       s2_insn       <= s1_insn;
+      s2_pd         <= s1_pd;
+      s2_itlb_miss  <= s1_itlb_miss;
+      s2_ipf        <= s1_ipf;
+      s2_iaf        <= s1_iaf;
+`ifdef ICACHE
+      s2_ppc        <= s1_ppc;
+      s2_ic_miss    <= (!s1_itlb_miss && !s1_ipf &&
+                        (!s1_ic_valid || s1_ic_tag != s1_ppc[`VMSB:`IC_WORDS_LG2+2]));
+`else
+      s2_ic_miss    <= 0;
+`endif
       s2_btb_type   <= s1_btb_type;
       s2_btb_hit    <= s1_btb_hit;
+      s2_btb_way    <= s1_btb_way;
       s2_yags_idx   <= s1_yags_idx;
       s2_yags_hit   <= s1_yags_hit;
       s2_yags_dir   <= s1_yags_dir;
+      s2_ras_tos   <= s1_ras_tos;
+      s2_ras_top   <= s1_ras_top;
+      s2_itc_idx   <= s1_itc_idx;
+      s2_itc_hit   <= s1_itc_hit;
+      s2_itc_conf   <= s1_itc_conf;
+      s2_br_history <= s1_br_history;
+      s2_path_history <= s1_path_history;
+`ifdef RVC
+      s2_taken      <= s1_taken;
+      s2_btb_half   <= s1_btb_half;
+`endif
+
+`ifndef QUIET
+`ifdef RVC
+      if (pd_redirect)
+        $display("PREDICT: %x stale BTB entry, fetch goes on at %x", s2_pc, pd_target);
+`else
+      if (pd_redirect)
+        $display("PREDICT: %x predecode says %s to %x", s2_pc,
+                 s2_pd == `PD_RETURN ? "RETURN" : s2_pd == `PD_CALL ? "CALL" :
+                 s2_pd == `PD_JUMP ? "JUMP" : "BACKWARD BRANCH", pd_target);
+`endif
+`endif
+   end
+
+`ifdef RVC
+   // Align
+   //
+   // Fetch is still a word per cycle and S2 splits the words into
+   // instructions, one per cycle to S3 (expanding the 16-bit ones).  A
+   // 32-bit instruction starting in the high half waits in al_half for
+   // the next word.  When the high half is a second instruction, S0-S2
+   // wait a cycle (al_hold) while S3 takes the first, and al_skip
+   // then marks the low half as done.
+   //
+   // The BTB prediction for a word belongs to the first instruction
+   // ending in or after the halfword of the entry, and if taken, what
+   // follows it in the word is dropped.  If no instruction ends there,
+   // but one starts there, the entry is stale and S0 would have skipped
+   // the word holding the rest of it.  Then S2 redirects S0 to the next
+   // word, as the predecode redirect would, undoing the prediction.
+   // Otherwise a stale entry is just a mispredict in S5.
+   //
+   // Static prediction from predecode assumes aligned words, so RVC
+   // goes without.
+   reg                     al_valid = 0;  // al_half starts a 32-bit instruction
+   reg [             15:0] al_half;
+   reg [`VMSB          :0] al_pc;
+   reg                     al_skip = 0;   // the low half of the S2 word went to S3
+
+   wire                    s2_fault = s2_ic_miss | s2_itlb_miss | s2_ipf;
+   wire                    al_i = s2_pc[1] | al_skip; // first halfword left in S2
+   wire [             15:0] al_h = al_i ? s2_insn[31:16] : s2_insn[15:0];
+   wire [             31:0] al_c_insn;
+
+   yarvi_rvc yarvi_rvc_inst(al_h, al_c_insn);
+
+   reg                     al_emit;       // an instruction goes to S3
+   reg                     al_rvc;
+   reg                     al_k;          // the halfword it ends in
+   reg [`VMSB          :0] al_pc_out;
+   reg [             31:0] al_insn;
+   always @(*) begin
+      al_emit   = 1;
+      al_rvc    = 0;
+      al_k      = 1;
+      al_pc_out = {s2_pc[`VMSB:2], al_i, 1'd0};
+      al_insn   = s2_insn;
+      if (s2_fault) begin
+         // A NOP that restarts or traps, so the rest doesn't matter
+         if (al_valid)
+           al_pc_out = al_pc;
+      end else if (al_valid) begin
+         al_k      = 0;
+         al_pc_out = al_pc;
+         al_insn   = {s2_insn[15:0], al_half};
+      end else if (al_h[1:0] != 2'd3) begin
+         al_rvc    = 1;
+         al_k      = al_i;
+         al_insn   = al_c_insn;
+      end else if (al_i)
+         al_emit   = 0;
    end
 
+   wire                    al_mine  = s2_btb_hit & (al_skip ? s2_btb_half : al_k >= s2_btb_half);
+   wire                    al_drop  = al_mine & s2_taken;
+   wire                    al_rest  = !al_drop & !al_k; // the high half is left
+   wire                    al_hold  = s2_valid & al_rest & s2_insn[17:16] != 2'd3;
+   wire                    al_buf   = s2_valid & !s2_fault & (al_rest & s2_insn[17:16] == 2'd3 | !al_emit);
+   wire [`VMSB         :0] al_npc   = al_drop ? s2_npc : al_pc_out + (al_rvc ? 2 : 4);
+
+   assign s2_stall = s3_stall | al_hold;
+
+   always @(posedge clock)
+     if (restart) begin
+        al_valid <= 0;
+        al_skip  <= 0;
+     end else if (s2_valid & !s3_stall) begin
+        al_valid <= al_buf;
+        al_half  <= s2_insn[31:16];
+        al_pc    <= {s2_pc[`VMSB:2], 2'd2};
+        al_skip  <= al_hold;
+     end
+
+   assign pd_redirect = s2_valid & !s3_stall & al_buf & s2_taken;
+   assign pd_target   = {s2_pc[`VMSB:2], 2'd0} + 4;
+   assign pd_type     = `PD_OTHER;
+   assign pd_pc       = s2_pc;
+   assign pd_ras_tos  = s2_ras_tos;
+   assign pd_ras_top  = s2_ras_top;
+   assign pd_br_history = s2_br_history;
+   assign pd_path_history = s2_path_history;
+`else
+   assign s2_stall = s3_stall;
+
+   // Static prediction on a BTB miss: predecode marks backward
+   // branches, JALs, and returns which are predicted taken, returns
+   // with the RAS.  This redirects S0 and drops what's in S1 and S0,
+   // costing two bubbles rather than a restart from S6.  The histories
+   // go back to the checkpoint taken when S0 fetched the instruction,
+   // plus its own branch or jump, undoing the dropped fetches.
+   wire [`VMSB         :0] s2_sb_imm = {{(`VMSB-11){s2_insn[31]}}, s2_insn[7], s2_insn[30:25], s2_insn[11:8], 1'd0};
+   wire [`VMSB         :0] s2_uj_imm = {{(`VMSB-19){s2_insn[31]}}, s2_insn[19:12], s2_insn[20], s2_insn[30:21], 1'd0};
+
+   assign pd_redirect = s2_valid & !s3_stall & !s2_btb_hit & !s2_ic_miss & !s2_itlb_miss & !s2_ipf &
+                        (s2_pd == `PD_BR_BACK || s2_pd == `PD_RETURN || s2_pd[2]);
+   assign pd_target   = s2_pd == `PD_RETURN ? s2_ras_top : s2_pc + (s2_pd[2] ? s2_uj_imm : s2_sb_imm);
+   assign pd_type     = s2_pd;
+   assign pd_pc       = s2_pc;
+   assign pd_ras_tos  = s2_ras_tos;
+   assign pd_ras_top  = s2_ras_top;
+   assign pd_br_history = s2_pd == `PD_BR_BACK ? (s2_br_history << 1) | 1'd1 : s2_br_history;
+   assign pd_path_history = s2_pd[2] ? (s2_path_history << 2) ^ pd_target[`ITC_INDEX_MSB+2:2] : s2_path_history;
+`endif
+
 
 
    // S3 - RF, stall if needed, read registers
@@ -494,23 +1488,49 @@ module yarvi
    reg [`XMSB          :0] s3_pc;
    reg [`XMSB          :0] s3_npc;
    reg [   31:          0] s3_insn;
+   reg                     s3_ic_miss = 0; // or ITLB miss
+   reg                     s3_ipf = 0;
+   reg                     s3_iaf = 0;
    reg [              2:0] s3_btb_type;
    reg                     s3_btb_hit;
-   reg [`YAGS_INDEX_MSB:0] s3_yags_idx;
+   reg [`BTB_WAYS_LG2  :0] s3_btb_way;
+   reg [`BP_META_MSB   :0] s3_yags_idx;
    reg                     s3_yags_hit;
    reg [1              :0] s3_yags_dir;
-   always @(posedge clock) begin
-      s3_valid_r     <= s2_valid;
-   end
+   reg [`RAS_INDEX_MSB :0] s3_ras_tos;
+   reg [`VMSB          :0] s3_ras_top;
+   reg [`ITC_INDEX_MSB :0] s3_itc_idx;
+   reg                     s3_itc_hit;
+   reg [              1:0] s3_itc_conf;
+   reg                     s3_rvc = 0;
    always @(posedge clock) if (!s3_stall | restart) begin
+`ifdef RVC
+      s3_valid_r     <= s2_valid & al_emit;
+      s3_pc          <= al_pc_out;
+      s3_npc         <= al_npc;
+      s3_insn        <= s2_fault ? 32'h 13 : al_insn; // NOP
+      s3_rvc         <= al_rvc;
+      s3_btb_hit     <= al_mine;
+`else
+      s3_valid_r     <= s2_valid;
       s3_pc          <= s2_pc;
-      s3_npc         <= s2_npc;
-      s3_insn        <= s2_insn;
-      s3_btb_type    <= s2_btb_type;
+      s3_npc         <= pd_redirect ? pd_target : s2_npc;
+      s3_insn        <= s2_ic_miss | s2_itlb_miss | s2_ipf ? 32'h 13 : s2_insn; // NOP
       s3_btb_hit     <= s2_btb_hit;
+`endif
+      s3_ic_miss     <= s2_ic_miss | s2_itlb_miss;
+      s3_ipf         <= s2_ipf;
+      s3_iaf         <= s2_iaf;
+      s3_btb_type    <= s2_btb_type;
+      s3_btb_way     <= s2_btb_way;
       s3_yags_idx    <= s2_yags_idx;
       s3_yags_hit    <= s2_yags_hit;
       s3_yags_dir    <= s2_yags_dir;
+      s3_ras_tos    <= s2_ras_tos;
+      s3_ras_top    <= s2_ras_top;
+      s3_itc_idx    <= s2_itc_idx;
+      s3_itc_hit    <= s2_itc_hit;
+      s3_itc_conf    <= s2_itc_conf;
    end
 
    wire [`XMSB-12:0] s3_sext12 = {(`XMSB-11){s3_insn[31]}};
@@ -537,18 +1557,69 @@ module yarvi
                  = s3_insn`opcode == `AUIPC ||
                    s3_insn`opcode == `LUI    ? {1'd1, s3_insn[31:12], 12'd 0} :
                    s3_insn`opcode == `JALR  ||
-                   s3_insn`opcode == `JAL    ? {1'd1, 32'd 4}              :
+                   s3_insn`opcode == `JAL    ? {1'd1, s3_rvc ? 32'd 2 : 32'd 4} :
                    s3_insn`opcode == `SYSTEM ? {1'd1, 32'd 0}              :
                    s3_insn`opcode == `OP_IMM ||
                    s3_insn`opcode == `OP_IMM_32 ||
                    s3_insn`opcode == `LOAD   ? {1'd1, s3_i_imm}            :
                    s3_insn`opcode == `STORE  ? {1'd1, s3_s_imm}            :
                                        0;
+   // Loads, atomics, multiplies, and divides have their results in S7
+   // at the earliest
+`ifndef NO_MULDIV
+   wire s4_late = (s4_insn`opcode == `LOAD || s4_insn`opcode == `AMO ||
+                   s4_insn`opcode == `OP && s4_insn`funct7 == `MULDIV);
+   wire s5_late = (s5_insn`opcode == `LOAD || s5_insn`opcode == `AMO ||
+                   s5_insn`opcode == `OP && s5_insn`funct7 == `MULDIV);
+`else
+   wire s4_late = s4_insn`opcode == `LOAD || s4_insn`opcode == `AMO;
+   wire s5_late = s5_insn`opcode == `LOAD || s5_insn`opcode == `AMO;
+`endif
+   // An AMO writes memory from S8 (see the atomics), so an access
+   // behind it waits here until it's in S7
+   wire s3_mem = (s3_insn`opcode == `LOAD || s3_insn`opcode == `STORE ||
+                  s3_insn`opcode == `AMO);
+   wire s3_amo_wait = (s4_valid && `IS_AMO_RMW(s4_insn) ||
+                       s5_valid && `IS_AMO_RMW(s5_insn) ||
+                       s6_valid && `IS_AMO_RMW(s6_insn));
    assign s3_stall
-     = s3_use_rs1 && s3_insn`rs1 == s4_rd && s4_insn`opcode == `LOAD ||
-       s3_use_rs2 && s3_insn`rs2 == s4_rd && s4_insn`opcode == `LOAD ||
-       s3_use_rs1 && s3_insn`rs1 == s5_rd && s5_insn`opcode == `LOAD ||
-       s3_use_rs2 && s3_insn`rs2 == s5_rd && s5_insn`opcode == `LOAD;
+     = s3_use_rs1 && s3_insn`rs1 == s4_rd && s4_late ||
+       s3_use_rs2 && s3_insn`rs2 == s4_rd && s4_late ||
+       s3_use_rs1 && s3_insn`rs1 == s5_rd && s5_late ||
+       s3_use_rs2 && s3_insn`rs2 == s5_rd && s5_late ||
+       s3_mem && s3_amo_wait;
+
+   // Fuse
+   //
+   // An instruction in S3 that finishes what the one in S4 started
+   // issues as one operation with it: LUI+ADDI builds a constant,
+   // AUIPC+ADDI an address, AUIPC+JALR is a far call, AUIPC+load reads
+   // PC-relative data, and SLLI+SRLI by the same amount zero-extends.
+   // Both write the same rd and the second only reads that, so the
+   // first has no result of its own to write.  The second goes on with
+   // its operand from the first: the constant or address, or for the
+   // shifts the SLLI's own rs1 (s3_rs1) ANDed with a mask, so that is
+   // also the register S4 waits on (s4_rs1).  The first leaves S4 as a
+   // bubble which still carries its pc and insn, so it retires just
+   // ahead of the second, and restarts and traps of the pair go back
+   // to it.
+   wire s3_addi = s3_opcode == `OP_IMM && s3_insn`funct3 == `ADDSUB;
+   wire s3_zext = (s4_insn`opcode == `OP_IMM && s4_insn`funct3 == `SLL && s4_insn`funct7 == 0 &&
+                   s3_opcode == `OP_IMM && s3_insn`funct3 == `SR_ && s3_insn`funct7 == 0 &&
+                   s3_insn`rs2 == s4_insn`rs2);
+`ifndef NO_FUSION
+   wire s3_fuse = (s3_valid && s4_valid && !s3_stall &&
+                   s4_rd != 0 && s3_insn`rs1 == s4_rd && s3_rd == s4_rd &&
+                   s4_insn_target == s3_pc &&
+                   (s4_insn`opcode == `LUI && s3_addi ||
+                    s4_insn`opcode == `AUIPC && (s3_addi || s3_opcode == `JALR || s3_opcode == `LOAD) ||
+                    s3_zext));
+`else
+   wire s3_fuse = 0;
+`endif
+   wire [`XMSB:0] s3_fuse_base = (s4_insn`opcode == `AUIPC ? s4_pc : 0) + {s4_insn[31:12], 12'd 0};
+   wire [`XMSB:0] s3_fuse_mask = {(`XMSB+1){1'd1}} >> s3_insn`rs2;
+   wire [    4:0] s3_rs1 = s3_fuse && s3_zext ? s4_insn`rs1 : s3_insn`rs1;
 
 
 
@@ -559,15 +1630,31 @@ module yarvi
    reg [`XMSB          :0] s4_pc;
    reg [`XMSB          :0] s4_npc;
    reg [   31          :0] s4_insn;
+   reg                     s4_ic_miss = 0;
+   reg                     s4_ipf = 0;
+   reg                     s4_iaf = 0;
+   reg                     s4_use_rs1 = 0;
+   reg                     s4_use_rs2 = 0;
    reg [    4          :0] s4_rd;
+   reg [    4          :0] s4_rs1;  // s4_insn`rs1, or the SLLI's for a fused zext
    reg [`XMSB          :0] s4_rs1_rf;
    reg [`XMSB          :0] s4_rs2_rf;
    reg [`XMSB          :0] s4_op2_imm;
    reg [              2:0] s4_btb_type;
    reg                     s4_btb_hit;
-   reg [`YAGS_INDEX_MSB:0] s4_yags_idx;
+   reg [`BTB_WAYS_LG2  :0] s4_btb_way;
+   reg [`BP_META_MSB   :0] s4_yags_idx;
    reg                     s4_yags_hit;
    reg [1              :0] s4_yags_dir;
+   reg [`RAS_INDEX_MSB :0] s4_ras_tos;
+   reg [`VMSB          :0] s4_ras_top;
+   reg [`ITC_INDEX_MSB :0] s4_itc_idx;
+   reg                     s4_itc_hit;
+   reg [              1:0] s4_itc_conf;
+   reg                     s4_rvc = 0;
+   reg                     s4_fused = 0;
+   reg                     s4_fuse_zext = 0;
+   reg [`XMSB          :0] s4_fuse_base;
 
    // Possible targets for normal execution:
    // - statically determined (+4 or jump target)
@@ -581,17 +1668,33 @@ module yarvi
       s4_pc          <= s3_pc;
       s4_npc         <= s3_npc;
       s4_insn        <= s3_insn;
+      s4_ic_miss     <= s3_ic_miss;
+      s4_ipf         <= s3_ipf;
+      s4_iaf         <= s3_iaf;
+      s4_use_rs1     <= s3_use_rs1;
+      s4_use_rs2     <= s3_use_rs2;
       s4_rd          <= s3_stall ? 0 : s3_rd;
-      s4_rs1_rf      <= regs[s3_insn`rs1];
+      s4_rs1         <= s3_rs1;
+      s4_rs1_rf      <= regs[s3_rs1];
       s4_rs2_rf      <= regs[s3_insn`rs2];
-      s4_op2_imm     <= s3_op2_imm;
+      s4_op2_imm     <= s3_fuse && s3_zext ? s3_fuse_mask : s3_op2_imm;
+      s4_fused       <= s3_fuse;
+      s4_fuse_zext   <= s3_fuse && s3_zext;
+      s4_fuse_base   <= s3_fuse_base;
       s4_btb_type    <= s3_btb_type;
       s4_btb_hit     <= s3_btb_hit;
+      s4_btb_way     <= s3_btb_way;
       s4_yags_idx    <= s3_yags_idx;
       s4_yags_hit    <= s3_yags_hit;
       s4_yags_dir    <= s3_yags_dir;
+      s4_ras_tos    <= s3_ras_tos;
+      s4_ras_top    <= s3_ras_top;
+      s4_itc_idx    <= s3_itc_idx;
+      s4_itc_hit    <= s3_itc_hit;
+      s4_itc_conf    <= s3_itc_conf;
+      s4_rvc         <= s3_rvc;
       s4_br_target   <= s3_pc + s3_sb_imm;
-      s4_insn_target <= s3_pc + 4;
+      s4_insn_target <= s3_pc + (s3_rvc ? 2 : 4);
       case (s3_insn`opcode)
         `JAL: s4_insn_target <= s3_pc + s3_uj_imm;
       endcase
@@ -610,7 +1713,12 @@ module yarvi
        `CSR_FCSR:         s4_csr_val <= {24'd0, csr_frm, csr_fflags};
 
        `CSR_MSTATUS:      s4_csr_val <= csr_mstatus;
-       `CSR_MISA:         s4_csr_val <= (32'd 2 << 30) | (32'd 1 << ("I"-"A"));
+`ifdef MMU
+       `CSR_MISA:         s4_csr_val <= (32'd 2 << 30) | (32'd 1 << ("A"-"A")) | (32'd 1 << ("I"-"A")) | `MISA_M | `MISA_C | `MISA_B |
+                                        (32'd 1 << ("S"-"A")) | (32'd 1 << ("U"-"A"));
+`else
+       `CSR_MISA:         s4_csr_val <= (32'd 2 << 30) | (32'd 1 << ("A"-"A")) | (32'd 1 << ("I"-"A")) | `MISA_M | `MISA_C | `MISA_B;
+`endif
        `CSR_MIE:          s4_csr_val <= {{(`XMSB-11){1'd0}}, csr_mie};
        `CSR_MTVEC:        s4_csr_val <= csr_mtvec;
 
@@ -638,6 +1746,9 @@ module yarvi
        `CSR_SCAUSE:       s4_csr_val <= csr_scause;
        `CSR_STVAL:        s4_csr_val <= csr_stval;
        `CSR_STVEC:        s4_csr_val <= csr_stvec;
+       `CSR_SSTATUS:      s4_csr_val <= csr_mstatus & `SSTATUS_WMASK;
+       `CSR_SSCRATCH:     s4_csr_val <= csr_sscratch;
+       `CSR_SATP:         s4_csr_val <= csr_satp;
 
        `CSR_CYCLE:        s4_csr_val <= csr_mcycle;
        `CSR_INSTRET:      s4_csr_val <= csr_minstret;
@@ -650,22 +1761,24 @@ module yarvi
 
    always @(posedge clock)
      s4_alu_op1_src
-       <= s3_opcode == `LUI   ||
+       <= s3_fuse && s3_addi ? 0 :
+          s3_opcode == `LUI   ||
           s3_opcode == `AUIPC ||
           s3_opcode == `JALR  ||
           s3_opcode == `JAL    ? 0 :
           s3_opcode == `SYSTEM ? 7 :
           !s3_use_rs1          ? 1 :
-          s3_insn`rs1 == s4_rd ? 2 :
-          s3_insn`rs1 == s5_rd ? 3 :
-          s3_insn`rs1 == s6_rd ? 4 :
-          s3_insn`rs1 == s7_rd ? 5 :
+          s3_rs1 == s4_rd && !s3_fuse ? 2 :
+          s3_rs1 == s5_rd      ? 3 :
+          s3_rs1 == s6_rd      ? 4 :
+          s3_rs1 == s7_rd      ? 5 :
           /*                  */ 1;
 
    reg [`XMSB:0] s4_alu_op1_imm;
    always @(posedge clock)
      s4_alu_op1_imm
-       <= s3_opcode == `LUI    ? 0 :
+       <= s3_fuse && s3_addi   ? s3_fuse_base :
+          s3_opcode == `LUI    ? 0 :
           s3_opcode == `AUIPC ||
           s3_opcode == `JALR  ||
           s3_opcode == `JAL    ? s3_pc : 'hX;
@@ -678,6 +1791,10 @@ module yarvi
    reg  [`XMSB          :0] s5_pc;
    reg  [`XMSB          :0] s5_npc;
    reg  [   31          :0] s5_insn;
+   reg                      s5_replay = 0; // refetch, don't execute
+   reg                      s5_ma_second = 0; // second word of a split access
+   reg                      s5_ipf = 0; // fetch page fault, trap in S6
+   reg                      s5_iaf = 0; // or rather an access fault
    reg  [    4          :0] s5_rd;
    wire [`XMSB          :0] s5_wb_val;
    wire [    4          :0] s5_opcode = s5_insn`opcode;
@@ -695,21 +1812,53 @@ module yarvi
    reg  [`XMSB          :0] s5_alu_op1, s5_alu_op2;
    reg  [              2:0] s5_btb_type;
    reg                      s5_btb_hit;
-   reg  [`YAGS_INDEX_MSB:0] s5_yags_idx;
+   reg  [`BTB_WAYS_LG2  :0] s5_btb_way;
+   reg  [`BP_META_MSB   :0] s5_yags_idx;
    reg                      s5_yags_hit;
-   reg  [              1:0] s5_yags_dir;
+/* verilator lint_off UNUSED */
+   reg  [              1:0] s5_yags_dir; // not needed with TAGE
+/* verilator lint_on UNUSED */
+   reg  [`RAS_INDEX_MSB :0] s5_ras_tos;
+   reg  [`VMSB          :0] s5_ras_top;
+   reg  [`ITC_INDEX_MSB :0] s5_itc_idx;
+   reg                      s5_itc_hit;
+   reg  [              1:0] s5_itc_conf;
+   reg                      s5_rvc = 0;
+   reg                      s5_fused = 0;
+
+   // The pc after the instruction, and the one the predictors know it
+   // by, which with RVC is its last halfword, as that's the word S0
+   // fetched when it predicted it
+   wire [`XMSB          :0] s5_seq_pc = s5_pc + (s5_rvc ? 2 : 4);
+`ifdef RVC
+   wire [`XMSB          :0] s5_bp_pc = s5_pc + (s5_rvc ? 0 : 2);
+`else
+   wire [`XMSB          :0] s5_bp_pc = s5_pc;
+`endif
+
+   // Where to restart the instruction from, which for a fused pair is
+   // the first of the two, in the bubble just ahead
+   wire [`XMSB          :0] s5_first_pc = s5_fused ? s6_pc : s5_pc;
 
    always @(posedge clock) begin
-      s5_valid_r          <= s4_valid;
+      s5_valid_r          <= s4_valid & !s3_fuse;
+      s5_rvc              <= s4_rvc;
+      s5_fused            <= s4_fused;
       s5_insn_target      <= s4_insn_target;
       s5_pc_insn_miss     <= s4_insn_target != s4_npc;
       s5_br_target        <= s4_br_target;
       s5_br_target_miss   <= s4_br_target != s4_npc;
       s5_btb_type         <= s4_btb_type;
       s5_btb_hit          <= s4_btb_hit;
+      s5_btb_way          <= s4_btb_way;
       s5_yags_idx         <= s4_yags_idx;
       s5_yags_hit         <= s4_yags_hit;
       s5_yags_dir         <= s4_yags_dir;
+      s5_ras_tos          <= s4_ras_tos;
+      s5_ras_top          <= s4_ras_top;
+      s5_itc_idx          <= s4_itc_idx;
+      s5_itc_hit          <= s4_itc_hit;
+      s5_itc_conf         <= s4_itc_conf;
    end
 
    reg s5_alu_sub = 0;
@@ -725,9 +1874,65 @@ module yarvi
    always @(posedge clock)
      s5_alu_ashr <= s4_insn[30];
 
+   // Zba, Zbb, and Zbs are told apart from the RV32I operations by
+   // funct7 (and for the unary ones, the rs2 field)
+   reg [4:0] s4_alu_bop;
+   always @(*) begin
+      s4_alu_bop = `ALU_BASE;
+`ifndef NO_BITMANIP
+      if (s4_opcode == `OP)
+        case ({s4_insn`funct7, s4_insn`funct3})
+          {7'h10, 3'd2}: s4_alu_bop = `ALU_SH1ADD;
+          {7'h10, 3'd4}: s4_alu_bop = `ALU_SH2ADD;
+          {7'h10, 3'd6}: s4_alu_bop = `ALU_SH3ADD;
+          {7'h20, 3'd7}: s4_alu_bop = `ALU_ANDN;
+          {7'h20, 3'd6}: s4_alu_bop = `ALU_ORN;
+          {7'h20, 3'd4}: s4_alu_bop = `ALU_XNOR;
+          {7'h05, 3'd4}: s4_alu_bop = `ALU_MIN;
+          {7'h05, 3'd5}: s4_alu_bop = `ALU_MINU;
+          {7'h05, 3'd6}: s4_alu_bop = `ALU_MAX;
+          {7'h05, 3'd7}: s4_alu_bop = `ALU_MAXU;
+          {7'h30, 3'd1}: s4_alu_bop = `ALU_ROL;
+          {7'h30, 3'd5}: s4_alu_bop = `ALU_ROR;
+          {7'h04, 3'd4}: if (s4_insn`rs2 == 0) s4_alu_bop = `ALU_ZEXTH;
+          {7'h24, 3'd1}: s4_alu_bop = `ALU_BCLR;
+          {7'h14, 3'd1}: s4_alu_bop = `ALU_BSET;
+          {7'h34, 3'd1}: s4_alu_bop = `ALU_BINV;
+          {7'h24, 3'd5}: s4_alu_bop = `ALU_BEXT;
+          default: ;
+        endcase
+      else if (s4_opcode == `OP_IMM)
+        case ({s4_insn`funct7, s4_insn`funct3})
+          {7'h30, 3'd1}:
+            case (s4_insn`rs2)
+              0: s4_alu_bop = `ALU_CLZ;
+              1: s4_alu_bop = `ALU_CTZ;
+              2: s4_alu_bop = `ALU_CPOP;
+              4: s4_alu_bop = `ALU_SEXTB;
+              5: s4_alu_bop = `ALU_SEXTH;
+              default: ;
+            endcase
+          {7'h30, 3'd5}: s4_alu_bop = `ALU_ROR;
+          {7'h14, 3'd5}: if (s4_insn`rs2 == 7) s4_alu_bop = `ALU_ORCB;
+          {7'h34, 3'd5}: if (s4_insn`rs2 == 24) s4_alu_bop = `ALU_REV8;
+          {7'h24, 3'd1}: s4_alu_bop = `ALU_BCLR;
+          {7'h14, 3'd1}: s4_alu_bop = `ALU_BSET;
+          {7'h34, 3'd1}: s4_alu_bop = `ALU_BINV;
+          {7'h24, 3'd5}: s4_alu_bop = `ALU_BEXT;
+          default: ;
+        endcase
+`endif
+   end
+
+   reg [4:0] s5_alu_bop = `ALU_BASE;
+   always @(posedge clock)
+     s5_alu_bop <= s4_alu_bop;
+
    reg [2:0] s5_alu_funct3 = 0;
    always @(posedge clock)
-     s5_alu_funct3 <= (s4_opcode == `OP        ||
+     s5_alu_funct3 <= (s4_fuse_zext             ? `AND :
+                       s4_alu_bop != `ALU_BASE ? `XOR :
+                       s4_opcode == `OP        ||
                        s4_opcode == `OP_IMM    ||
                        s4_opcode == `OP_IMM_32 ? s4_insn`funct3 : `ADDSUB);
 
@@ -769,15 +1974,17 @@ module yarvi
 
    always @(posedge clock)
      s4_rs1_src
-       <= !s3_use_rs1          ? 1 :
-          s3_insn`rs1 == s4_rd ? 2 :
-          s3_insn`rs1 == s5_rd ? 3 :
-          s3_insn`rs1 == s6_rd ? 4 :
-          s3_insn`rs1 == s7_rd ? 5 :
+       <= s3_fuse && !s3_zext  ? 0 :
+          !s3_use_rs1          ? 1 :
+          s3_rs1 == s4_rd && !s3_fuse ? 2 :
+          s3_rs1 == s5_rd      ? 3 :
+          s3_rs1 == s6_rd      ? 4 :
+          s3_rs1 == s7_rd      ? 5 :
           /*                  */ 1;
 
    always @(posedge clock)
      case (s4_rs1_src)
+       0: s5_rs1 <= s4_fuse_base;
        1: s5_rs1 <= s4_rs1_rf;
        2: s5_rs1 <= s5_wb_val;
        3: s5_rs1 <= s6_wb_val;
@@ -812,6 +2019,7 @@ module yarvi
                       .ashr(s5_alu_ashr),
                       .funct3(s5_alu_funct3),
                       .w(1 'd 0),
+                      .bop(s5_alu_bop),
                       .op1(s5_alu_op1),
                       .op2(s5_alu_op2),
                       .result(s5_wb_val),
@@ -828,10 +2036,21 @@ module yarvi
       s5_pc      <= s4_pc;
       s5_npc     <= s4_npc;
       s5_insn    <= s4_insn;
-      s5_rd      <= s4_valid ? s4_rd : 0;
+      s5_replay  <= s4_ic_miss | s4_dc_wait | s4_md_wait;
+      s5_ipf     <= s4_ipf;
+      s5_iaf     <= s4_iaf;
+      s5_rd      <= s4_valid & !s3_fuse ? s4_rd : 0;
       s5_s_imm   <= s4_s_imm;
-      s5_i_imm   <= s4_i_imm;
+      s5_i_imm   <= s4_opcode == `AMO ? 0 : s4_i_imm;
       s5_csr_val <= s4_csr_val;
+
+      // The second beat of a split access is the access itself, four
+      // bytes on
+      s5_ma_second <= ma_second && s4_pc == ma_pc;
+      if (ma_second && s4_pc == ma_pc) begin
+         s5_s_imm <= s4_s_imm + 4;
+         s5_i_imm <= s4_i_imm + 4;
+      end
    end
 
    always @(*) begin
@@ -847,9 +2066,12 @@ module yarvi
 
    reg              s6_valid_r = 0;
    reg              s6_flush = 0;
-   wire             s6_valid = s6_valid_r;
+   wire             s6_valid = s6_valid_r & !s6_flush;
    reg  [`XMSB:0]   s6_pc;
    reg  [   31:0]   s6_insn;
+   reg              s6_fused = 0;
+   reg              s6_rvc = 0;
+   wire [`XMSB:0]   s6_first_pc = s6_fused ? s7_pc : s6_pc; // see s5_first_pc
    reg  [    1:0]   s6_priv;
 
    reg              s6_restart = 1;
@@ -881,61 +2103,120 @@ module yarvi
    reg [    3:0]    s6_trap_cause;
    reg [`XMSB:0]    s6_trap_val;
    reg              s6_intr;
+   reg              s6_ma_second = 0;
+   reg              ma_second = 0; // the access at ma_pc is replaying for its second word
+   reg [`VMSB:0]    ma_pc;
    reg [    3:0]    s6_cause;
    reg              s6_deleg;
-   reg [`XMSB:0]    s6_addr;
+   reg [`XMSB:0]    s6_addr;     // physical
+`ifdef MMU
+   reg [`XMSB:0]    s6_va;
+   reg              s6_dtlb_miss = 0;
+   reg              s6_dpf = 0;
+   reg              s6_daf = 0;  // and s6_dpf
+`else
+   wire [`XMSB:0]   s6_va = s6_addr;
+   wire             s6_dtlb_miss = 0;
+   wire             s6_dpf = 0;
+   wire             s6_daf = 0;
+`endif
+   reg              s6_ipf = 0;
+   reg              s6_iaf = 0;
 
    wire [`XMSB:0]   m1_load_addr;
 
+`ifndef TAGE
    wire [1:0] yags_new_direction =
               s5_yags_hit
               ? (s5_branch_taken
                  ? s5_yags_dir == `BTB_TYPE_BR_S_T ? `BTB_TYPE_BR_S_T : s5_yags_dir + 1
                  : s5_yags_dir == `BTB_TYPE_BR_S_N ? `BTB_TYPE_BR_S_N : s5_yags_dir - 1)
               : s5_branch_taken ? `BTB_TYPE_BR_W_T : `BTB_TYPE_BR_W_N;
+`endif
 
-   // A precise retirement RAS and branch history
-   reg [`VMSB          :0] rras0 = 0, rras1 = 0, rras2 = 0;
-   reg [`YAGS_INDEX_MSB:0] rbr_history = 0;
+   // A precise retirement branch history, and the RAS state to restart
+   // with: the S5 instruction's checkpoint with its push or pop applied,
+   // or for restarts from S6, the S6 instruction's checkpoint.  Unless
+   // rras_we, the top is whatever ras[rras_tos] holds.
+   reg [`BR_HISTORY_MSB:0] rbr_history = 0;
+   reg [`ITC_INDEX_MSB :0] rpath_history = 0;
+
+   // The BTB way a miss in S5 allocates
+   reg [`BTB_WAYS_LG2  :0] btb_victim;
+`ifndef BTB_REPLACE_RANDOM
+   wire [`BTB_WAYS-1   :0] s5_btb_nru = btb_nru[s5_bp_pc[`BTB_INDEX_MSB+2:2]];
+   integer                 btb_v;
+`endif
+   always @(*) begin
+`ifdef BTB_REPLACE_RANDOM
+      btb_victim = btb_lfsr & (`BTB_WAYS - 1);
+`else
+      btb_victim = 0;
+      for (btb_v = `BTB_WAYS - 1; btb_v >= 0; btb_v = btb_v - 1)
+        if (!s5_btb_nru[btb_v])
+          btb_victim = btb_v;
+`endif
+   end
+
+   // A JALR that isn't a return, that is, one the ITC predicts
+   wire                    s5_jalr_indirect = s5_insn`rs1 != 1 && s5_insn`rs1 != 5 || s5_insn`rd == 1 || s5_insn`rd == 5;
+   reg [`RAS_INDEX_MSB :0] rras_tos = 0;
+   reg [`VMSB          :0] rras_top = 0;
+   reg                     rras_we = 0;
+   reg [`RAS_INDEX_MSB :0] s6_ras_tos;
+   reg [`VMSB          :0] s6_ras_top;
    always @(posedge clock) begin
       s6_valid_r      <= s5_valid;
       s6_pc           <= s5_pc;
+      s6_fused        <= s5_fused;
+      s6_rvc          <= s5_rvc;
       s6_insn         <= s5_insn;
       s6_rs1          <= s5_rs1;
       s6_rs2          <= s5_rs2;
       s6_rd           <= s5_valid ? s5_rd : 0;
+      s6_ma_second    <= s5_ma_second;
+      s6_ipf          <= s5_ipf;
+      s6_iaf          <= s5_iaf;
       s6_branch_taken <= s5_branch_taken;
       s6_intr         <= csr_mip_and_mie != 0 && csr_mstatus`MIE;
+      s6_ras_tos      <= s5_ras_tos;
+      s6_ras_top      <= s5_ras_top;
 
       s6_wb_val       <= s5_wb_val;
       s6_flush        <= 0;
       s6_csr_val      <= s5_csr_val;
-      s6_addr         <= s5_opcode == `LOAD || s5_opcode == `STORE ?
-                         s5_rs1 + (s5_opcode == `LOAD ? s5_i_imm : s5_s_imm) : 0;
+`ifdef MMU
+      s6_addr         <= s5_opcode == `LOAD || s5_opcode == `STORE || s5_opcode == `AMO ? s5_pa : 0;
+      s6_va           <= s5_va;
+      s6_dtlb_miss    <= s5_dtlb_miss;
+      s6_dpf          <= s5_dpf;
+      s6_daf          <= s5_daf;
+`else
+      s6_addr         <= s5_opcode == `LOAD || s5_opcode == `STORE || s5_opcode == `AMO ?
+                         s5_rs1 + (s5_opcode == `STORE ? s5_s_imm : s5_i_imm) : 0;
+`endif
 
       s6_restart      <= s5_pc_insn_miss & s5_valid;
       s6_restart_pc   <= s5_insn_target;
       btb_update      <= s5_pc_insn_miss & s5_valid;
-      btb_update_idx  <= s5_pc[`BTB_INDEX_MSB+2:2];
+      btb_update_idx  <= s5_bp_pc[`BTB_INDEX_MSB+2:2] + ((s5_btb_hit ? s5_btb_way : btb_victim) << (`BTB_INDEX_MSB + 1));
+`ifdef RVC
+      btb_update_half <= s5_bp_pc[1];
+`endif
+      btb_touch       <= s5_valid & s5_btb_hit;
       btb_update_type <= `BTB_TYPE_BR_W_N;
       yags_update     <= 0;
+      itc_update      <= 0;
+      itc_update_idx  <= s5_itc_idx;
+      itc_update_tag  <= s5_bp_pc[`ITC_TAG_MSB+`ITC_INDEX_MSB+3:`ITC_INDEX_MSB+3] ^ s5_bp_pc[`ITC_TAG_MSB+2:2];
+      itc_update_target <= s5_jalr_target[`VMSB:`INSN_LSB];
 
-      if (s5_valid)
-        case (s5_opcode)
-          `LOAD: begin
-             // XXX This is conservative, but I just want it passing for now
-             // XXX Could be retimed by precomputing s6_addr - s5_s_imm and then just compare with s5_rs1
-             if (s6_valid && s6_insn`opcode == `STORE && s6_addr[`PMSB:2] == m1_load_addr[`PMSB:2] ||
-                 s7_valid && s7_insn`opcode == `STORE && s7_addr[`PMSB:2] == m1_load_addr[`PMSB:2]) begin
-                s6_flush <= 1;
-                s6_restart <= 1;
-                s6_restart_pc <= s5_pc;
-`ifndef QUIET
-                $display("RESTART: %x  load-hit-store", s5_pc);
-`endif
-             end
-          end
+      rras_tos        <= s5_ras_tos;
+      rras_top        <= s5_ras_top;
+      rras_we         <= 1;
 
+      if (s5_valid & !s5_replay & !s6_replay)
+        case (s5_opcode)
           `BRANCH: begin
              rbr_history <= (rbr_history << 1) | s5_branch_taken;
              if (s5_branch_taken)
@@ -947,23 +2228,31 @@ module yarvi
                   s6_restart <= 0; // The common path will presume a misprediction
                end
 
-             btb_update_tag <= s5_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
-             btb_update_target <= s5_br_target >> 2;
+             btb_update_tag <= s5_bp_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
+             btb_update_target <= `BTB_ENCODE(s5_bp_pc, s5_br_target);
 
 `ifndef QUIET
+`ifndef TAGE
              if (s5_yags_hit)
                $display("%x/%x hit in YAGS[%x] with direction %d, updating to %d", s5_pc, rbr_history,
-                        s5_pc[`YAGS_INDEX_MSB+2:2] ^ rbr_history,
+                        s5_bp_pc[`YAGS_INDEX_MSB+2:2] ^ rbr_history,
                         s5_yags_dir, yags_new_direction);
              else
                $display("%x/%x updating YAGS[%x] to direction %d", s5_pc, rbr_history,
-                        s5_pc[`YAGS_INDEX_MSB+2:2] ^ rbr_history,
+                        s5_bp_pc[`YAGS_INDEX_MSB+2:2] ^ rbr_history,
                         yags_new_direction);
+`endif
 `endif
              yags_update <= 1;
              yags_update_idx <= s5_yags_idx;
-             yags_update_tag <= s5_pc[`YAGS_TAG_MSB+`YAGS_INDEX_MSB+3:`YAGS_INDEX_MSB+3];
+`ifdef TAGE
+             yags_update_pc <= s5_bp_pc;
+             yags_update_taken <= s5_branch_taken;
+             yags_update_base <= s5_btb_hit && !s5_btb_type[2] && s5_btb_type[1];
+`else
+             yags_update_tag <= s5_bp_pc[`YAGS_TAG_MSB+`YAGS_INDEX_MSB+3:`YAGS_INDEX_MSB+3];
              yags_update_direction <= yags_new_direction;
+`endif
 
              if (!(s5_btb_hit && s5_yags_hit)) begin
                 if (s5_branch_taken && (s5_btb_type != `BTB_TYPE_BR_S_T || !s5_btb_hit)) begin
@@ -983,7 +2272,7 @@ module yarvi
                         s5_pc,
                         s5_branch_taken ? "TAKEN" : "NOT-taken",
                         s5_npc,
-                        s5_branch_taken ? s5_br_target : s5_pc + 4);
+                        s5_branch_taken ? s5_br_target : s5_seq_pc);
              else if (s5_branch_taken) // Correctly predicted non-taken branches are boring
                $display("WINNER_: %x %1s BRANCH predicted correctly!",
                         s5_pc, s5_branch_taken ? "TAKEN" : "NOT-taken");
@@ -991,11 +2280,10 @@ module yarvi
           end
 
           `JALR: begin
-             if (s5_jalr_target_miss) begin
-                s6_restart <= 1;
-                s6_restart_pc <= s5_jalr_target;
+             // A return predicted from predecode still goes in the BTB
+             if (s5_jalr_target_miss || !s5_btb_hit) begin
                 btb_update <= 1;
-                btb_update_tag <= s5_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
+                btb_update_tag <= s5_bp_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
                 // rd           |  rs1          | rs1=rd        | Interpretation
                 // !r1/r5       | !r1/r5        | -             | indirect branch
                 // !r1/r5       |  r1/r5        | -             | return
@@ -1009,7 +2297,20 @@ module yarvi
                   1: btb_update_type <= `BTB_TYPE_RETURN;
                   2, 3: btb_update_type <= `BTB_TYPE_CALL;
                 endcase
-                btb_update_target <= s5_jalr_target >> 2;
+                btb_update_target <= `BTB_ENCODE(s5_bp_pc, s5_jalr_target);
+             end
+
+             if (s5_jalr_target_miss) begin
+                s6_restart <= 1;
+                s6_restart_pc <= s5_jalr_target;
+
+                // The ITC learns the target, unless it has a confident
+                // one, which just loses confidence
+                if (s5_jalr_indirect) begin
+                   itc_update <= 1;
+                   itc_update_replace <= !s5_itc_hit || s5_itc_conf == 0;
+                   itc_update_conf <= !s5_itc_hit ? 1 : s5_itc_conf == 0 ? 1 : s5_itc_conf - 1;
+                end
 `ifndef QUIET
                 $display("RESTART: %x JALR mispredicted as %x instead of %x", s5_pc, s5_npc, s5_jalr_target);
 `endif
@@ -1017,39 +2318,42 @@ module yarvi
 `ifndef QUIET
                 $display("WINNER_: %x JALR predicted correctly!", s5_pc);
 `endif
-                btb_update <= 0; // The common path will presume a misprediction
+                btb_update <= !s5_btb_hit; // The common path will presume a misprediction
                 s6_restart <= 0; // The common path will presume a misprediction
+
+                if (s5_jalr_indirect && s5_itc_hit && s5_itc_conf != 3) begin
+                   itc_update <= 1;
+                   itc_update_replace <= 0;
+                   itc_update_conf <= s5_itc_conf + 1;
+                end
              end
 
+             if (s5_jalr_indirect)
+               rpath_history <= (rpath_history << 2) ^ s5_jalr_target[`ITC_INDEX_MSB+2:2];
+
              case ({s5_insn`rd == 1 || s5_insn`rd == 5,s5_insn`rs1 == 1 || s5_insn`rs1 == 5})
                1: begin
-                  rras0 <= rras1;
-                  rras1 <= rras2;
-                  // keep ras2
-                  rras2 <= 0; // XXX just to make debugging easier
+                  rras_tos <= s5_ras_tos - 1'd1;
+                  rras_we  <= 0;
 `ifndef QUIET
-                $display("         RRAS %x %x %x", rras1, rras2, 0);
+                $display("         RRAS [%d]", s5_ras_tos - 1'd1);
 `endif
                end
                2, 3: begin
-                  // Old ras2 lost
-                  rras2 <= rras1;
-                  rras1 <= rras0;
-                  rras0 <= s5_pc + 4;
+                  rras_tos <= s5_ras_tos + 1'd1;
+                  rras_top <= s5_seq_pc;
 `ifndef QUIET
-                $display("         RRAS %x %x %x", s5_pc + 4, rras0, rras1);
+                $display("         RRAS [%d] %x", s5_ras_tos + 1'd1, s5_seq_pc);
 `endif
                end
              endcase
           end
 
           `JAL: begin
-             if (s5_pc_insn_miss) begin
-                s6_restart <= 1;
-                s6_restart_pc <= s5_insn_target;
-
+             // A JAL predicted from predecode still goes in the BTB
+             if (s5_pc_insn_miss || !s5_btb_hit) begin
                 btb_update <= 1;
-                btb_update_tag <= s5_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
+                btb_update_tag <= s5_bp_pc[`BTB_TAG_MSB+`BTB_INDEX_MSB+3:`BTB_INDEX_MSB+3];
                 // rd           | Interpretation
                 // !r1/r5       | jump
                 // r1/r5        | call
@@ -1059,7 +2363,12 @@ module yarvi
                   0: btb_update_type <= `BTB_TYPE_JUMP;
                   1: btb_update_type <= `BTB_TYPE_CALL;
                 endcase
-                btb_update_target <= s5_insn_target >> 2;
+                btb_update_target <= `BTB_ENCODE(s5_bp_pc, s5_insn_target);
+             end
+
+             if (s5_pc_insn_miss) begin
+                s6_restart <= 1;
+                s6_restart_pc <= s5_insn_target;
 `ifndef QUIET
                 $display("RESTART: %x JAL mispredicted as %x instead of %x", s5_pc, s5_npc, s5_insn_target);
              end else begin
@@ -1067,15 +2376,13 @@ module yarvi
 `endif
              end
 
+             rpath_history <= (rpath_history << 2) ^ s5_insn_target[`ITC_INDEX_MSB+2:2];
+
              // Update RRAS
-             case ({s5_insn`rd == 1 || s5_insn`rd == 5})
-               1: begin
-                  // Old ras2 lost
-                  rras2 <= rras1;
-                  rras1 <= rras0;
-                  rras0 <= s5_pc + 4;
-               end
-             endcase
+             if (s5_insn`rd == 1 || s5_insn`rd == 5) begin
+                rras_tos <= s5_ras_tos + 1'd1;
+                rras_top <= s5_seq_pc;
+             end
           end
 
           `SYSTEM: begin
@@ -1093,6 +2400,12 @@ module yarvi
                       s6_restart_pc <= csr_mepc;
 `ifndef QUIET
                       $display("RESTART: %x MRET", s5_pc);
+`endif
+                   end
+                   `SRET: begin
+                      s6_restart_pc <= csr_sepc;
+`ifndef QUIET
+                      $display("RESTART: %x SRET", s5_pc);
 `endif
                    end
                  endcase
@@ -1116,6 +2429,76 @@ module yarvi
             endcase
         endcase;
 
+      // Replay an instruction that missed in the I$ or ITLB or needs a register
+      // a D$ miss or a divide hasn't delivered yet, that is, restart from itself
+      if (s5_valid & s5_replay) begin
+`ifndef QUIET
+         $display("RESTART: %x replay", s5_pc);
+`endif
+         s6_flush <= 1;
+         s6_restart <= 1;
+         s6_restart_pc <= s5_first_pc;
+         btb_update <= 0;
+      end
+
+      if (s6_dc_replay) begin
+`ifndef QUIET
+         $display("RESTART: %x D$ replay", s6_pc);
+`endif
+         s6_flush <= 1;
+         s6_restart <= 1;
+         s6_restart_pc <= s6_first_pc;
+         btb_update <= 0;
+         rras_tos <= s6_ras_tos;
+         rras_top <= s6_ras_top;
+         rras_we <= 1;
+      end
+
+      if (s6_tlb_replay) begin
+`ifndef QUIET
+         $display("RESTART: %x DTLB miss", s6_pc);
+`endif
+         s6_flush <= 1;
+         s6_restart <= 1;
+         s6_restart_pc <= s6_first_pc;
+         btb_update <= 0;
+         rras_tos <= s6_ras_tos;
+         rras_top <= s6_ras_top;
+         rras_we <= 1;
+      end
+
+      if (s6_md_replay) begin
+`ifndef QUIET
+         $display("RESTART: %x divider busy", s6_pc);
+`endif
+         s6_flush <= 1;
+         s6_restart <= 1;
+         s6_restart_pc <= s6_first_pc;
+         btb_update <= 0;
+         rras_tos <= s6_ras_tos;
+         rras_top <= s6_ras_top;
+         rras_we <= 1;
+      end
+
+      // Having done the first word of an access that crosses a word,
+      // restart it for the second.  If it doesn't make it, retry it
+      // all.
+      if (s6_ma_split) begin
+`ifndef QUIET
+         $display("RESTART: %x misaligned, second word", s6_pc);
+`endif
+         s6_flush <= 1;
+         s6_restart <= 1;
+         s6_restart_pc <= s6_first_pc;
+         btb_update <= 0;
+         rras_tos <= s6_ras_tos;
+         rras_top <= s6_ras_top;
+         rras_we <= 1;
+         ma_second <= 1;
+         ma_pc <= s6_pc;
+      end else if (s6_valid & s6_ma_second & !s6_replay)
+         ma_second <= 0;
+
       /*
        * XXX This is awkward; with the exception below, everything for
        * s5 restart depends on s4.  However we do this to get more
@@ -1131,11 +2514,18 @@ module yarvi
 `endif
          s6_flush <= 1;
          s6_restart <= 1;
-         s6_restart_pc <= csr_mtvec;
+         s6_restart_pc <= s6_deleg ? csr_stvec : csr_mtvec;
+         rras_tos <= s6_ras_tos;
+         rras_top <= s6_ras_top;
+         rras_we <= 1;
+         ma_second <= 0;
       end
 
       if (reset) begin
          s6_restart <= 1;
+         ma_second <= 0;
+         rras_tos <= 0;
+         rras_we <= 0;
          s6_restart_pc <= `INIT_PC;
 `ifndef QUIET
          $display("RESTART: reset");
@@ -1180,14 +2570,14 @@ module yarvi
 
         // XXX Should compute ctl targets at end of decode and use that for misaligned fetch tests
         `BRANCH:
-           if (s6_restart_pc[1] && s6_branch_taken) begin
+           if (s6_restart_pc[`INSN_LSB-1] && s6_branch_taken) begin
               s6_trap                   = s6_valid;
               s6_trap_cause             = `CAUSE_MISALIGNED_FETCH;
               s6_trap_val               = s6_restart_pc;
            end
 
         `JALR: begin
-           if (s6_restart_pc[1]) begin
+           if (s6_restart_pc[`INSN_LSB-1]) begin
               s6_trap                   = s6_valid;
               s6_trap_cause             = `CAUSE_MISALIGNED_FETCH;
               s6_trap_val               = s6_restart_pc;
@@ -1195,7 +2585,7 @@ module yarvi
         end
 
         `JAL: begin
-           if (s6_restart_pc[1]) begin
+           if (s6_restart_pc[`INSN_LSB-1]) begin
               s6_trap                   = s6_valid;
               s6_trap_cause             = `CAUSE_MISALIGNED_FETCH;
               s6_trap_val               = s6_restart_pc;
@@ -1227,14 +2617,31 @@ module yarvi
                      s6_csr_mstatus`MPIE= 1;
                      s6_priv            = csr_mstatus`MPP;
                      s6_csr_mstatus`MPP = `PRV_U;
+                     if (csr_mstatus`MPP != `PRV_M)
+                       s6_csr_mstatus`MPRV = 0;
                   end
 
+                  `SRET:
+                    if (priv == `PRV_U || priv == `PRV_S && csr_mstatus`TSR) begin
+                       s6_trap          = s6_valid;
+                       s6_trap_cause    = `CAUSE_ILLEGAL_INSTRUCTION;
+                    end else if (s6_valid) begin
+                       s6_csr_mstatus`SIE = csr_mstatus`SPIE;
+                       s6_csr_mstatus`SPIE= 1;
+                       s6_priv          = {1'd0, csr_mstatus`SPP};
+                       s6_csr_mstatus`SPP = 0;
+                       s6_csr_mstatus`MPRV = 0;
+                    end
+
                   `WFI: ; // XXX Should restart and block fetch until interrupt becomes pending
 
-                  default: begin
-                     s6_trap            = s6_valid;
-                     s6_trap_cause      = `CAUSE_ILLEGAL_INSTRUCTION;
-                  end
+                  // SFENCE.VMA (any rs1, rs2) flushes the TLBs, see tlb_flush
+                  default:
+                    if (s6_insn`funct7 != `SFENCE_VMA || s6_insn`rd != 0 ||
+                        priv == `PRV_U || priv == `PRV_S && csr_mstatus`TVM) begin
+                       s6_trap          = s6_valid;
+                       s6_trap_cause    = `CAUSE_ILLEGAL_INSTRUCTION;
+                    end
                 endcase
              end
            endcase
@@ -1269,9 +2676,10 @@ module yarvi
                 s6_trap_cause           = `CAUSE_ILLEGAL_INSTRUCTION;
              end
              default: begin
-                s6_trap                 = s6_valid & s6_misaligned;
-                s6_trap_cause           = `CAUSE_MISALIGNED_LOAD;
-                s6_trap_val             = s6_addr;
+                s6_trap                 = s6_valid & (s6_dpf | s6_ma_trap) & !s6_dtlb_miss;
+                s6_trap_cause           = (s6_daf ? `CAUSE_FAULT_LOAD :
+                                           s6_dpf ? `CAUSE_LOAD_PAGE_FAULT : `CAUSE_MISALIGNED_LOAD);
+                s6_trap_val             = s6_va;
              end
            endcase
         end
@@ -1284,19 +2692,52 @@ module yarvi
                 s6_trap_cause           = `CAUSE_ILLEGAL_INSTRUCTION;
              end
              default: begin
-                s6_trap                 = s6_valid & s6_misaligned;
-                s6_trap_cause           = `CAUSE_MISALIGNED_STORE;
-                s6_trap_val             = s6_addr;
+                s6_trap                 = s6_valid & (s6_dpf | s6_ma_trap) & !s6_dtlb_miss;
+                s6_trap_cause           = (s6_daf ? `CAUSE_FAULT_STORE :
+                                           s6_dpf ? `CAUSE_STORE_PAGE_FAULT : `CAUSE_MISALIGNED_STORE);
+                s6_trap_val             = s6_va;
              end
            endcase
         end
 
+        // Atomics must be aligned and in memory
+        `AMO:
+           case (s6_insn`funct5)
+             `LR, `SC, `AMOSWAP, `AMOADD, `AMOXOR, `AMOAND, `AMOOR,
+             `AMOMIN, `AMOMAX, `AMOMINU, `AMOMAXU:
+                if (s6_insn`funct3 != 2 || s6_insn`funct5 == `LR && s6_insn`rs2 != 0) begin
+                   s6_trap              = s6_valid;
+                   s6_trap_cause        = `CAUSE_ILLEGAL_INSTRUCTION;
+                end else begin
+                   s6_trap              = s6_valid & (s6_dpf | s6_misaligned | s6_amo_fault) & !s6_dtlb_miss;
+                   s6_trap_cause        = (s6_insn`funct5 == `LR
+                                           ? (s6_daf ? `CAUSE_FAULT_LOAD :
+                                              s6_dpf ? `CAUSE_LOAD_PAGE_FAULT :
+                                              s6_misaligned ? `CAUSE_MISALIGNED_LOAD : `CAUSE_FAULT_LOAD)
+                                           : (s6_daf ? `CAUSE_FAULT_STORE :
+                                              s6_dpf ? `CAUSE_STORE_PAGE_FAULT :
+                                              s6_misaligned ? `CAUSE_MISALIGNED_STORE : `CAUSE_FAULT_STORE));
+                   s6_trap_val          = s6_va;
+                end
+             default: begin
+                s6_trap                 = s6_valid;
+                s6_trap_cause           = `CAUSE_ILLEGAL_INSTRUCTION;
+             end
+           endcase
+
         default: begin
            s6_trap                      = s6_valid;
            s6_trap_cause                = `CAUSE_ILLEGAL_INSTRUCTION;
         end
       endcase
 
+      // The instruction is a NOP standing in for one we couldn't fetch
+      if (s6_ipf) begin
+         s6_trap                        = s6_valid;
+         s6_trap_cause                  = s6_iaf ? `CAUSE_FAULT_FETCH : `CAUSE_FETCH_PAGE_FAULT;
+         s6_trap_val                    = s6_pc;
+      end
+
       if (s6_trap || s6_intr) begin
          if (s6_intr) begin
             // Awkward priority scheme
@@ -1315,7 +2756,7 @@ module yarvi
          if (s6_deleg) begin
             s6_csr_scause[`XMSB]        = s6_intr;
             s6_csr_scause[`XMSB-1:0]    = {{(`XMSB-4){1'd0}},s6_cause};
-            s6_csr_sepc                 = s6_pc;
+            s6_csr_sepc                 = s6_first_pc;
             s6_csr_stval                = s6_trap_val;
             s6_csr_mstatus`SPIE         = csr_mstatus`SIE;
             s6_csr_mstatus`SIE          = 0;
@@ -1324,7 +2765,7 @@ module yarvi
          end else begin
             s6_csr_mcause[`XMSB]        = s6_intr;
             s6_csr_mcause[`XMSB-1:0]    = {{(`XMSB-4){1'd0}}, s6_cause};
-            s6_csr_mepc                 = s6_pc;
+            s6_csr_mepc                 = s6_first_pc;
             s6_csr_mtval                = s6_trap_val;
             s6_csr_mstatus`MPIE         = csr_mstatus`MIE;
             s6_csr_mstatus`MIE          = 0;
@@ -1355,6 +2796,8 @@ module yarvi
       csr_scause                        <= 0;
       csr_sepc                          <= 0;
       csr_stval                         <= 0;
+      csr_sscratch                      <= 0;
+      csr_satp                          <= 0;
 
    end else begin
       csr_mcycle                        <= csr_mcycle + 1;
@@ -1371,7 +2814,7 @@ module yarvi
 
       csr_mideleg                       <= s6_csr_mideleg;
       csr_medeleg                       <= s6_csr_medeleg;
-      csr_minstret                      <= csr_minstret + s7_valid;
+      csr_minstret                      <= csr_minstret + s7_valid + (s7_valid & s7_fused);
 
       /* CSR write port (notice, this happens in EX) */
       if (s6_csr_we) begin
@@ -1381,7 +2824,7 @@ module yarvi
            `CSR_FRM:       csr_frm      <= s6_csr_d[2:0];
            `CSR_MCAUSE:    csr_mcause   <= s6_csr_d;
 //         `CSR_MCYCLE:    csr_mcycle   <= s6_csr_d;
-           `CSR_MEPC:      csr_mepc     <= s6_csr_d & ~3;
+           `CSR_MEPC:      csr_mepc     <= s6_csr_d & ~((1 << `INSN_LSB) - 1);
            `CSR_MIE:       csr_mie      <= s6_csr_d[11:0];
 //         `CSR_MINSTRET:  csr_minstret <= s6_csr_d;
            `CSR_MIP:       csr_mip      <= s6_csr_d & `CSR_MIP_WMASK | csr_mip & ~`CSR_MIP_WMASK;
@@ -1390,12 +2833,19 @@ module yarvi
            `CSR_MSCRATCH:  csr_mscratch <= s6_csr_d;
            `CSR_MSTATUS:   csr_mstatus  <= s6_csr_d & ~(15 << 13); // No FP or XS;
            `CSR_MTVEC:     csr_mtvec    <= s6_csr_d & ~1; // We don't support vectored interrupts
-           `CSR_MTVAL:     csr_mtvec    <= s6_csr_d;
+           `CSR_MTVAL:     csr_mtval    <= s6_csr_d;
 
            `CSR_SCAUSE:    csr_scause   <= s6_csr_d;
            `CSR_SEPC:      csr_sepc     <= s6_csr_d;
            `CSR_STVEC:     csr_stvec    <= s6_csr_d & ~1; // We don't support vectored interrupts
-           `CSR_STVAL:     csr_stvec    <= s6_csr_d;
+           `CSR_STVAL:     csr_stval    <= s6_csr_d;
+           `CSR_SSTATUS:   csr_mstatus  <= s6_csr_d & `SSTATUS_WMASK | csr_mstatus & ~`SSTATUS_WMASK;
+           `CSR_SSCRATCH:  csr_sscratch <= s6_csr_d;
+`ifdef MMU
+           `CSR_SATP:      csr_satp     <= s6_csr_d & ~32'h 0030_0000; // 32-bit physical addresses
+`else
+           `CSR_SATP: ; // Bare only
+`endif
 
            `CSR_PMPCFG0: ;
            `CSR_PMPADDR0: ;
@@ -1415,15 +2865,86 @@ module yarvi
 
 
 
-   reg s6_misaligned;
+   reg s6_misaligned, s6_cross;
    always @(*)
      case (s6_insn`funct3 & 3)
-       0: s6_misaligned =  0;            // Byte
-       1: s6_misaligned =  s6_addr[  0]; // Half
-       2: s6_misaligned = |s6_addr[1:0]; // Word
-       3: s6_misaligned =  1'hX;
+       0: {s6_misaligned, s6_cross} = 0;                                  // Byte
+       1: {s6_misaligned, s6_cross} = {s6_addr[0], &s6_addr[1:0]};        // Half
+       2: {s6_misaligned, s6_cross} = {|s6_addr[1:0], |s6_addr[1:0]};     // Word
+       3: {s6_misaligned, s6_cross} = 2'hX;
      endcase
 
+   // Misaligned accesses to memory are done in hardware.  One that
+   // stays within a word is just rotated into place.  One that crosses
+   // a word is split in two beats: the first word is loaded (into
+   // ma_buf) or stored as usual and then the access restarts itself
+   // for the second with four added to its immediate, so it's an
+   // ordinary access to the next word as far as the memory, the D$,
+   // and store forwarding are concerned, and is merged with ma_buf.
+   // Elsewhere they still trap.
+`ifdef DCACHE
+   wire             s6_ma_trap = s6_misaligned && s6_addr[`XMSB:`XMSB-1] != 2'b10;
+   wire             s6_amo_fault = s6_addr[`XMSB:`XMSB-1] != 2'b10;
+`else
+   wire             s6_ma_trap = s6_misaligned && !s6_addr_in_mem;
+   wire             s6_amo_fault = !s6_addr_in_mem;
+`endif
+   wire             s6_ma_split = (s6_valid && !s6_trap && !s6_intr && !s6_replay &&
+                                   (s6_insn`opcode == `LOAD || s6_insn`opcode == `STORE) &&
+                                   s6_cross && !s6_ma_second);
+   reg  [`XMSB:0]   ma_buf;
+
+   // Atomics
+   //
+   // LR is a load that also sets the reservation and SC a store, done
+   // in S6 only if the reservation (cleared by SC and traps) is still
+   // for its word.  The other AMOs load the old value like LR, into
+   // rd, and write the new one from S8 through the store port, which
+   // is free then as S3 holds back any younger access until the AMO
+   // has reached S7 (s3_amo_wait).  Older stores are forwarded to the
+   // load as usual, so the read-modify-write needs no restart.
+   wire             s6_lr = s6_insn`opcode == `AMO && s6_insn`funct5 == `LR;
+   wire             s6_sc = s6_insn`opcode == `AMO && s6_insn`funct5 == `SC;
+   reg              resv_valid = 0;
+   reg  [`XMSB:2]   resv_addr;
+   wire             s6_sc_ok = s6_sc && resv_valid && resv_addr == s6_addr[`XMSB:2];
+
+   wire             s7_amo = s7_valid && `IS_AMO_RMW(s7_insn);
+   reg              amo_we = 0;
+   reg  [`XMSB:0]   amo_addr;
+   reg  [`XMSB:0]   amo_data;
+/* verilator lint_off UNUSED */
+   wire             amo_in_mem = (amo_addr & (-1 << (`PMSB+1))) == 32'h80000000; // not with ICACHE and DCACHE
+/* verilator lint_on UNUSED */
+
+   always @(posedge clock) begin
+      if (s6_valid && !s6_trap && !s6_intr && !s6_replay) begin
+         if (s6_lr) begin
+            resv_valid <= 1;
+            resv_addr  <= s6_addr[`XMSB:2];
+         end
+         if (s6_sc)
+           resv_valid <= 0;
+      end
+      if (s6_valid && (s6_trap || s6_intr) || reset)
+        resv_valid <= 0;
+
+      amo_we   <= s7_amo;
+      amo_addr <= s7_addr;
+      case (s7_insn`funct5)
+        `AMOSWAP: amo_data <= s7_rs2;
+        `AMOADD:  amo_data <= m3_wb_val + s7_rs2;
+        `AMOXOR:  amo_data <= m3_wb_val ^ s7_rs2;
+        `AMOAND:  amo_data <= m3_wb_val & s7_rs2;
+        `AMOOR:   amo_data <= m3_wb_val | s7_rs2;
+        `AMOMIN:  amo_data <= $signed(m3_wb_val) < $signed(s7_rs2) ? m3_wb_val : s7_rs2;
+        `AMOMAX:  amo_data <= $signed(m3_wb_val) < $signed(s7_rs2) ? s7_rs2 : m3_wb_val;
+        `AMOMINU: amo_data <= m3_wb_val < s7_rs2 ? m3_wb_val : s7_rs2;
+        `AMOMAXU: amo_data <= m3_wb_val < s7_rs2 ? s7_rs2 : m3_wb_val;
+        default:  amo_data <= 'hX;
+      endcase
+   end
+
    /* Load path */
 
    /* Store path */
@@ -1432,40 +2953,69 @@ module yarvi
    wire [    3:0] s6_st_mask;
 
    yarvi_st_align yarvi_st_align1
-     (s6_insn`funct3, s6_addr[1:0], s6_rs2, s6_st_mask, s6_st_data);
+     (s6_insn`funct3, s6_addr[1:0], s6_ma_second, s6_rs2, s6_st_mask, s6_st_data);
 
    wire             s6_addr_in_mem = (s6_addr & (-1 << (`PMSB+1))) == 32'h80000000;
+`ifdef DCACHE
+   wire [`DC_WORDS_LG2-1:0] s6_wi = s6_addr[`DC_WORDS_LG2+1:2];
+   wire             s6_we = (s6_valid &&
+                             !s6_trap &&
+                             !s6_intr &&
+                             (s6_insn`opcode == `STORE || s6_sc_ok) &&
+                             s6_dc_hit);
+`else
    wire [`PMSB-2:0] s6_wi = s6_addr[`PMSB:2];
    wire             s6_we = (s6_valid &&
                              !s6_flush &&
                              !s6_trap &&
                              !s6_intr &&
-                             s6_insn`opcode == `STORE &&
+                             !s6_replay &&
+                             (s6_insn`opcode == `STORE || s6_sc_ok) &&
                              s6_addr_in_mem);
+`endif
 
 
 
    // S7 - Write back committed results, store to memory
    reg              s7_valid = 0;
    reg  [`XMSB:0]   s7_wb_val;
-   reg  [`PMSB:2]   s7_addr;
+   reg  [`XMSB:0]   s7_addr;
+   reg  [`XMSB:0]   s7_rs2;
    reg              s7_timer_interrupt_future;
    reg  [`VMSB:0]   s7_pc;
    reg  [   31:0]   s7_insn;
    reg  [    4:0]   s7_rd = 0;
+   reg              s7_fused = 0;
+   reg              s7_rvc = 0;
    reg              s7_timer_interrupt;
    reg  [   63:0]   mtime_future;
+   wire             s6_retire = s6_valid & !s6_flush && !s6_trap && !s6_intr && !s6_replay && !s6_ma_split;
    always @(posedge clock) begin
-      s7_valid          <= s6_valid & !s6_flush && !s6_trap && !s6_intr;
+      s7_valid          <= s6_retire;
+      s7_fused          <= s6_fused;
+      s7_rvc            <= s6_rvc;
       s7_pc             <= s6_pc;
       s7_insn           <= s6_insn;
-      s7_rd             <= s6_valid ? s6_rd : 0;
-      s7_addr[`PMSB:2]  <= s6_addr[`PMSB:2];
-      s7_wb_val         <= s6_wb_val;
+      s7_rd             <= s6_valid && !s6_dc_fill && !s6_md_start ? s6_rd : 0;
+      s7_addr           <= s6_addr;
+      s7_rs2            <= s6_rs2;
+`ifndef NO_MULDIV
+      s7_wb_val         <= s6_sc ? {{`XMSB{1'd0}}, !s6_sc_ok} : s6_mul ? s6_mul_val : s6_wb_val;
+`else
+      s7_wb_val         <= s6_sc ? {{`XMSB{1'd0}}, !s6_sc_ok} : s6_wb_val;
+`endif
       if (|s7_rd & s7_valid) begin
          regs[s7_rd]    <= m3_wb_val;
          //$display("%x %x r%1d %x", priv, s7_pc, s7_rd, m3_wb_val);
       end
+`ifdef DCACHE
+      else if (dc_reg_we)
+         regs[mshr_rd[mshr_head]] <= dc_reg_val;
+`endif
+`ifndef NO_MULDIV
+      else if (md_reg_we)
+         regs[md_rd]    <= md_result;
+`endif
 
       /* Memory mapped io devices (only word-wide accesses are allowed) */
       mtime_future                      <= mtime_future + 1; // XXX Yes, this is terrible
@@ -1481,14 +3031,36 @@ module yarvi
           3: mtimecmp[63:32]            <= s6_rs2;
         endcase
 
+`ifdef DCACHE
       if (s6_we & s6_st_mask[0]) data0[s6_wi] <= s6_st_data[ 7: 0];
       if (s6_we & s6_st_mask[1]) data1[s6_wi] <= s6_st_data[15: 8];
       if (s6_we & s6_st_mask[2]) data2[s6_wi] <= s6_st_data[23:16];
       if (s6_we & s6_st_mask[3]) data3[s6_wi] <= s6_st_data[31:24];
-      if (s6_we & s6_st_mask[0]) code0[s6_wi] <= s6_st_data[ 7: 0];
-      if (s6_we & s6_st_mask[1]) code1[s6_wi] <= s6_st_data[15: 8];
-      if (s6_we & s6_st_mask[2]) code2[s6_wi] <= s6_st_data[23:16];
-      if (s6_we & s6_st_mask[3]) code3[s6_wi] <= s6_st_data[31:24];
+      if (amo_we) begin
+         data0[amo_addr[`DC_WORDS_LG2+1:2]] <= amo_data[ 7: 0];
+         data1[amo_addr[`DC_WORDS_LG2+1:2]] <= amo_data[15: 8];
+         data2[amo_addr[`DC_WORDS_LG2+1:2]] <= amo_data[23:16];
+         data3[amo_addr[`DC_WORDS_LG2+1:2]] <= amo_data[31:24];
+      end
+      if (dc_install_we) begin
+         data0[{dc_index, dc_word}] <= dc_buf[dc_word][ 7: 0];
+         data1[{dc_index, dc_word}] <= dc_buf[dc_word][15: 8];
+         data2[{dc_index, dc_word}] <= dc_buf[dc_word][23:16];
+         data3[{dc_index, dc_word}] <= dc_buf[dc_word][31:24];
+      end
+`ifndef ICACHE
+      if (s6_we & s6_addr_in_mem & s6_st_mask[0]) code0[s6_addr[`PMSB:2]] <= s6_st_data[ 7: 0];
+      if (s6_we & s6_addr_in_mem & s6_st_mask[1]) code1[s6_addr[`PMSB:2]] <= s6_st_data[15: 8];
+      if (s6_we & s6_addr_in_mem & s6_st_mask[2]) code2[s6_addr[`PMSB:2]] <= s6_st_data[23:16];
+      if (s6_we & s6_addr_in_mem & s6_st_mask[3]) code3[s6_addr[`PMSB:2]] <= s6_st_data[31:24];
+      if (amo_we & amo_in_mem) begin
+         code0[amo_addr[`PMSB:2]] <= amo_data[ 7: 0];
+         code1[amo_addr[`PMSB:2]] <= amo_data[15: 8];
+         code2[amo_addr[`PMSB:2]] <= amo_data[23:16];
+         code3[amo_addr[`PMSB:2]] <= amo_data[31:24];
+      end
+`endif
+`endif
 
       if (reset) begin
          mtime_future                      <= 0;
@@ -1501,7 +3073,7 @@ module yarvi
    reg  [`VMSB  :0] dump_addr;
 `endif
    always @(posedge clock)
-     if (!restart && s6_valid && s6_insn`opcode == `STORE && !s6_misaligned) begin
+     if (!restart && s6_valid && !s6_replay && s6_insn`opcode == `STORE && !s6_misaligned) begin
 `ifndef QUIET
         if (!s6_addr_in_mem)
           $display("store %x -> [%x]/%x", s6_st_data, s6_addr, s6_st_mask);
@@ -1520,7 +3092,11 @@ module yarvi
            $display("");
            $display("Signature Begin");
            for (dump_addr = 'h`BEGIN_SIGNATURE; dump_addr < 'h`END_SIGNATURE; dump_addr=dump_addr+4)
+`ifdef DCACHE
               $display("%x", {data3[dump_addr[`PMSB:2]],data2[dump_addr[`PMSB:2]],data1[dump_addr[`PMSB:2]],data0[dump_addr[`PMSB:2]]});
+`else
+              $display("%x", {ram3.mem[dump_addr[`PMSB:2]],ram2.mem[dump_addr[`PMSB:2]],ram1.mem[dump_addr[`PMSB:2]],ram0.mem[dump_addr[`PMSB:2]]});
+`endif
 `endif
 `ifndef KEEP_GOING
            $finish;
@@ -1537,12 +3113,15 @@ module yarvi
    always @(posedge clock) begin
       s8_wb_val     <= m3_wb_val;
 
-      retire_valid  <= s7_valid;
+      // The first of a fused pair is the bubble in S7 ahead of it
+      retire_valid  <= s7_valid | s6_fused & s6_retire;
       retire_priv   <= priv;
       retire_pc     <= s7_pc;
       retire_insn   <= s7_insn;
+      retire_rvc    <= s7_rvc;
       retire_rd     <= s7_rd;
       retire_wb_val <= m3_wb_val;
+      retire_addr   <= s7_addr;
       debug         <= retire_wb_val;
    end
 
@@ -1550,22 +3129,85 @@ module yarvi
 
 
    // Memory pipeline - S5 - S7
+   //
+   // Loads read the memory as they leave S5, the same edge where the
+   // store in S6 (if any) writes it, thus they would see the old
+   // value.  Instead the store's bytes are captured along with the
+   // load data and merged in M2 (by byte lane, so partial overlaps
+   // work too, and bytes the store didn't write are never replaced).
+   // Older stores have already been written.
+   //
+   // Whether the load hits the store's word is checked without waiting
+   // for the address adder: a + b == k iff every bit of a ^ b ^ k is
+   // the carry into it that k implies, ie. a & b | (a | b) & ~k one
+   // bit down.  Only the word bits are compared, the carry into bit 2
+   // coming from the low two bits.  The load/store pairing is known in
+   // S4.
+`ifdef MMU
+   assign         m1_load_addr = s5_pa;
+`else
    assign         m1_load_addr = s5_rs1 + s5_i_imm; // Need full address
+`endif
+   reg            m1_st_ahead = 0;
+   always @(posedge clock)
+     m1_st_ahead <= ((s4_opcode == `LOAD || s4_opcode == `AMO) && s5_valid &&
+                     (s5_opcode == `STORE || s5_opcode == `AMO));
+
+   wire [`PMSB:2]   m1_k  = s6_addr[`PMSB:2];
+`ifdef MMU
+   // Virtual addresses can alias, compare the translated ones
+   wire             m1_hits_s6 = m1_load_addr[`PMSB:2] == m1_k;
+`else
+   wire [`PMSB:2]   m1_a  = s5_rs1[`PMSB:2];
+   wire [`PMSB:2]   m1_b  = s5_i_imm[`PMSB:2];
+   wire [`PMSB-1:2] m1_gen = m1_a[`PMSB-1:2] & m1_b[`PMSB-1:2] |
+                             (m1_a[`PMSB-1:2] | m1_b[`PMSB-1:2]) & ~m1_k[`PMSB-1:2];
+   wire             m1_c2 = s5_rs1[1] & s5_i_imm[1] |
+                            (s5_rs1[1] | s5_i_imm[1]) & s5_rs1[0] & s5_i_imm[0];
+   wire             m1_hits_s6 = (m1_a ^ m1_b ^ m1_k) == {m1_gen, m1_c2};
+`endif
+`ifdef DCACHE
+   wire [`DC_WORDS_LG2-1:0] m1_wi = dc_wb_rd ? {dc_index, dc_issue[`DC_LINE_WORDS_LG2-1:0]}
+                                             : m1_load_addr[`DC_WORDS_LG2+1:2];
+`else
+   wire [`PMSB-2:0] m1_wi = m1_load_addr[`PMSB:2];
+`endif
    reg  [`XMSB:0] m2_load_addr;
    reg  [    1:0] m3_load_addr;
+`ifdef DCACHE
    reg  [`XMSB:0] m2_memory_data;
+`else
+   wire [`XMSB:0] m2_memory_data = ram_b_dout;
+`endif
    reg  [`XMSB:0] m3_memory_data;
+   reg  [`XMSB:0] m2_fwd_data;
+   reg  [    3:0] m2_fwd_mask;
 /* verilator lint_off UNUSED */
    reg  [   31:0] m3_insn;
 /* verilator lint_on UNUSED */
    wire [`XMSB:0] m3_wb_val;
+   wire           m3_load = (m3_insn`opcode == `LOAD ||
+                             m3_insn`opcode == `AMO && m3_insn`funct5 != `SC);
    reg m3_load_addr_in_mem = 1;
+   reg            m3_ma_first = 0;
+   reg            m3_ma_second = 0;
    always @(posedge clock) begin
       m2_load_addr      <= m1_load_addr;
+      m3_ma_first       <= s6_ma_split;
+      m3_ma_second      <= s6_ma_second;
+      if (m3_ma_first)
+        ma_buf          <= m3_memory_data;
       m3_load_addr[1:0] <= m2_load_addr[1:0];
-      m2_memory_data    <= {data3[m1_load_addr[`PMSB:2]],data2[m1_load_addr[`PMSB:2]],data1[m1_load_addr[`PMSB:2]],data0[m1_load_addr[`PMSB:2]]};
+`ifdef DCACHE
+      m2_memory_data    <= {data3[m1_wi],data2[m1_wi],data1[m1_wi],data0[m1_wi]};
+`endif
+      m2_fwd_data       <= s6_st_data;
+      m2_fwd_mask       <= m1_st_ahead && s6_we && m1_hits_s6 ? s6_st_mask : 0;
       m3_insn           <= s6_insn;
-      m3_memory_data    <= m2_memory_data;
+      m3_memory_data    <= {m2_fwd_mask[3] ? m2_fwd_data[31:24] : m2_memory_data[31:24],
+                            m2_fwd_mask[2] ? m2_fwd_data[23:16] : m2_memory_data[23:16],
+                            m2_fwd_mask[1] ? m2_fwd_data[15: 8] : m2_memory_data[15: 8],
+                            m2_fwd_mask[0] ? m2_fwd_data[ 7: 0] : m2_memory_data[ 7: 0]};
 
       /* Memory mapped io devices (only word-wide accesses are allowed) */
       case (m2_load_addr[`PMSB:2])
@@ -1575,38 +3217,879 @@ module yarvi
         3: m3_mmio_data <= mtimecmp[63:32];
         default: m3_mmio_data <= 0;
       endcase
+`ifdef DCACHE
+      m3_load_addr_in_mem
+        <= m2_load_addr[`XMSB:`XMSB-1] == 2'b10;
+`else
       m3_load_addr_in_mem
         <= (m2_load_addr & (-1 << (`PMSB+1))) == 32'h80000000;
+`endif
    end
    reg [`XMSB:0] m3_mmio_data = 0;
    yarvi_ld_align yarvi_load_align_m
-     (m3_insn`opcode != `LOAD, s7_wb_val, // XXX Drop the s7_wb_val -> m3_wb_val bypass?
-      m3_insn`funct3, m3_load_addr[1:0],
+     (!m3_load, s7_wb_val, // XXX Drop the s7_wb_val -> m3_wb_val bypass?
+      m3_insn`funct3, m3_load_addr[1:0], m3_ma_second, ma_buf,
       m3_load_addr_in_mem ? m3_memory_data : m3_mmio_data,
       m3_wb_val);
 
 
+`ifndef DCACHE
+   // On-chip memory
+   //
+   // Code and data share one true dual-port memory, four byte lanes of
+   // bram_tdp_en.  Port A fetches and port B loads and stores, except
+   // that a store in S6 alongside a load in S5 (which has port B) is
+   // written through port A and fetch waits a cycle.  As stores go
+   // straight to the memory fetch reads, FENCE.I only has to refetch
+   // what follows it, as before.
+`ifndef ICACHE
+   wire             ram_a_busy = (s6_valid && (s6_insn`opcode == `STORE || s6_sc) &&
+                                  (s5_opcode == `LOAD || s5_opcode == `AMO));
+`endif
+   wire             ram_st_a = s6_we && (s5_opcode == `LOAD || s5_opcode == `AMO);
+   wire [`PMSB-2:0] ram_a_addr = ram_st_a ? s6_wi : s0_ppc[`PMSB:2];
+   wire             ram_a_en = !s2_stall | restart;
+   wire [    3:0]   ram_a_wr = ram_st_a ? s6_st_mask : 0;
+   wire [`PMSB-2:0] ram_b_addr = (ptw_rd ? ptw_addr[`PMSB:2] :
+                                  amo_we ? amo_addr[`PMSB:2] :
+                                  s6_we && !ram_st_a ? s6_wi : m1_wi);
+   wire [    3:0]   ram_b_wr = (amo_we ? {4{amo_in_mem}} :
+                                s6_we && !ram_st_a ? s6_st_mask : 0);
+   wire [   31:0]   ram_b_din = amo_we ? amo_data : s6_st_data;
+/* verilator lint_off UNUSED */
+   wire [   31:0]   ram_a_dout; // unused with ICACHE
+/* verilator lint_on UNUSED */
+   wire [   31:0]   ram_b_dout;
+
+   bram_tdp_en #(.DATA(8), .ADDR(`PMSB-1), .INIT(`INIT_LANE0)) ram0
+     (clock, ram_a_en, ram_a_wr[0], ram_a_addr, s6_st_data[ 7: 0], ram_a_dout[ 7: 0],
+      clock, 1'd1,     ram_b_wr[0], ram_b_addr, ram_b_din[ 7: 0], ram_b_dout[ 7: 0]);
+   bram_tdp_en #(.DATA(8), .ADDR(`PMSB-1), .INIT(`INIT_LANE1)) ram1
+     (clock, ram_a_en, ram_a_wr[1], ram_a_addr, s6_st_data[15: 8], ram_a_dout[15: 8],
+      clock, 1'd1,     ram_b_wr[1], ram_b_addr, ram_b_din[15: 8], ram_b_dout[15: 8]);
+   bram_tdp_en #(.DATA(8), .ADDR(`PMSB-1), .INIT(`INIT_LANE2)) ram2
+     (clock, ram_a_en, ram_a_wr[2], ram_a_addr, s6_st_data[23:16], ram_a_dout[23:16],
+      clock, 1'd1,     ram_b_wr[2], ram_b_addr, ram_b_din[23:16], ram_b_dout[23:16]);
+   bram_tdp_en #(.DATA(8), .ADDR(`PMSB-1), .INIT(`INIT_LANE3)) ram3
+     (clock, ram_a_en, ram_a_wr[3], ram_a_addr, s6_st_data[31:24], ram_a_dout[31:24],
+      clock, 1'd1,     ram_b_wr[3], ram_b_addr, ram_b_din[31:24], ram_b_dout[31:24]);
+`endif
 
 
-   // Module outputs
-   assign           restart    = s6_restart;
-   assign           restart_pc = s6_restart_pc;
 
-`ifdef __ICARUS__
-`define HAS_PLUSARGS 1
+   // Data translation and page table walker
+   //
+   // The DTLB translates the load/store address in S5, in parallel with
+   // the permission checks, so the memory is read with the physical
+   // address as the access leaves S5 and S6 sees the physical address
+   // (and the virtual one, for traps).  An access that missed replays
+   // from S6 like a D$ miss.
+   //
+   // The walker takes one miss at a time, from S6 (DTLB) or S2 (ITLB,
+   // which may be on a wrong path), and holds fetch while walking,
+   // which drains the pipeline and frees port B of the on-chip memory
+   // for its PTE reads.  Misses seen while it's busy are dropped and
+   // will just miss again.  SFENCE.VMA in S6 flushes both TLBs and
+   // abandons the walk.
+`ifdef MMU
+   wire [`XMSB:0]   s5_va = s5_rs1 + (s5_opcode == `STORE ? s5_s_imm : s5_i_imm);
+   wire             s5_dtlb_hit;
+   wire [`XMSB:0]   s5_dtlb_pa;
+/* verilator lint_off UNUSED */
+   wire [    7:0]   s5_dtlb_flags; // D A G U X W R V
+/* verilator lint_on UNUSED */
+   wire             s5_dtlb_af;
+   wire [`XMSB:0]   s5_pa = mmu_d_on ? s5_dtlb_pa : s5_va;
+   wire             s5_dtlb_miss = mmu_d_on && !s5_dtlb_hit;
+   wire             s5_dpf = (mmu_d_on && s5_dtlb_hit &&
+                              (!s5_dtlb_flags[0] || !s5_dtlb_flags[6] ||
+                               (s5_opcode == `STORE || s5_opcode == `AMO && s5_insn`funct5 != `LR
+                                ? !s5_dtlb_flags[2] || !s5_dtlb_flags[7]
+                                : !s5_dtlb_flags[1] && !(csr_mstatus`MXR && s5_dtlb_flags[3])) ||
+                               (mmu_d_priv == `PRV_U
+                                ? !s5_dtlb_flags[4]
+                                : s5_dtlb_flags[4] && !csr_mstatus`SUM)));
+   wire             s5_daf = mmu_d_on && s5_dtlb_af;
+
+   wire             s6_tlb_replay = (s6_valid && s6_dtlb_miss &&
+                                     (s6_insn`opcode == `LOAD || s6_insn`opcode == `STORE ||
+                                      s6_insn`opcode == `AMO));
+   wire             tlb_flush = (s6_valid && !s6_trap && s6_insn`opcode == `SYSTEM &&
+                                 s6_insn`funct3 == `PRIV && s6_insn`funct7 == `SFENCE_VMA ||
+                                 reset);
+
+   reg              ptw_busy = 0;
+   reg              ptw_wait = 0;  // the PTE is in ram_b_dout
+   reg              ptw_d;         // for the DTLB
+   reg              ptw_level;     // 1 for the root table
+   reg  [    8:0]   ptw_asid;
+   reg  [`XMSB:0]   ptw_addr;
+   wire             ptw_rd = (ptw_busy && !ptw_wait && !s6_we && !amo_we &&
+                              !(s5_valid && (s5_opcode == `LOAD || s5_opcode == `AMO)));
+/* verilator lint_off UNUSED */
+   reg  [`XMSB:0]   ptw_va;
+   wire [`XMSB:0]   ptw_pte = ram_b_dout;
+/* verilator lint_on UNUSED */
+   wire             ptw_leaf = ptw_pte[1] | ptw_pte[3];
+   // A PTE outside the memory is an access fault rather than a page fault
+   wire             ptw_access = (ptw_addr & (-1 << (`PMSB+1))) != 32'h80000000;
+   wire             ptw_bad = (!ptw_pte[0] || !ptw_pte[1] && ptw_pte[2] || |ptw_pte[31:30] ||
+                               ptw_access ||
+                               ptw_leaf && ptw_level && |ptw_pte[19:10] || // misaligned megapage
+                               !ptw_leaf && !ptw_level);
+   wire             ptw_done = ptw_busy && ptw_wait && (ptw_leaf || ptw_bad) && !tlb_flush;
+
+   yarvi_tlb #(`TLB_ENTRIES_LG2) dtlb
+     ( .clock          (clock)
+     , .asid           (csr_satp`SATP_ASID)
+     , .va             (s5_va)
+     , .hit            (s5_dtlb_hit)
+     , .pa             (s5_dtlb_pa)
+     , .flags          (s5_dtlb_flags)
+     , .access_fault   (s5_dtlb_af)
+     , .fill           (ptw_done & ptw_d)
+     , .fill_fault     (ptw_bad)
+     , .fill_access    (ptw_access)
+     , .fill_va        (ptw_va)
+     , .fill_mega      (ptw_level)
+     , .fill_asid      (ptw_asid)
+     , .fill_ppn       (ptw_pte[29:10])
+     , .fill_flags     (ptw_pte[7:0])
+     , .clear_fault    (s6_trap)
+     , .flush          (tlb_flush)
+     , .flush_all_va   (s6_insn`rs1 == 0 || reset)
+     , .flush_va       (s6_rs1)
+     , .flush_all_asid (s6_insn`rs2 == 0 || reset)
+     , .flush_asid     (s6_rs2[8:0]));
+
+   always @(posedge clock) begin
+      if (ptw_rd)
+        ptw_wait <= 1;
+
+      if (ptw_busy && ptw_wait) begin
+         ptw_wait  <= 0;
+         ptw_level <= 0;
+         ptw_addr  <= {ptw_pte[29:10], ptw_va[21:12], 2'd0};
+         if (ptw_leaf || ptw_bad) begin
+            ptw_busy <= 0;
+`ifndef QUIET
+            $display("PTW: %x %s %x %s", ptw_va, ptw_d ? "D" : "I", ptw_pte,
+                     ptw_bad ? "fault" : ptw_level ? "megapage" : "page");
 `endif
+         end
+      end else if (!ptw_busy) begin
+         if (s6_tlb_replay || s2_valid && s2_itlb_miss) begin
+            ptw_busy  <= 1;
+            ptw_d     <= s6_tlb_replay;
+            ptw_level <= 1;
+            ptw_va    <= s6_tlb_replay ? s6_va : s2_pc;
+            ptw_asid  <= csr_satp`SATP_ASID;
+            ptw_addr  <= {csr_satp[19:0], s6_tlb_replay ? s6_va[31:22] : s2_pc[31:22], 2'd0};
+         end
+      end
+
+      if (tlb_flush) begin
+         ptw_busy <= 0;
+         ptw_wait <= 0;
+      end
+   end
+`else
+   wire             s6_tlb_replay = 0;
+/* verilator lint_off UNUSED */
+   wire             ptw_busy = 0;
+   wire             ptw_rd = 0;
+   wire [`XMSB:0]   ptw_addr = 0;
+/* verilator lint_on UNUSED */
+`endif
+   wire             s6_replay = s6_dc_replay | s6_tlb_replay | s6_md_replay;
+/* verilator lint_off UNUSED */
+   wire             s6_fence_i = (s6_valid && !s6_flush && !s6_trap && !s6_intr &&
+                                  s6_insn`opcode == `MISC_MEM && s6_insn`funct3 == `FENCE_I);
+/* verilator lint_on UNUSED */
+
+
+   // Data cache
+   //
+   // Direct mapped and write-back, in the data arrays above.  The tag
+   // is read along with the data as the access leaves S5 and compared
+   // in S6, where a load or store to RAM (0x8000_0000 - 0xBFFF_FFFF)
+   // that hits proceeds exactly as without the D$.
+   //
+   // A load that misses allocates an MSHR and retires without writing
+   // its register.  Instead rd is marked pending and an instruction
+   // that needs it while it's pending is replayed from S5, like an I$
+   // miss.  A store that misses allocates an MSHR too (write allocate)
+   // but replays itself, as does any access to an index with a miss
+   // outstanding or when the MSHRs are all busy.
+   //
+   // The MSHRs are a FIFO served in order by one engine: read a dirty
+   // victim out of the data arrays (in cycles where S5 isn't a load or
+   // an AMO) and write it back, refill the line with a single read burst,
+   // install it (in cycles without a store), and finally write the
+   // register from the line, in a cycle where S7 doesn't.  A younger
+   // write of the same register cancels the latter.
+   //
+   // With the I$ too, FENCE.I replays from S6 while dc_clean_idx
+   // sweeps the lines, queueing a writeback-only MSHR for each dirty
+   // one, until the sweep is done and the MSHRs have drained
+   // (dc_clean).  Then it invalidates the I$ and retires.
+`define DC_IDLE    3'd0
+`define DC_WB_READ 3'd1
+`define DC_WB      3'd2
+`define DC_REFILL  3'd3
+`define DC_INSTALL 3'd4
+`define DC_TAG     3'd5
+`define DC_REG     3'd6
+`define DC_DONE    3'd7
+
+`ifdef DCACHE
+   reg  [`XMSB:`DC_WORDS_LG2+2]     dc_tag[(1 << `DC_LINES_LG2) - 1:0];
+   reg  [(1 << `DC_LINES_LG2) - 1:0] dc_valid = 0;
+   reg  [(1 << `DC_LINES_LG2) - 1:0] dc_dirty = 0;
+   reg  [(1 << `DC_LINES_LG2) - 1:0] dc_pf = 0;    // prefetched, not used yet
+   reg  [31:0]                      dc_pending = 0; // registers a miss will write
+
+   reg  [`DC_MSHRS-1:0]             mshr_valid = 0;
+   reg  [`DC_MSHRS-1:0]             mshr_cancel;    // no register to write
+   reg  [`DC_MSHRS-1:0]             mshr_wb;        // victim is dirty
+   reg  [`DC_MSHRS-1:0]             mshr_pf;        // a prefetch
+   reg  [`DC_MSHRS-1:0]             mshr_late;      // a prefetch demanded before it's done
+   reg  [`DC_MSHRS-1:0]             mshr_clean;     // write back only, for FENCE.I
+   reg  [`XMSB:`DC_LINE_WORDS_LG2+2] mshr_line[`DC_MSHRS-1:0];
+   reg  [`XMSB:`DC_WORDS_LG2+2]     mshr_victim[`DC_MSHRS-1:0];
+   reg  [    4:0]                   mshr_rd[`DC_MSHRS-1:0];
+   reg  [    2:0]                   mshr_funct3[`DC_MSHRS-1:0];
+   reg  [`DC_LINE_WORDS_LG2+1:0]    mshr_offset[`DC_MSHRS-1:0];
+   reg  [`DC_MSHRS_LG2-1:0]         mshr_head = 0;
+   reg  [`DC_MSHRS_LG2-1:0]         mshr_tail = 0;
+
+   reg  [    2:0]                   dc_state = `DC_IDLE;
+   reg  [`XMSB:0]                   dc_buf[`DC_LINE_WORDS-1:0];
+   reg  [`DC_LINE_WORDS_LG2:0]      dc_issue;   // next word to read or install
+   reg  [`DC_LINE_WORDS_LG2:0]      dc_count;   // next word to write or refill
+   reg                              dc_ar_req = 0;
+   wire                             dc_ar_grant;
+   wire [`XMSB:0]                   dc_ar_addr = {mshr_line[mshr_head], {(`DC_LINE_WORDS_LG2+2){1'd0}}};
+   wire [`DC_LINES_LG2-1:0]         dc_index = mshr_line[mshr_head][`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2];
+   wire [`DC_LINE_WORDS_LG2-1:0]    dc_word = dc_issue[`DC_LINE_WORDS_LG2-1:0];
+   wire                             dc_wb_rd = (dc_state == `DC_WB_READ &&
+                                                !dc_issue[`DC_LINE_WORDS_LG2] &&
+                                                s5_opcode != `LOAD &&
+                                                s5_opcode != `AMO);
+   wire                             dc_install_we = (dc_state == `DC_INSTALL &&
+                                                     !dc_issue[`DC_LINE_WORDS_LG2] &&
+                                                     !s6_we && !amo_we);
+   wire                             dc_reg_we = (dc_state == `DC_REG &&
+                                                 !mshr_cancel[mshr_head] &&
+                                                 !(|s7_rd & s7_valid));
+   wire [`XMSB:0]                   dc_reg_val;
+
+   assign mem_awlen   = `DC_LINE_WORDS - 1;
+   assign mem_awsize  = 2; // 4 bytes
+   assign mem_awburst = 1; // INCR
+   assign mem_wdata   = dc_buf[dc_count[`DC_LINE_WORDS_LG2-1:0]];
+   assign mem_wstrb   = 4'hF;
+   assign mem_wlast   = dc_count == `DC_LINE_WORDS - 1;
+   assign mem_bready  = 1;
+
+   // Tag lookup, with the address computed again as S6 has it
+/* verilator lint_off UNUSED */
+   wire [`XMSB:0]                   m1_addr = s5_rs1 + (s5_opcode == `STORE ? s5_s_imm : s5_i_imm);
+/* verilator lint_on UNUSED */
+   reg  [`XMSB:`DC_WORDS_LG2+2]     m2_dc_tag;
+   reg                              m2_dc_wb = 0;
+   reg  [`DC_LINE_WORDS_LG2-1:0]    m2_dc_wb_word;
+   always @(posedge clock) begin
+      m2_dc_tag     <= dc_tag[m1_addr[`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2]];
+      m2_dc_wb      <= dc_wb_rd;
+      m2_dc_wb_word <= dc_word;
+   end
+
+   wire [`DC_LINES_LG2-1:0]         s6_dc_index = s6_addr[`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2];
+   wire                             s6_dc_op = ((s6_insn`opcode == `LOAD ||
+                                                 s6_insn`opcode == `STORE ||
+                                                 s6_insn`opcode == `AMO) &&
+                                                s6_addr[`XMSB:`XMSB-1] == 2'b10);
+   reg                              s6_dc_conflict;
+   integer                          s6_dc_k;
+   always @(*) begin
+      s6_dc_conflict = 0;
+      for (s6_dc_k = 0; s6_dc_k < `DC_MSHRS; s6_dc_k = s6_dc_k + 1)
+        if (mshr_valid[s6_dc_k] && mshr_line[s6_dc_k][`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2] == s6_dc_index)
+          s6_dc_conflict = 1;
+   end
+
+   wire                             s6_dc_hit = (s6_dc_op &&
+                                                 dc_valid[s6_dc_index] &&
+                                                 m2_dc_tag == s6_addr[`XMSB:`DC_WORDS_LG2+2] &&
+                                                 !s6_dc_conflict);
+   wire                             s6_dc_go = s6_valid && !s6_trap && !s6_intr && s6_dc_op;
+   wire                             s6_dc_alloc = (s6_dc_go && !s6_dc_hit && !s6_dc_conflict &&
+                                                   !mshr_valid[mshr_tail]);
+   wire                             s6_dc_fill = s6_dc_alloc && (s6_insn`opcode == `LOAD || s6_lr) && !s6_cross;
+`ifdef ICACHE
+   reg                              dc_cleaning = 0;
+   reg                              dc_clean = 0;
+   reg  [`DC_LINES_LG2:0]           dc_clean_idx;
+   wire [`DC_LINES_LG2-1:0]         dc_ci = dc_clean_idx[`DC_LINES_LG2-1:0];
+   wire                             dc_clean_alloc = (dc_cleaning && !dc_clean_idx[`DC_LINES_LG2] &&
+                                                      dc_valid[dc_ci] && dc_dirty[dc_ci] &&
+                                                      !mshr_valid[mshr_tail] && !s6_dc_alloc);
+   wire                             s6_dc_replay = (s6_dc_go && !s6_dc_hit && !s6_dc_fill ||
+                                                    s6_fence_i && !dc_clean);
+`else
+   wire                             dc_cleaning = 0;
+/* verilator lint_off UNUSED */
+   wire                             dc_clean = 1;
+/* verilator lint_on UNUSED */
+   wire                             s6_dc_replay = s6_dc_go && !s6_dc_hit && !s6_dc_fill;
+`endif
+
+   // rd of a load in S6 that missed becomes pending as the consumer in
+   // S4 moves on
+   wire                             s4_dc_wait
+     = s4_valid &&
+       (s4_use_rs1 && (dc_pending[s4_rs1] || s6_dc_fill && s6_rd == s4_rs1) ||
+        s4_use_rs2 && (dc_pending[s4_insn`rs2] || s6_dc_fill && s6_rd == s4_insn`rs2));
+
+   yarvi_ld_align yarvi_load_align_dc
+     (1'd0, 0, mshr_funct3[mshr_head], mshr_offset[mshr_head][1:0], 1'd0, 0,
+      dc_buf[mshr_offset[mshr_head][`DC_LINE_WORDS_LG2+1:2]], dc_reg_val);
+
+   integer                          dc_k;
+   always @(posedge clock) begin
+      if (dc_ar_grant)
+        dc_ar_req <= 0;
+
+      if (m2_dc_wb)
+        dc_buf[m2_dc_wb_word] <= m2_memory_data;
+
+      case (dc_state)
+        `DC_IDLE:
+          if (mshr_valid[mshr_head]) begin
+             dc_issue <= 0;
+             dc_count <= 0;
+             if (mshr_wb[mshr_head])
+               dc_state <= `DC_WB_READ;
+             else begin
+                dc_state  <= `DC_REFILL;
+                dc_ar_req <= 1;
+             end
+          end
+
+        `DC_WB_READ: begin
+           if (dc_wb_rd)
+             dc_issue <= dc_issue + 1;
+           if (dc_issue[`DC_LINE_WORDS_LG2] && !m2_dc_wb) begin
+              dc_state    <= `DC_WB;
+              mem_awvalid <= 1;
+              mem_awaddr  <= {mshr_victim[mshr_head], dc_index, {(`DC_LINE_WORDS_LG2+2){1'd0}}};
+              mem_wvalid  <= 1;
+`ifndef QUIET
+              $display("D$ WRITEBACK: %x", {mshr_victim[mshr_head], dc_index, {(`DC_LINE_WORDS_LG2+2){1'd0}}});
+`endif
+           end
+        end
+
+        `DC_WB: begin
+           if (mem_awready)
+             mem_awvalid <= 0;
+           if (mem_wvalid & mem_wready) begin
+              dc_count <= dc_count + 1;
+              if (mem_wlast)
+                mem_wvalid <= 0;
+           end
+           if (mem_bvalid)
+             if (mshr_clean[mshr_head])
+               dc_state <= `DC_DONE;
+             else begin
+                dc_state  <= `DC_REFILL;
+                dc_count  <= 0;
+                dc_ar_req <= 1;
+             end
+        end
+
+        `DC_REFILL:
+          if (mem_rvalid & mem_rd_dc) begin
+             dc_buf[dc_count[`DC_LINE_WORDS_LG2-1:0]] <= mem_rdata;
+             dc_count <= dc_count + 1;
+             if (mem_rlast) begin
+                dc_state <= `DC_INSTALL;
+                dc_issue <= 0;
+             end
+          end
+
+        `DC_INSTALL:
+          if (dc_install_we)
+            dc_issue <= dc_issue + 1;
+          else if (dc_issue[`DC_LINE_WORDS_LG2])
+            dc_state <= `DC_TAG;
+
+        `DC_TAG: begin
+           dc_tag[dc_index]   <= mshr_line[mshr_head][`XMSB:`DC_WORDS_LG2+2];
+           dc_valid[dc_index] <= 1;
+           dc_dirty[dc_index] <= 0;
+           dc_pf[dc_index]    <= mshr_pf[mshr_head] & !mshr_late[mshr_head];
+           dc_state           <= `DC_REG;
+        end
+
+        `DC_REG:
+          if (mshr_cancel[mshr_head] || !(|s7_rd & s7_valid))
+            dc_state <= `DC_DONE;
+
+        `DC_DONE: begin
+           if (!mshr_cancel[mshr_head])
+             dc_pending[mshr_rd[mshr_head]] <= 0;
+           mshr_valid[mshr_head] <= 0;
+           mshr_head             <= mshr_head + 1;
+           dc_state              <= `DC_IDLE;
+        end
+      endcase
+
+      if (s6_we)
+        dc_dirty[s6_dc_index] <= 1;
+
+      if (amo_we)
+        dc_dirty[amo_addr[`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2]] <= 1;
+
+      if (s6_dc_go & s6_dc_hit)
+        dc_pf[s6_dc_index] <= 0;
+
+      if (s6_dc_go)
+        for (dc_k = 0; dc_k < `DC_MSHRS; dc_k = dc_k + 1)
+          if (mshr_valid[dc_k] && mshr_pf[dc_k] && mshr_line[dc_k] == s6_addr[`XMSB:`DC_LINE_WORDS_LG2+2])
+            mshr_late[dc_k] <= 1;
+
+      // A younger write of a pending register supersedes the miss
+      if (|s7_rd & s7_valid) begin
+         dc_pending[s7_rd] <= 0;
+         for (dc_k = 0; dc_k < `DC_MSHRS; dc_k = dc_k + 1)
+           if (mshr_rd[dc_k] == s7_rd)
+             mshr_cancel[dc_k] <= 1;
+      end
+
+      if (s6_dc_alloc) begin
+`ifndef QUIET
+         $display("D$ MISS: %x", s6_addr);
+`endif
+         for (dc_k = 0; dc_k < `DC_MSHRS; dc_k = dc_k + 1)
+           if (mshr_rd[dc_k] == s6_rd)
+             mshr_cancel[dc_k] <= 1;
+         if (s6_dc_fill & |s6_rd)
+           dc_pending[s6_rd]    <= 1;
+         mshr_valid[mshr_tail]  <= 1;
+         mshr_cancel[mshr_tail] <= !s6_dc_fill || s6_rd == 0;
+         mshr_wb[mshr_tail]     <= dc_valid[s6_dc_index] & dc_dirty[s6_dc_index];
+         mshr_pf[mshr_tail]     <= 0;
+         mshr_late[mshr_tail]   <= 0;
+         mshr_clean[mshr_tail]  <= 0;
+         mshr_line[mshr_tail]   <= s6_addr[`XMSB:`DC_LINE_WORDS_LG2+2];
+         mshr_victim[mshr_tail] <= m2_dc_tag;
+         mshr_rd[mshr_tail]     <= s6_rd;
+         mshr_funct3[mshr_tail] <= s6_insn`funct3;
+         mshr_offset[mshr_tail] <= s6_addr[`DC_LINE_WORDS_LG2+1:0];
+         mshr_tail              <= mshr_tail + 1;
+         dc_valid[s6_dc_index]  <= 0;
+      end
+`ifndef NO_PREFETCH
+      else if (pf_alloc) begin
+         mshr_valid[mshr_tail]  <= 1;
+         mshr_cancel[mshr_tail] <= 1;
+         mshr_wb[mshr_tail]     <= dc_valid[pf_index] & dc_dirty[pf_index];
+         mshr_pf[mshr_tail]     <= 1;
+         mshr_late[mshr_tail]   <= 0;
+         mshr_clean[mshr_tail]  <= 0;
+         mshr_line[mshr_tail]   <= pf_line;
+         mshr_victim[mshr_tail] <= pf_tag;
+         mshr_rd[mshr_tail]     <= 0;
+         mshr_tail              <= mshr_tail + 1;
+         dc_valid[pf_index]     <= 0;
+      end
+`endif
+`ifdef ICACHE
+      else if (dc_clean_alloc) begin
+         mshr_valid[mshr_tail]  <= 1;
+         mshr_cancel[mshr_tail] <= 1;
+         mshr_wb[mshr_tail]     <= 1;
+         mshr_pf[mshr_tail]     <= 0;
+         mshr_late[mshr_tail]   <= 0;
+         mshr_clean[mshr_tail]  <= 1;
+         mshr_line[mshr_tail]   <= {dc_tag[dc_ci], dc_ci};
+         mshr_victim[mshr_tail] <= dc_tag[dc_ci];
+         mshr_rd[mshr_tail]     <= 0;
+         mshr_tail              <= mshr_tail + 1;
+         dc_dirty[dc_ci]        <= 0;
+      end
+
+      // The sweep starts once an AMO ahead of the FENCE.I has written
+      if (s6_fence_i && !dc_cleaning && !s7_amo && !amo_we) begin
+         dc_cleaning  <= 1;
+         dc_clean_idx <= 0;
+      end else if (dc_cleaning && !dc_clean_idx[`DC_LINES_LG2] &&
+                   (dc_clean_alloc || !(dc_valid[dc_ci] && dc_dirty[dc_ci])))
+         dc_clean_idx <= dc_clean_idx + 1;
+      else if (dc_cleaning && dc_clean_idx[`DC_LINES_LG2] && mshr_valid == 0)
+         dc_clean     <= 1;
+
+      if (s6_fence_i && dc_clean) begin
+         dc_cleaning  <= 0;
+         dc_clean     <= 0;
+      end
+`endif
+
+      if (reset) begin
+`ifdef ICACHE
+         dc_cleaning <= 0;
+         dc_clean    <= 0;
+`endif
+         dc_valid    <= 0;
+         dc_dirty    <= 0;
+         dc_pf       <= 0;
+         dc_pending  <= 0;
+         mshr_valid  <= 0;
+         mshr_head   <= 0;
+         mshr_tail   <= 0;
+         dc_state    <= `DC_IDLE;
+         dc_ar_req   <= 0;
+         mem_awvalid <= 0;
+         mem_wvalid  <= 0;
+      end
+   end
+
+`ifndef NO_PREFETCH
+   // Prefetcher
+   //
+   // Loads train a small table, indexed by their pc, of the last
+   // address and the stride to the one before.  Once the same stride
+   // has been seen twice the line 2^DC_PF_DISTANCE_LG2 strides ahead is
+   // prefetched, and a miss by a load without a stride prefetches the
+   // next line.  The candidate's tag is read the next cycle and it's
+   // allocated an MSHR (that writes no register) the cycle after,
+   // unless the line is present or on its way, no MSHR is free, or S6
+   // is allocating or accessing the same index, in which case it's
+   // dropped.  Training is done in S6, rather than on m1_load_addr, as
+   // only then is it known whether the load missed or replays.
+   //
+   // Throttling: one candidate at a time, and an accuracy counter, up
+   // when a prefetched line is first used (or demanded while still in
+   // flight) and down when one is evicted unused, stops prefetching at
+   // zero until a load the table predicted misses.
+   reg  [`XMSB:0]                   pf_last[(1 << `DC_PF_LG2) - 1:0];
+   reg  [`XMSB:0]                   pf_stride[(1 << `DC_PF_LG2) - 1:0];
+   reg                              pf_seen[(1 << `DC_PF_LG2) - 1:0];  // stride seen twice
+   reg  [    2:0]                   pf_acc = 4;
+   reg                              pf_req = 0;    // candidate, reading its tag
+   reg                              pf_probe = 0;  // tag read, allocate?
+   reg  [`XMSB:`DC_LINE_WORDS_LG2+2] pf_line;
+   reg  [`XMSB:`DC_WORDS_LG2+2]     pf_tag;
+   reg  [   31:0]                   pf_issued = 0; // for simulation
+   reg  [   31:0]                   pf_useful = 0;
+   reg  [   31:0]                   pf_late = 0;
+
+   wire [`DC_PF_LG2-1:0]            s6_pf_idx = s6_pc[`DC_PF_LG2+1:2];
+   wire [`XMSB:0]                   s6_pf_delta = s6_addr - pf_last[s6_pf_idx];
+   wire                             s6_pf_train = (s6_dc_go && s6_insn`opcode == `LOAD &&
+                                                   !s6_dc_replay && !s6_ma_second);
+   wire                             s6_pf_match = s6_pf_delta == pf_stride[s6_pf_idx] && |s6_pf_delta;
+   wire                             s6_pf_stride = s6_pf_match && pf_seen[s6_pf_idx];
+   wire [`XMSB:0]                   s6_pf_addr
+     = s6_pf_stride ? s6_addr + (pf_stride[s6_pf_idx] << `DC_PF_DISTANCE_LG2)
+                    : s6_addr + (`DC_LINE_WORDS << 2);
+
+   wire [`DC_LINES_LG2-1:0]         pf_index = pf_line[`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2];
+   reg                              pf_conflict;
+   integer                          pf_k;
+   always @(*) begin
+      pf_conflict = 0;
+      for (pf_k = 0; pf_k < `DC_MSHRS; pf_k = pf_k + 1)
+        if (mshr_valid[pf_k] && mshr_line[pf_k][`DC_WORDS_LG2+1:`DC_LINE_WORDS_LG2+2] == pf_index)
+          pf_conflict = 1;
+   end
+
+   wire                             pf_alloc = (pf_probe &&
+                                                !(dc_valid[pf_index] && pf_tag == pf_line[`XMSB:`DC_WORDS_LG2+2]) &&
+                                                !pf_conflict &&
+                                                !mshr_valid[mshr_tail] &&
+                                                !s6_dc_alloc &&
+                                                !(s6_dc_go && s6_dc_index == pf_index) &&
+                                                !s7_amo && !amo_we && !dc_cleaning);
+
+   wire                             pf_up = (s6_dc_go && s6_dc_hit && dc_pf[s6_dc_index] ||
+                                             dc_state == `DC_DONE && mshr_pf[mshr_head] && mshr_late[mshr_head] ||
+                                             s6_pf_stride && s6_dc_fill && pf_acc == 0);
+   wire                             pf_down = (s6_dc_alloc && dc_valid[s6_dc_index] && dc_pf[s6_dc_index] ||
+                                               pf_alloc && dc_valid[pf_index] && dc_pf[pf_index]);
+
+   always @(posedge clock) begin
+      if (s6_pf_train) begin
+         pf_last[s6_pf_idx]   <= s6_addr;
+         pf_stride[s6_pf_idx] <= s6_pf_delta;
+         pf_seen[s6_pf_idx]   <= s6_pf_match;
+      end
+
+      pf_probe <= pf_req;
+      pf_tag   <= dc_tag[pf_index];
+      pf_req   <= 0;
+      if (s6_pf_train && (s6_pf_stride || s6_dc_fill) && !pf_req && pf_acc != 0 &&
+          s6_pf_addr[`XMSB:`XMSB-1] == 2'b10) begin
+         pf_req  <= 1;
+         pf_line <= s6_pf_addr[`XMSB:`DC_LINE_WORDS_LG2+2];
+      end
+
+      if (pf_up & !pf_down & pf_acc != 7)
+        pf_acc <= pf_acc + 1;
+      if (pf_down & !pf_up & pf_acc != 0)
+        pf_acc <= pf_acc - 1;
+
+      pf_issued <= pf_issued + pf_alloc;
+      pf_useful <= pf_useful + (s6_dc_go && s6_dc_hit && dc_pf[s6_dc_index]);
+      pf_late   <= pf_late + (dc_state == `DC_DONE && mshr_pf[mshr_head] && mshr_late[mshr_head]);
+
+      if (reset) begin
+         pf_req   <= 0;
+         pf_probe <= 0;
+         pf_acc   <= 4;
+      end
+   end
 
 `ifdef VERILATOR
-`define HAS_PLUSARGS 1
+   final
+     $display("D$ prefetches: %1d issued, %1d useful, %1d late", pf_issued, pf_useful, pf_late);
+`endif
 `endif
+`else
+   wire             s4_dc_wait = 0;
+   wire             s6_dc_fill = 0;
+   wire             dc_reg_we = 0;
+`ifdef ICACHE
+   // Write-through queue
+   //
+   // Without the D$, loads and stores use the on-chip memory but the
+   // I$ refills from the memory bus, so every store (and AMO) to RAM
+   // is also queued and written there, one single-beat burst at a
+   // time.  A store that finds the queue full replays, and so does a
+   // FENCE.I until the queue has drained (dc_clean), after which the
+   // I$ is invalidated as with the D$.
+   reg  [`XMSB:2]   wt_addr[3:0];
+   reg  [   31:0]   wt_data[3:0];
+   reg  [    3:0]   wt_mask[3:0];
+   reg  [    1:0]   wt_head = 0, wt_tail = 0;
+   reg  [    2:0]   wt_count = 0;    // including the one on the bus
+   reg              wt_busy = 0;     // wt_head is on the bus
+   wire             wt_full = wt_count == 4;
+   wire             dc_clean = wt_count == 0;
+   wire             s6_dc_replay = (s6_valid && !s6_trap && !s6_intr && wt_full &&
+                                    (s6_insn`opcode == `STORE || s6_insn`opcode == `AMO) ||
+                                    s6_fence_i && !dc_clean);
+   wire             wt_push = s6_we | amo_we & amo_in_mem;
+   wire             wt_pop = mem_bvalid & mem_bready;
+
+   assign mem_awlen   = 0;
+   assign mem_awsize  = 2; // 4 bytes
+   assign mem_awburst = 1; // INCR
+   assign mem_wdata   = wt_data[wt_head];
+   assign mem_wstrb   = wt_mask[wt_head];
+   assign mem_wlast   = 1;
+   assign mem_bready  = 1;
 
-`ifdef YOSYS
-// Doesn't appear to support $value$plusargs
+   always @(posedge clock) begin
+      // An AMO writes from S8 while S3 holds back any younger access,
+      // so this never coincides with a store from S6
+      if (wt_push) begin
+         wt_addr[wt_tail] <= amo_we ? amo_addr[`XMSB:2] : s6_addr[`XMSB:2];
+         wt_data[wt_tail] <= amo_we ? amo_data : s6_st_data;
+         wt_mask[wt_tail] <= amo_we ? 4'hF : s6_st_mask;
+         wt_tail          <= wt_tail + 1;
+      end
+      wt_count <= wt_count + wt_push - wt_pop;
+
+      if (mem_awready)
+        mem_awvalid <= 0;
+      if (mem_wready)
+        mem_wvalid <= 0;
+      if (wt_pop) begin
+         wt_busy <= 0;
+         wt_head <= wt_head + 1;
+      end else if (!wt_busy && wt_count != 0) begin
+         wt_busy     <= 1;
+         mem_awvalid <= 1;
+         mem_awaddr  <= {wt_addr[wt_head], 2'd0};
+         mem_wvalid  <= 1;
+      end
+
+      if (reset) begin
+         wt_head     <= 0;
+         wt_tail     <= 0;
+         wt_count    <= 0;
+         wt_busy     <= 0;
+         mem_awvalid <= 0;
+         mem_wvalid  <= 0;
+      end
+   end
+`else
+   wire             s6_dc_replay = 0;
+/* verilator lint_off UNUSED */
+   wire             dc_clean = 1;
+/* verilator lint_on UNUSED */
+`endif
 `endif
 
-`ifdef ALTERA_RESERVED_QIS
-// Doesn't appear to support $value$plusargs
+
+
+`define MD_IDLE 2'd0
+`define MD_DIV  2'd1
+`define MD_REG  2'd2
+`define MD_DONE 2'd3
+
+`ifndef NO_MULDIV
+   // Multiply and divide
+   //
+   // A multiply goes down the pipeline like a load: yarvi_mul registers
+   // its operands from S5, the product is registered into s7_wb_val,
+   // and a consumer stalls in S3 until it can be forwarded from S7.
+   //
+   // A divide commits in S6 and then runs in yarvi_div like a D$ miss
+   // without the memory: its rd is pending until the result is written
+   // in a cycle S7 and the D$ don't write, and only a consumer of it
+   // replays (s4_md_wait).  A divide finding the divider busy, or its
+   // rd pending on a load miss, replays itself.
+   wire             s5_mul = s5_opcode == `OP && s5_insn`funct7 == `MULDIV && s5_insn`funct3 < `DIV;
+   reg              s6_mul = 0;
+   wire [`XMSB:0]   s6_mul_val;
+
+   yarvi_mul yarvi_mul
+     (.clock(clock), .funct3(s5_insn`funct3), .a(s5_rs1), .b(s5_rs2), .result(s6_mul_val));
+
+   reg  [    1:0]   md_state = `MD_IDLE;
+   reg              md_pending = 0; // md_rd will be written
+   reg              md_cancel;      // no register to write
+   reg  [    4:0]   md_rd;
+   wire             md_busy;
+   wire [`XMSB:0]   md_result;
+   wire             md_reg_we = (md_state == `MD_REG &&
+                                 !md_cancel &&
+                                 !(|s7_rd & s7_valid) &&
+                                 !dc_reg_we);
+
+   wire             s6_md_go = (s6_valid && !s6_trap && !s6_intr &&
+                                s6_insn`opcode == `OP && s6_insn`funct7 == `MULDIV &&
+                                s6_insn`funct3 >= `DIV);
+`ifdef DCACHE
+   wire             s6_md_replay = s6_md_go && (md_state != `MD_IDLE || dc_pending[s6_rd]);
+`else
+   wire             s6_md_replay = s6_md_go && md_state != `MD_IDLE;
 `endif
+   wire             s6_md_start = s6_md_go && !s6_md_replay;
+
+   wire             s4_md_wait
+     = s4_valid &&
+       (s4_use_rs1 && (md_pending && md_rd == s4_rs1 || s6_md_start && s6_rd == s4_rs1) ||
+        s4_use_rs2 && (md_pending && md_rd == s4_insn`rs2 || s6_md_start && s6_rd == s4_insn`rs2));
+
+   yarvi_div yarvi_div
+     (.clock(clock), .start(s6_md_start), .funct3(s6_insn`funct3), .a(s6_rs1), .b(s6_rs2),
+      .busy(md_busy), .result(md_result));
+
+   always @(posedge clock) begin
+      s6_mul <= s5_mul;
+
+      case (md_state)
+        `MD_DIV:
+          if (!md_busy)
+            md_state <= `MD_REG;
+
+        `MD_REG:
+          if (md_cancel || !(|s7_rd & s7_valid) && !dc_reg_we)
+            md_state <= `MD_DONE;
+
+        `MD_DONE: begin
+           md_pending <= 0;
+           md_state   <= `MD_IDLE;
+        end
+      endcase
+
+      // A younger write of the pending register supersedes the divide
+      if (|s7_rd & s7_valid && s7_rd == md_rd || s6_dc_fill && s6_rd == md_rd) begin
+         md_pending <= 0;
+         md_cancel  <= 1;
+      end
+
+      if (s6_md_start) begin
+         md_pending <= |s6_rd;
+         md_cancel  <= s6_rd == 0;
+         md_rd      <= s6_rd;
+         md_state   <= `MD_DIV;
+      end
+
+      if (reset) begin
+         md_pending <= 0;
+         md_state   <= `MD_IDLE;
+      end
+   end
+`else
+   wire             s4_md_wait = 0;
+   wire             s6_md_start = 0;
+   wire             s6_md_replay = 0;
+`endif
+
+
+
+`ifdef MEM_BUS
+   // Memory bus
+   //
+   // One AXI4 read burst at a time, of a whole line, with the D$ ahead
+   // of the I$.  The D$ writes back whole lines and without it the
+   // write-through queue writes single words.
+   reg              mem_rd_busy = 0;
+   reg              mem_rd_dc = 0; // the burst is the D$'s
+`ifdef DCACHE
+   assign           dc_ar_grant = !mem_rd_busy & dc_ar_req;
+`else
+   wire             dc_ar_req = 0;
+   wire             dc_ar_grant = 0;
+   wire [`XMSB:0]   dc_ar_addr = 0;
+`endif
+`ifdef ICACHE
+   assign           ic_ar_grant = !mem_rd_busy & !dc_ar_req & ic_ar_req;
+`else
+/* verilator lint_off UNUSED */
+   wire             ic_ar_req = 0;
+/* verilator lint_on UNUSED */
+   wire             ic_ar_grant = 0;
+   wire [`VMSB:0]   ic_ar_addr = 0;
+`endif
+
+   assign           mem_arsize  = 2; // 4 bytes
+   assign           mem_arburst = 1; // INCR
+   assign           mem_rready  = 1;
+
+   always @(posedge clock) begin
+      if (mem_arready)
+        mem_arvalid <= 0;
+
+      if (mem_rvalid & mem_rlast)
+        mem_rd_busy <= 0;
+
+      if (dc_ar_grant | ic_ar_grant) begin
+         mem_arvalid <= 1;
+         mem_rd_busy <= 1;
+         mem_rd_dc   <= dc_ar_grant;
+         mem_araddr  <= dc_ar_grant ? dc_ar_addr : ic_ar_addr;
+         mem_arlen   <= dc_ar_grant ? `DC_LINE_WORDS - 1 : (1 << `IC_LINE_WORDS_LG2) - 1;
+      end
+
+      if (reset) begin
+         mem_arvalid <= 0;
+         mem_rd_busy <= 0;
+      end
+   end
+`endif
+
+
+
+   // Module outputs
+   assign           restart    = s6_restart;
+   assign           restart_pc = s6_restart_pc;
 
 `ifdef HAS_PLUSARGS
    reg [511:0]   init_mem_0 = "init_mem.0.hex",
@@ -1629,37 +4112,52 @@ module yarvi
          /*$display("Loading lane 2 from %s", init_mem_2)*/;
       if ($value$plusargs("INIT3=%s", init_mem_3))
          /*$display("Loading lane 3 from %s", init_mem_3)*/;
+`ifdef DCACHE
+`ifndef ICACHE
       $readmemh(init_mem_0, code0);
-      $readmemh(init_mem_0, data0);
       $readmemh(init_mem_1, code1);
-      $readmemh(init_mem_1, data1);
       $readmemh(init_mem_2, code2);
-      $readmemh(init_mem_2, data2);
       $readmemh(init_mem_3, code3);
-      $readmemh(init_mem_3, data3);
+`endif
+`else
+      $readmemh(init_mem_0, ram0.mem);
+      $readmemh(init_mem_1, ram1.mem);
+      $readmemh(init_mem_2, ram2.mem);
+      $readmemh(init_mem_3, ram3.mem);
+`endif
 `else
+`ifdef DCACHE
+`ifndef ICACHE
       $readmemh("init_mem.0.hex", code0);
-      $readmemh("init_mem.0.hex", data0);
       $readmemh("init_mem.1.hex", code1);
-      $readmemh("init_mem.1.hex", data1);
       $readmemh("init_mem.2.hex", code2);
-      $readmemh("init_mem.2.hex", data2);
       $readmemh("init_mem.3.hex", code3);
-      $readmemh("init_mem.3.hex", data3);
+`endif
+`endif
 `endif
 
       for (i = 0; i < 32; i = i + 1)
         regs[i[4:0]] = {26'd0,i[5:0]};
       regs[2] = 'h80000000 + (1 << (`PMSB + 1)); // XXX Total hack
-      for (i = 0; i < 2 << `BTB_INDEX_MSB; i = i + 1) begin
+      for (i = 0; i < 2 << (`BTB_INDEX_MSB + `BTB_WAYS_LG2); i = i + 1) begin
          btb_target[i] = 0;
          btb_type[i] = 0;
          btb_tag[i] = ~0;
       end
+`ifndef BTB_REPLACE_RANDOM
+      for (i = 0; i < 2 << `BTB_INDEX_MSB; i = i + 1)
+        btb_nru[i] = 0;
+`endif
+      for (i = 0; i < 2 << `ITC_INDEX_MSB; i = i + 1) begin
+         itc_tag[i] = ~0;
+         itc_conf[i] = 0;
+      end
+`ifndef TAGE
       for (i = 0; i < 2 << `YAGS_INDEX_MSB; i = i + 1) begin
          yags_tag[i] = ~0;
          yags_direction[i] = 1;
       end
+`endif
    end
 
 `ifdef DISASSEMBLE
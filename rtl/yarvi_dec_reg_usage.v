@@ -53,6 +53,7 @@ module yarvi_dec_reg_usage
           `OP_IMM_32: {rd,use_rs2,use_rs1} = {   dest, unused,   used};
           `JALR:      {rd,use_rs2,use_rs1} = {   dest, unused,   used};
           `LOAD:      {rd,use_rs2,use_rs1} = {   dest, unused,   used};
+          `AMO:       {rd,use_rs2,use_rs1} = {   dest,   used,   used};
           `SYSTEM:
             case (insn`funct3)
               `CSRRS, `CSRRC, `CSRRW:
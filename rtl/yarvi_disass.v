@@ -73,6 +73,22 @@ module yarvi_disass( input             clock
              endcase
 
            `OP_IMM:
+             case ({insn`funct7, insn`rs2, insn`funct3})
+               {7'h30, 5'd0, 3'd1}:  $write(" clz    r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h30, 5'd1, 3'd1}:  $write(" ctz    r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h30, 5'd2, 3'd1}:  $write(" cpop   r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h30, 5'd4, 3'd1}:  $write(" sext.b r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h30, 5'd5, 3'd1}:  $write(" sext.h r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h14, 5'd7, 3'd5}:  $write(" orc.b  r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h34, 5'd24, 3'd5}: $write(" rev8   r%1d, r%1d", insn`rd, insn`rs1);
+               default:
+             case ({insn`funct7, insn`funct3})
+               {7'h30, 3'd5}: $write(" rori   r%1d, r%1d, %1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h24, 3'd1}: $write(" bclri  r%1d, r%1d, %1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h14, 3'd1}: $write(" bseti  r%1d, r%1d, %1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h34, 3'd1}: $write(" binvi  r%1d, r%1d, %1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h24, 3'd5}: $write(" bexti  r%1d, r%1d, %1d", insn`rd, insn`rs1, insn`rs2);
+               default:
              case (insn`funct3)
                `ADDSUB:
                  if (insn == 32 'h 00000013)
@@ -88,8 +104,41 @@ module yarvi_disass( input             clock
                `AND:  $write(" andi   r%1d, r%1d, %1d", insn`rd, insn`rs1, $signed(i_imm));
                default:$write(" OP_IMM %1d", insn`funct3);
              endcase
+             endcase
+             endcase
 
            `OP:
+             if (insn`funct7 == `MULDIV)
+             case (insn`funct3)
+               `MUL:    $write(" mul    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `MULH:   $write(" mulh   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `MULHSU: $write(" mulhsu r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `MULHU:  $write(" mulhu  r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `DIV:    $write(" div    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `DIVU:   $write(" divu   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `REM:    $write(" rem    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               `REMU:   $write(" remu   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+             endcase
+             else
+             case ({insn`funct7, insn`funct3})
+               {7'h10, 3'd2}: $write(" sh1add r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h10, 3'd4}: $write(" sh2add r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h10, 3'd6}: $write(" sh3add r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h20, 3'd7}: $write(" andn   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h20, 3'd6}: $write(" orn    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h20, 3'd4}: $write(" xnor   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h05, 3'd4}: $write(" min    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h05, 3'd5}: $write(" minu   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h05, 3'd6}: $write(" max    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h05, 3'd7}: $write(" maxu   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h30, 3'd1}: $write(" rol    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h30, 3'd5}: $write(" ror    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h04, 3'd4}: $write(" zext.h r%1d, r%1d", insn`rd, insn`rs1);
+               {7'h24, 3'd1}: $write(" bclr   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h14, 3'd1}: $write(" bset   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h34, 3'd1}: $write(" binv   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               {7'h24, 3'd5}: $write(" bext   r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
+               default:
              case (insn`funct3)
                `ADDSUB: if (insn[30])
                  $write(" sub    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
@@ -107,6 +156,7 @@ module yarvi_disass( input             clock
                `AND: $write(" and    r%1d, r%1d, r%1d", insn`rd, insn`rs1, insn`rs2);
                default: $write(" OP %1d", insn`funct3);
              endcase
+             endcase
 
            `LUI:  $write(" lui    r%1d, 0x%1x000", insn`rd, insn[31:12]);
 
@@ -133,6 +183,22 @@ module yarvi_disass( input             clock
                default: $write(" s??%1d?? r%1d, %1d(r%1d)", insn`funct3, insn`rs2, $signed(s_imm), insn`rs1);
              endcase
 
+           `AMO:
+             case (insn`funct5)
+               `LR:      $write(" lr.w   r%1d, (r%1d)", insn`rd, insn`rs1);
+               `SC:      $write(" sc.w   r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOSWAP: $write(" amoswap.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOADD:  $write(" amoadd.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOXOR:  $write(" amoxor.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOAND:  $write(" amoand.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOOR:   $write(" amoor.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOMIN:  $write(" amomin.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOMAX:  $write(" amomax.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOMINU: $write(" amominu.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               `AMOMAXU: $write(" amomaxu.w r%1d, r%1d, (r%1d)", insn`rd, insn`rs2, insn`rs1);
+               default:  $write(" AMO %1d", insn`funct5);
+             endcase
+
            `JAL: $write(" jal    r%1d, 0x%x", insn`rd, pc + uj_imm);
            `JALR:
              if (insn`rd == 0 && i_imm == 0 && insn`rs1 == 1)
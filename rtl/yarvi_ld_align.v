@@ -20,7 +20,8 @@
 // -----------------------------------------------------------------------
 
 // Assumptions:
-// - we don't support misaligned loads
+// - a misaligned load crossing a word comes in two beats, the second
+//   with cross set and the first word in prev
 // - only RV32
 
 // XXX The bypass feature isn't as useful as expected
@@ -36,17 +37,26 @@ module yarvi_ld_align
   ,input  wire [`XMSB:0] bypass_val
   ,input  wire [    2:0] funct3
   ,input  wire [    1:0] address
+  ,input  wire           cross
+  ,input  wire [`XMSB:0] prev
   ,input  wire [`XMSB:0] readdata
   ,output reg  [`XMSB:0] aligned);
 
+   reg [31:0] merged;
    reg [31:0] shifted;
-   // Conceptually readdata >> (8 * address[1:0]), but optimized
+   // Conceptually {readdata,prev} >> (8 * address[1:0]) for the
+   // second beat, otherwise readdata >> (8 * address[1:0]), done as a
+   // rotate of the bytes at and above address from prev
    always @(*) begin
+     merged = {cross && address != 0 ? prev[31:24] : readdata[31:24],
+               cross && address <= 2 && address != 0 ? prev[23:16] : readdata[23:16],
+               cross && address == 1 ? prev[15: 8] : readdata[15: 8],
+                                                     readdata[ 7: 0]};
      case (address)
-       0: shifted =         readdata;
-       1: shifted = {24'hX, readdata[15: 8]}; // must be byte access
-       2: shifted = {16'hX, readdata[31:16]}; // at most half access
-       3: shifted = {24'hX, readdata[31:24]}; // must be byte access
+       0: shifted =  readdata;
+       1: shifted = {merged[ 7:0], merged[31: 8]};
+       2: shifted = {merged[15:0], merged[31:16]};
+       3: shifted = {merged[23:0], merged[31:24]};
      endcase
 
      case (funct3 | {3{bypass}})
@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------
+//
+// The RV32M multiplier and divider
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+// Assumptions:
+// - only RV32
+
+/* The width comparisons in Verilator are completely broken. */
+/* verilator lint_off WIDTH */
+
+`include "yarvi.h"
+`default_nettype none
+
+// A 33x33 signed multiply with registered operands, meant to be
+// registered again by the user so the whole thing maps onto the DSP
+// blocks.  All four of MUL, MULH, MULHSU, and MULHU are one multiply
+// with the operands sign- or zero-extended.
+module yarvi_mul
+  (input  wire           clock
+  ,input  wire [    2:0] funct3
+  ,input  wire [   31:0] a
+  ,input  wire [   31:0] b
+  ,output wire [   31:0] result);
+
+   reg  signed [32:0] a_r;
+   reg  signed [32:0] b_r;
+   reg                hi;
+/* verilator lint_off UNUSED */
+   wire signed [65:0] product = a_r * b_r;
+/* verilator lint_on UNUSED */
+
+   always @(posedge clock) begin
+      a_r <= {funct3 != `MULHU && a[31], a};
+      b_r <= {funct3 == `MULH  && b[31], b};
+      hi  <= funct3 != `MUL;
+   end
+
+   assign result = hi ? product[63:32] : product[31:0];
+endmodule
+
+// A radix-2 restoring divider on the magnitudes, with the leading
+// zeros of the dividend skipped, so a division takes 2 + 32 - clz(|a|)
+// cycles, from start to busy falling with the result.  Division by
+// zero gives all ones and the dividend as the ISA wants it, and the
+// overflow case (-2^31 / -1) falls out of the magnitudes.
+module yarvi_div
+  (input  wire           clock
+  ,input  wire           start
+  ,input  wire [    2:0] funct3
+  ,input  wire [   31:0] a
+  ,input  wire [   31:0] b
+  ,output reg            busy = 0
+  ,output reg  [   31:0] result);
+
+   wire        signed_op = !funct3[0];
+   wire        neg_a = signed_op & a[31];
+   wire        neg_b = signed_op & b[31];
+   wire [31:0] ua = neg_a ? -a : a;
+   wire [31:0] ub = neg_b ? -b : b;
+
+   reg  [ 5:0] lz;
+   integer     i;
+   always @(*) begin
+      lz = 32;
+      for (i = 0; i < 32; i = i + 1)
+        if (ua[i])
+          lz = 31 - i;
+   end
+
+   reg  [31:0] q;     // dividend bits shift out as quotient bits shift in
+   reg  [31:0] r;     // partial remainder
+   reg  [31:0] d;
+   reg  [ 5:0] n;     // steps to go
+   reg         rem;
+   reg         neg_q;
+   reg         neg_r;
+   wire [33:0] diff = {1'd0, r, q[31]} - {2'd0, d};
+
+   always @(posedge clock)
+     if (start) begin
+        busy  <= 1;
+        rem   <= funct3[1];
+        neg_q <= (neg_a ^ neg_b) && b != 0;
+        neg_r <= neg_a;
+        d     <= ub;
+        if (b == 0) begin
+           q  <= ~0;
+           r  <= ua;
+           n  <= 0;
+        end else begin
+           q  <= ua << lz;
+           r  <= 0;
+           n  <= 32 - lz;
+        end
+     end else if (busy)
+       if (n != 0) begin
+          q <= {q[30:0], !diff[33]};
+          r <= diff[33] ? {r[30:0], q[31]} : diff[31:0];
+          n <= n - 1;
+       end else begin
+          result <= rem ? (neg_r ? -r : r) : (neg_q ? -q : q);
+          busy   <= 0;
+       end
+endmodule
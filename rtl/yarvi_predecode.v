@@ -0,0 +1,48 @@
+// -----------------------------------------------------------------------
+//
+// A purely combinatorial RISC-V predecoder, for the static prediction
+// on a BTB miss
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/* The width comparisons in Verilator are completely broken. */
+/* verilator lint_off WIDTH */
+
+`include "yarvi.h"
+
+`default_nettype none
+
+module yarvi_predecode
+  (
+/* Bits of signal are not used: 'insn'[30:20,14:12,1:0] */
+/* verilator lint_off UNUSED */
+    input  wire [   31:0] insn
+/* verilator lint_on UNUSED */
+  , output reg  [    2:0] pd);
+
+   wire link_rd  = insn`rd  == 1 || insn`rd  == 5;
+   wire link_rs1 = insn`rs1 == 1 || insn`rs1 == 5;
+
+   always @(*)
+     case (insn`opcode)
+       `BRANCH: pd = insn[31] ? `PD_BR_BACK : `PD_BR_FWD;
+       `JAL:    pd = link_rd ? `PD_CALL : `PD_JUMP;
+       `JALR:   pd = link_rs1 && !link_rd ? `PD_RETURN : `PD_OTHER;
+       default: pd = `PD_OTHER;
+     endcase
+endmodule
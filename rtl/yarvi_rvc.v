@@ -0,0 +1,125 @@
+// -----------------------------------------------------------------------
+//
+// A purely combinatorial RV32C decompressor, expanding a 16-bit
+// instruction to the 32-bit one it stands for.  The reserved and
+// floating point encodings expand to 0, which traps as illegal.
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/* The width comparisons in Verilator are completely broken. */
+/* verilator lint_off WIDTH */
+
+`include "yarvi.h"
+
+`default_nettype none
+
+module yarvi_rvc
+  ( input  wire [   15:0] c
+  , output reg  [   31:0] insn);
+
+   wire [4:0] rd   = c[11:7];           // also rs1
+   wire [4:0] rs2  = c[6:2];
+   wire [4:0] rd_  = {2'd1, c[4:2]};    // rd' and rs2'
+   wire [4:0] rs1_ = {2'd1, c[9:7]};    // rs1' and rd'
+   wire       s    = c[12];
+
+   // The immediates, as placed in the 32-bit encodings
+   wire [11:0] ci_imm   = {{7{s}}, c[6:2]};
+   wire [11:0] lw_imm   = {5'd0, c[5], c[12:10], c[6], 2'd0};
+   wire [11:0] lwsp_imm = {4'd0, c[3:2], c[12], c[6:4], 2'd0};
+   wire [11:0] swsp_imm = {4'd0, c[8:7], c[12:9], 2'd0};
+   wire [11:0] spn_imm  = {2'd0, c[10:7], c[12:11], c[5], c[6], 2'd0};
+   wire [11:0] sp16_imm = {{3{s}}, c[4:3], c[5], c[2], c[6], 4'd0};
+   wire [19:0] j_imm    = {s, c[8], c[10:9], c[6], c[7], c[2], c[11], c[5:3], s, {8{s}}};
+   wire [11:0] b_imm    = {s, s, s, s, c[6:5], c[2], c[11:10], c[4:3], s}; // [31:25] and [11:7]
+
+   always @(*) begin
+      insn = 0;
+      case ({c[15:13], c[1:0]})
+        // Quadrant 0
+        {3'd0, 2'd0}: // C.ADDI4SPN
+          if (spn_imm != 0)
+            insn = {spn_imm, 5'd2, 3'd0, rd_, 5'd`OP_IMM, 2'd3};
+        {3'd2, 2'd0}: // C.LW
+          insn = {lw_imm, rs1_, 3'd2, rd_, 5'd`LOAD, 2'd3};
+        {3'd6, 2'd0}: // C.SW
+          insn = {lw_imm[11:5], rd_, rs1_, 3'd2, lw_imm[4:0], 5'd`STORE, 2'd3};
+
+        // Quadrant 1
+        {3'd0, 2'd1}: // C.ADDI, C.NOP
+          insn = {ci_imm, rd, 3'd0, rd, 5'd`OP_IMM, 2'd3};
+        {3'd1, 2'd1}: // C.JAL
+          insn = {j_imm, 5'd1, 5'd`JAL, 2'd3};
+        {3'd2, 2'd1}: // C.LI
+          insn = {ci_imm, 5'd0, 3'd0, rd, 5'd`OP_IMM, 2'd3};
+        {3'd3, 2'd1}:
+          if (rd == 2) begin // C.ADDI16SP
+             if (sp16_imm != 0)
+               insn = {sp16_imm, 5'd2, 3'd0, 5'd2, 5'd`OP_IMM, 2'd3};
+          end else if (ci_imm != 0) // C.LUI
+            insn = {{8{s}}, ci_imm, rd, 5'd`LUI, 2'd3};
+        {3'd4, 2'd1}:
+          case (c[11:10])
+            0: if (!s) insn = {7'd0,  rs2, rs1_, 3'd5, rs1_, 5'd`OP_IMM, 2'd3}; // C.SRLI
+            1: if (!s) insn = {7'd32, rs2, rs1_, 3'd5, rs1_, 5'd`OP_IMM, 2'd3}; // C.SRAI
+            2: insn = {ci_imm, rs1_, 3'd7, rs1_, 5'd`OP_IMM, 2'd3};             // C.ANDI
+            3: if (!s)
+              case (c[6:5])
+                0: insn = {7'd32, rd_, rs1_, 3'd0, rs1_, 5'd`OP, 2'd3}; // C.SUB
+                1: insn = {7'd0,  rd_, rs1_, 3'd4, rs1_, 5'd`OP, 2'd3}; // C.XOR
+                2: insn = {7'd0,  rd_, rs1_, 3'd6, rs1_, 5'd`OP, 2'd3}; // C.OR
+                3: insn = {7'd0,  rd_, rs1_, 3'd7, rs1_, 5'd`OP, 2'd3}; // C.AND
+              endcase
+          endcase
+        {3'd5, 2'd1}: // C.J
+          insn = {j_imm, 5'd0, 5'd`JAL, 2'd3};
+        {3'd6, 2'd1}: // C.BEQZ
+          insn = {b_imm[11:5], 5'd0, rs1_, 3'd0, b_imm[4:0], 5'd`BRANCH, 2'd3};
+        {3'd7, 2'd1}: // C.BNEZ
+          insn = {b_imm[11:5], 5'd0, rs1_, 3'd1, b_imm[4:0], 5'd`BRANCH, 2'd3};
+
+        // Quadrant 2
+        {3'd0, 2'd2}: // C.SLLI
+          if (!s)
+            insn = {7'd0, rs2, rd, 3'd1, rd, 5'd`OP_IMM, 2'd3};
+        {3'd2, 2'd2}: // C.LWSP
+          if (rd != 0)
+            insn = {lwsp_imm, 5'd2, 3'd2, rd, 5'd`LOAD, 2'd3};
+        {3'd4, 2'd2}:
+          if (!s) begin
+             if (rs2 == 0) begin
+                if (rd != 0)
+                  insn = {12'd0, rd, 3'd0, 5'd0, 5'd`JALR, 2'd3};   // C.JR
+             end else
+               insn = {7'd0, rs2, 5'd0, 3'd0, rd, 5'd`OP, 2'd3};    // C.MV
+          end else begin
+             if (rs2 == 0) begin
+                if (rd == 0)
+                  insn = 32'h 00100073;                             // C.EBREAK
+                else
+                  insn = {12'd0, rd, 3'd0, 5'd1, 5'd`JALR, 2'd3};   // C.JALR
+             end else
+               insn = {7'd0, rs2, rd, 3'd0, rd, 5'd`OP, 2'd3};      // C.ADD
+          end
+        {3'd6, 2'd2}: // C.SWSP
+          insn = {swsp_imm[11:5], rs2, 5'd2, 3'd2, swsp_imm[4:0], 5'd`STORE, 2'd3};
+
+        default: ; // C.FLD, C.FSD, ..., and reserved
+      endcase
+   end
+endmodule
@@ -55,8 +55,10 @@ module yarvi_soc
      , .retire_priv     ()
      , .retire_pc       ()
      , .retire_insn     ()
+     , .retire_rvc      ()
      , .retire_rd       ()
      , .retire_wb_val   ()
+     , .retire_addr     ()
      , .debug           (debug)
      );
 endmodule
@@ -32,23 +32,27 @@ module yarvi_st_align
   (input  wire [    2:0] funct3
 /* verilator lint_on UNUSED */
   ,input  wire [    1:0] address
+  ,input  wire           second
   ,input  wire [`XMSB:0] writedata
   ,output reg  [    3:0] st_mask
   ,output reg  [`XMSB:0] st_data);
 
+   reg [7:0] mask;
    always @(*) begin
+     // writedata rotated left by the address, so a store crossing a
+     // word has its upper bytes in place for the second beat
      case (address[1:0])
-       // An explicitly cheap aligner     v one-bit sel       v one-bit sel    v fixed
-       0: st_data = {writedata[31:24], writedata[23:16], writedata[15:8], writedata[7:0]};
-       1: st_data = {writedata[ 7: 0], writedata[23:16], writedata[ 7:0], writedata[7:0]}; // must be byte
-       2: st_data = {writedata[15: 8], writedata[ 7: 0], writedata[15:8], writedata[7:0]}; // at most half
-       3: st_data = {writedata[ 7: 0], writedata[ 7: 0], writedata[ 7:0], writedata[7:0]}; // must be byte
+       0: st_data =  writedata;
+       1: st_data = {writedata[23:0], writedata[31:24]};
+       2: st_data = {writedata[15:0], writedata[31:16]};
+       3: st_data = {writedata[ 7:0], writedata[31: 8]};
      endcase
      case (funct3[1:0])
-       0: st_mask = 4'h1 << address[1:0];
-       1: st_mask = address[1] ? 4'hC : 4'h3;
-       2: st_mask = 4'hF;
-       3: st_mask = 4'hX;
+       0: mask = 8'h01 << address[1:0];
+       1: mask = 8'h03 << address[1:0];
+       2: mask = 8'h0F << address[1:0];
+       3: mask = 8'hXX;
      endcase
+     st_mask = second ? mask[7:4] : mask[3:0];
    end
 endmodule
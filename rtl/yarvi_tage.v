@@ -0,0 +1,313 @@
+// -----------------------------------------------------------------------
+//
+// TAGE-style conditional branch predictor with a loop predictor
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+// A drop-in for the YAGS corrector: the base predictor is still the
+// bimodal counters in the BTB, used when no tagged table hits.  Four
+// tagged tables are indexed with 5, 12, 27, and 64 bits of global
+// history folded onto the index and tag, the longest hit provides the
+// prediction.  Entries have a 3-bit counter and a useful bit.
+//
+// Like YAGS, the tables are read at the clock edge (with lookup_pc,
+// whatever the front end has then) and the tags compared with pc in
+// the cycle after.  The indices and tags used, and what the lookup
+// found, are returned as meta, which the pipeline carries along in
+// place of the YAGS index and hands back with the outcome.
+//
+// On top, a small fully associative loop predictor, keyed by pc,
+// learns the trip count of branches that are taken a fixed number of
+// times and then not, and overrides once it has seen the same count
+// three times.  Its iteration counts are advanced speculatively as
+// predictions are used and reset to the retired counts on restart.
+//
+// Meta, LSB first: the four indices, the four tags, the four useful
+// bits, provider (0 none, 1-4 table), provider counter, alternate
+// hit, alternate direction, loop hit, loop direction.
+
+/* The width comparisons in Verilator are completely broken. */
+/* verilator lint_off WIDTH */
+/* Not all pc bits go into the hashes */
+/* verilator lint_off UNUSED */
+
+`include "yarvi.h"
+`default_nettype none
+
+module yarvi_tage
+  #(parameter LG2 = 9, TAG = 8, HIST = 64, LOOP_LG2 = 3,
+    parameter META = 14 + 4 * (LG2 + TAG))
+  ( input  wire              clock
+  , input  wire              restart
+
+  , input  wire              lookup
+  , input  wire [31:0]       lookup_pc
+  , input  wire [HIST-1:0]   history
+  , input  wire [31:0]       pc
+  , output wire              hit
+  , output wire [1:0]        dir
+  , output wire [META-1:0]   meta
+
+  // The prediction for pc was used (a branch leaving the front end)
+  , input  wire              advance
+  , input  wire              advance_taken
+
+  // The outcome of a branch, registered like the YAGS update.  base
+  // is what the BTB bimodal counter said.
+  , input  wire              update
+  , input  wire [META-1:0]   update_meta
+  , input  wire [31:0]       update_pc
+  , input  wire              update_taken
+  , input  wire              update_base);
+
+   // The tagged tables
+   wire [LG2-1:0]            idx0, idx1, idx2, idx3;
+   wire [TAG-1:0]            tag0, tag1, tag2, tag3;
+   wire                      hit0, hit1, hit2, hit3;
+   wire [2:0]                ctr0, ctr1, ctr2, ctr3;
+   wire                      u0, u1, u2, u3;
+   reg  [3:0]                we, we_u;
+   reg  [3:0]                wtag;  // allocate, else just the counter
+   reg  [3:0]                wu;
+   reg  [11:0]               wctr;  // three bits per table
+
+   yarvi_tage_table #(LG2, TAG, HIST, 5) t0
+     (clock, lookup, lookup_pc, history, pc, idx0, tag0, hit0, ctr0, u0,
+      we[0], wtag[0], wctr[0*3 +: 3], we_u[0], wu[0],
+      update_meta[0*LG2 +: LG2], update_meta[4*LG2+0*TAG +: TAG]);
+   yarvi_tage_table #(LG2, TAG, HIST, 12) t1
+     (clock, lookup, lookup_pc, history, pc, idx1, tag1, hit1, ctr1, u1,
+      we[1], wtag[1], wctr[1*3 +: 3], we_u[1], wu[1],
+      update_meta[1*LG2 +: LG2], update_meta[4*LG2+1*TAG +: TAG]);
+   yarvi_tage_table #(LG2, TAG, HIST, 27) t2
+     (clock, lookup, lookup_pc, history, pc, idx2, tag2, hit2, ctr2, u2,
+      we[2], wtag[2], wctr[2*3 +: 3], we_u[2], wu[2],
+      update_meta[2*LG2 +: LG2], update_meta[4*LG2+2*TAG +: TAG]);
+   yarvi_tage_table #(LG2, TAG, HIST, 64) t3
+     (clock, lookup, lookup_pc, history, pc, idx3, tag3, hit3, ctr3, u3,
+      we[3], wtag[3], wctr[3*3 +: 3], we_u[3], wu[3],
+      update_meta[3*LG2 +: LG2], update_meta[4*LG2+3*TAG +: TAG]);
+
+   // Provider and alternate
+   reg  [2:0]                prov;
+   reg  [2:0]                prov_ctr;
+   reg                       alt_hit, alt_taken;
+   always @(*) begin
+      prov = 0; prov_ctr = 0; alt_hit = 0; alt_taken = 0;
+      if (hit0) begin alt_hit = prov != 0; alt_taken = prov_ctr[2]; prov = 1; prov_ctr = ctr0; end
+      if (hit1) begin alt_hit = prov != 0; alt_taken = prov_ctr[2]; prov = 2; prov_ctr = ctr1; end
+      if (hit2) begin alt_hit = prov != 0; alt_taken = prov_ctr[2]; prov = 3; prov_ctr = ctr2; end
+      if (hit3) begin alt_hit = prov != 0; alt_taken = prov_ctr[2]; prov = 4; prov_ctr = ctr3; end
+   end
+
+   // The loop predictor
+   reg  [(1 << LOOP_LG2) - 1:0] l_valid = 0;
+   reg  [13:0]               l_tag[(1 << LOOP_LG2) - 1:0];
+   reg  [9:0]                l_trip[(1 << LOOP_LG2) - 1:0];
+   reg  [9:0]                l_iter[(1 << LOOP_LG2) - 1:0];  // retired
+   reg  [9:0]                l_spec[(1 << LOOP_LG2) - 1:0];  // speculative
+   reg  [1:0]                l_conf[(1 << LOOP_LG2) - 1:0];
+   reg  [LOOP_LG2-1:0]       l_next = 0;
+
+   reg                       l_match;
+   reg  [LOOP_LG2-1:0]       l_i;
+   integer                   i;
+   always @(*) begin
+      l_match = 0;
+      l_i     = 0;
+      for (i = 0; i < (1 << LOOP_LG2); i = i + 1)
+        if (l_valid[i] && l_tag[i] == pc[15:2]) begin
+           l_match = 1;
+           l_i     = i;
+        end
+   end
+
+   wire                      loop_hit = l_match && l_conf[l_i] == 3;
+   wire                      loop_taken = l_spec[l_i] != l_trip[l_i];
+
+   assign hit  = loop_hit | prov != 0;
+   assign dir  = loop_hit ? {2{loop_taken}} : prov_ctr[2:1];
+   assign meta = {loop_taken, loop_hit, alt_taken, alt_hit, prov_ctr, prov,
+                  u3, u2, u1, u0, tag3, tag2, tag1, tag0, idx3, idx2, idx1, idx0};
+
+   // The update
+   wire [3:0]                m_u         = update_meta[4*(LG2+TAG) +: 4];
+   wire [2:0]                m_prov      = update_meta[4*(LG2+TAG)+4 +: 3];
+   wire [2:0]                m_prov_ctr  = update_meta[4*(LG2+TAG)+7 +: 3];
+   wire                      m_alt_hit   = update_meta[4*(LG2+TAG)+10];
+   wire                      m_alt_taken = update_meta[4*(LG2+TAG)+11];
+   wire                      m_loop_hit  = update_meta[4*(LG2+TAG)+12];
+   wire                      m_loop_taken= update_meta[4*(LG2+TAG)+13];
+
+   wire                      alt   = m_alt_hit ? m_alt_taken : update_base;
+   wire                      pred  = m_prov != 0 ? m_prov_ctr[2] : update_base;
+   wire                      wrong = pred != update_taken;
+
+   // Allocate in the first longer table with a free entry, otherwise
+   // age all of them.  The provider's counter and the allocated one
+   // are written in the same cycle, so each table has its own.
+   integer                   j;
+   reg                       allocated;
+   always @(*) begin
+      we = 0; we_u = 0; wtag = 0; wu = 0; wctr = 0;
+      allocated = 0;
+      for (j = 0; j < 4; j = j + 1)
+        if (update)
+          if (m_prov == j + 1) begin
+             we[j]   = 1;
+             we_u[j] = pred != alt;
+             wu[j]   = pred == update_taken;
+             wctr[j*3 +: 3] = update_taken ? (m_prov_ctr == 7 ? 7 : m_prov_ctr + 1'd1)
+                                           : (m_prov_ctr == 0 ? 0 : m_prov_ctr - 1'd1);
+          end else if (wrong && m_prov < j + 1 && !allocated && !m_u[j]) begin
+             we[j]     = 1;
+             we_u[j]   = 1;
+             wtag[j]   = 1;
+             allocated = 1;
+             wctr[j*3 +: 3] = update_taken ? 4 : 3;
+          end
+      if (update && wrong && m_prov < 4 && !allocated)
+        for (j = 0; j < 4; j = j + 1)
+          if (m_prov < j + 1)
+            we_u[j] = 1; // wu = 0
+   end
+
+   // The loop predictor update; iteration counts are the number of
+   // times taken since last not taken
+   reg                       u_match;
+   reg  [LOOP_LG2-1:0]       u_i;
+   reg  [9:0]                u_iter;
+   integer                   k;
+   always @(*) begin
+      u_match = 0;
+      u_i     = 0;
+      for (k = 0; k < (1 << LOOP_LG2); k = k + 1)
+        if (l_valid[k] && l_tag[k] == update_pc[15:2]) begin
+           u_match = 1;
+           u_i     = k;
+        end
+      u_iter = update_taken ? l_iter[u_i] + 1'd1 : 0;
+   end
+
+   integer                   n;
+   always @(posedge clock) begin
+      if (advance && l_match)
+        l_spec[l_i] <= advance_taken ? l_spec[l_i] + 1'd1 : 0;
+
+      if (update)
+        if (u_match) begin
+           l_iter[u_i] <= u_iter;
+           if (!update_taken) begin
+              if (l_iter[u_i] == l_trip[u_i])
+                l_conf[u_i] <= l_conf[u_i] == 3 ? 3 : l_conf[u_i] + 1'd1;
+              else begin
+                 l_trip[u_i] <= l_iter[u_i];
+                 l_conf[u_i] <= 0;
+              end
+           end
+           if (update_taken && &l_iter[u_i])
+             l_valid[u_i] <= 0; // Too long for us
+        end else if (!update_taken && (m_loop_hit ? m_loop_taken : pred)) begin
+           l_valid[l_next] <= 1;
+           l_tag[l_next]   <= update_pc[15:2];
+           l_trip[l_next]  <= 0;
+           l_iter[l_next]  <= 0;
+           l_conf[l_next]  <= 0;
+           l_spec[l_next]  <= 0;
+           l_next          <= l_next + 1'd1;
+        end
+
+      if (restart)
+        for (n = 0; n < (1 << LOOP_LG2); n = n + 1)
+          l_spec[n] <= update && u_match && u_i == n ? u_iter : l_iter[n];
+   end
+endmodule
+
+// One tagged table: the history of length LEN folded onto the index
+// and the tag
+module yarvi_tage_table
+  #(parameter LG2 = 9, TAG = 8, HIST = 64, LEN = 5)
+  ( input  wire              clock
+  , input  wire              lookup
+  , input  wire [31:0]       lookup_pc
+  , input  wire [HIST-1:0]   history
+  , input  wire [31:0]       pc
+  , output reg  [LG2-1:0]    idx
+  , output wire [TAG-1:0]    tag
+  , output wire              hit
+  , output reg  [2:0]        ctr
+  , output reg               u
+
+  , input  wire              we
+  , input  wire              wtag
+  , input  wire [2:0]        wctr
+  , input  wire              we_u
+  , input  wire              wu
+  , input  wire [LG2-1:0]    widx
+  , input  wire [TAG-1:0]    wtag_val);
+
+   reg  [TAG-1:0]            tag_ram[(1 << LG2) - 1:0];
+   reg  [2:0]                ctr_ram[(1 << LG2) - 1:0];
+   reg                       u_ram[(1 << LG2) - 1:0];
+
+   reg  [LG2-1:0]            fold_idx;
+   reg  [TAG-1:0]            fold_tag;
+   integer                   i;
+
+   // As the model starts: tag 0, weakly not taken, and not useful
+   integer                   e;
+   initial
+     for (e = 0; e < (1 << LG2); e = e + 1) begin
+        tag_ram[e] = 0;
+        ctr_ram[e] = 3;
+        u_ram[e]   = 0;
+     end
+   always @(*) begin
+      fold_idx = 0;
+      fold_tag = 0;
+      for (i = 0; i < LEN; i = i + 1) begin
+         fold_idx[i % LG2] = fold_idx[i % LG2] ^ history[i];
+         fold_tag[i % TAG] = fold_tag[i % TAG] ^ history[i];
+      end
+   end
+
+   wire [LG2-1:0]            lookup_idx = lookup_pc[LG2+1:2] ^ lookup_pc[2*LG2+1:LG2+2] ^ fold_idx;
+
+   reg  [TAG-1:0]            r_fold;
+   reg  [TAG-1:0]            r_tag;
+   always @(posedge clock) begin
+      if (lookup) begin
+         idx    <= lookup_idx;
+         r_fold <= fold_tag;
+         r_tag  <= tag_ram[lookup_idx];
+         ctr    <= ctr_ram[lookup_idx];
+         u      <= u_ram[lookup_idx];
+      end
+
+      if (we) begin
+         ctr_ram[widx] <= wctr;
+         if (wtag)
+           tag_ram[widx] <= wtag_val;
+      end
+      if (we_u)
+        u_ram[widx] <= wu;
+   end
+
+   assign tag = pc[LG2+TAG+1:LG2+2] ^ r_fold;
+   assign hit = r_tag == tag;
+endmodule
@@ -0,0 +1,132 @@
+// -----------------------------------------------------------------------
+//
+// Sv32 TLB, small and fully associative
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+// The lookup is combinational: every entry compares its VPN (only
+// VPN[1] for a 4 MiB megapage) and ASID (unless global) with the
+// virtual address and the hit selects the physical address and the
+// PTE flags, D A G U X W R V, leaving the permission checks to the
+// pipeline.  Fills replace entries round robin.
+//
+// A walk that faulted is kept as a fault entry, which hits with no
+// permissions (so the access that missed takes its page fault), until
+// clear_fault, the next fault, or a flush.  Invalid PTEs are thus
+// never cached beyond that access.  A walk that couldn't read a PTE
+// (fill_access) makes it an access fault instead.
+//
+// Physical addresses are 32 bits, PPN[21:20] are left to the walker.
+
+/* The width comparisons in Verilator are completely broken. */
+/* verilator lint_off WIDTH */
+
+`include "yarvi.h"
+`default_nettype none
+
+module yarvi_tlb
+  #(parameter ENTRIES_LG2 = 2)
+  ( input  wire           clock
+  , input  wire [    8:0] asid
+  , input  wire [   31:0] va
+  , output reg            hit
+  , output reg  [   31:0] pa
+  , output reg  [    7:0] flags
+  , output reg            access_fault
+
+  , input  wire           fill
+  , input  wire           fill_fault
+  , input  wire           fill_access
+  , input  wire [   31:0] fill_va
+  , input  wire           fill_mega
+  , input  wire [    8:0] fill_asid
+  , input  wire [   19:0] fill_ppn
+  , input  wire [    7:0] fill_flags
+  , input  wire           clear_fault
+
+  // SFENCE.VMA: all entries, or those for flush_va and/or those
+  // non-global ones of flush_asid
+  , input  wire           flush
+  , input  wire           flush_all_va
+  , input  wire [   31:0] flush_va
+  , input  wire           flush_all_asid
+  , input  wire [    8:0] flush_asid);
+
+   reg  [(1 << ENTRIES_LG2) - 1:0] valid = 0;
+   reg  [   19:0]                  vpn[(1 << ENTRIES_LG2) - 1:0];
+   reg                             mega[(1 << ENTRIES_LG2) - 1:0];
+   reg  [    8:0]                  tasid[(1 << ENTRIES_LG2) - 1:0];
+   reg  [   19:0]                  ppn[(1 << ENTRIES_LG2) - 1:0];
+   reg  [    7:0]                  pte[(1 << ENTRIES_LG2) - 1:0];
+   reg  [ENTRIES_LG2-1:0]          next = 0;
+
+   reg                             fault_valid = 0;
+   reg  [   19:0]                  fault_vpn;
+   reg                             fault_access;
+
+   integer                         i;
+   always @(*) begin
+      hit   = fault_valid && fault_vpn == va[31:12];
+      pa    = 'hX;
+      flags = 0;
+      access_fault = 0;
+      for (i = 0; i < (1 << ENTRIES_LG2); i = i + 1)
+        if (valid[i] &&
+            vpn[i][19:10] == va[31:22] && (mega[i] || vpn[i][9:0] == va[21:12]) &&
+            (pte[i][5] || tasid[i] == asid)) begin
+           hit   = 1;
+           pa    = {mega[i] ? {ppn[i][19:10], va[21:12]} : ppn[i], va[11:0]};
+           flags = pte[i];
+        end
+      if (fault_valid && fault_vpn == va[31:12]) begin
+         flags = 0;
+         access_fault = fault_access;
+      end
+   end
+
+   integer                         j;
+   always @(posedge clock) begin
+      if (clear_fault)
+        fault_valid <= 0;
+
+      if (fill) begin
+         if (fill_fault) begin
+            fault_valid      <= 1;
+            fault_vpn        <= fill_va[31:12];
+            fault_access     <= fill_access;
+         end else begin
+            valid[next]      <= 1;
+            vpn[next]        <= fill_va[31:12];
+            mega[next]       <= fill_mega;
+            tasid[next]      <= fill_asid;
+            ppn[next]        <= fill_ppn;
+            pte[next]        <= fill_flags;
+            next             <= next + 1;
+         end
+      end
+
+      if (flush) begin
+         for (j = 0; j < (1 << ENTRIES_LG2); j = j + 1)
+           if ((flush_all_va ||
+                vpn[j][19:10] == flush_va[31:22] && (mega[j] || vpn[j][9:0] == flush_va[21:12])) &&
+               (flush_all_asid || !pte[j][5] && tasid[j] == flush_asid))
+             valid[j] <= 0;
+         fault_valid <= 0;
+      end
+   end
+endmodule
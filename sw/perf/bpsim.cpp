@@ -0,0 +1,348 @@
+// -----------------------------------------------------------------------
+//
+// Trace driven branch predictor simulator
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * Replays a retirement trace through the yarvi_bp model and reports
+ * mispredictions per kilo-instruction.
+ *
+ * The pipeline is approximated without simulating it: every retired
+ * instruction is one S0 cycle, the S5 outcome of an instruction is
+ * visible to predictions -d instructions later (8 in the RTL: S0..S5 is
+ * five stages, plus the registered write, plus the registered read), a
+ * restart walks the wrong path for the five instructions S0 fetched
+ * behind it, and a load-use stall in S3 repeats the S0 cycle three
+ * instructions later.  A predecode redirect in S2 costs the two
+ * instructions S0 fetched behind it.  Use -d 0 for an idealized
+ * immediate update.
+ *
+ * With -c (RVC=1) S0 fetches words rather than instructions: from the
+ * instruction's own pc where fetch goes on after a taken branch or
+ * restart, and then a cycle per word up to the one an instruction
+ * ends in.  The word's prediction goes to the first instruction
+ * ending at or after its BTB entry's halfword (the aligner), and a
+ * word predicted taken that no instruction claims is redirected by S2
+ * to the next word.  Two RVC instructions in a word hold S0 for a
+ * cycle, which like a load-use stall repeats the next S0 cycle.  The
+ * -d delay is then in S0 cycles.
+ */
+
+#include <deque>
+#include <unistd.h>
+#include "trace.h"
+#include "yarvi_bp.h"
+
+#define WRONG_PATH_DEPTH 5 // s5 .. s1 behind the restarting instruction in s6
+
+struct pending {
+    uint64_t  seq;
+    bp_update u;
+};
+
+struct ctl_stats {
+    uint64_t n, taken, mispredicted;
+};
+
+enum { C_BRANCH, C_JUMP, C_CALL, C_RETURN, C_INDIRECT, C_OTHER, C_N };
+static const char *class_name[C_N] = {
+    "branch", "jump", "call", "return", "indirect", "non-ctl"
+};
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [TRACE]\n"
+            "  -a ALGO  yags (default), tage, bimodal, gshare, or static\n"
+            "  -b N     BTB index bits (10)\n"
+            "  -t N     BTB tag bits (5)\n"
+            "  -T N     BTB target bits (15)\n"
+            "  -F FMT   BTB targets: low (default), delta, or full\n"
+            "  -w N     BTB ways log2 (0)\n"
+            "  -R       BTB replaces randomly instead of NRU\n"
+            "  -y N     YAGS index/history bits (12)\n"
+            "  -g N     YAGS tag bits (6)\n"
+            "  -e N     TAGE table index bits (9)\n"
+            "  -r N     RAS depth (16)\n"
+            "  -i N     ITC index bits, 0 for none (8)\n"
+            "  -N       no predecode static prediction on BTB misses\n"
+            "  -H       no history checkpoint for the predecode redirect\n"
+            "  -c       RVC, as RVC=1 (the trace may have 16-bit instructions)\n"
+            "  -d N     update delay in instructions (8)\n"
+            "  -p N     restart penalty in cycles (7)\n"
+            "TRACE defaults to stdin\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    bp_config cfg;
+    unsigned  delay = 8;
+    unsigned  penalty = 7;
+    int       opt;
+
+    while ((opt = getopt(argc, argv, "a:b:w:RF:t:T:y:g:e:r:i:NHcd:p:h")) != -1)
+        switch (opt) {
+        case 'a':
+            if      (strcmp(optarg, "yags") == 0)    cfg.algo = BP_YAGS;
+            else if (strcmp(optarg, "bimodal") == 0) cfg.algo = BP_BIMODAL;
+            else if (strcmp(optarg, "gshare") == 0)  cfg.algo = BP_GSHARE;
+            else if (strcmp(optarg, "static") == 0)  cfg.algo = BP_STATIC;
+            else if (strcmp(optarg, "tage") == 0)    cfg.algo = BP_TAGE;
+            else usage(argv[0]);
+            break;
+        case 'b': cfg.btb_index_bits  = atoi(optarg); break;
+        case 'w': cfg.btb_ways_lg2    = atoi(optarg); break;
+        case 'R': cfg.btb_random      = true; break;
+        case 'F':
+            if (strcmp(optarg, "low") == 0)        cfg.btb_target = BTB_LOW;
+            else if (strcmp(optarg, "delta") == 0) cfg.btb_target = BTB_DELTA;
+            else if (strcmp(optarg, "full") == 0)  cfg.btb_target = BTB_FULL;
+            else usage(argv[0]);
+            break;
+        case 't': cfg.btb_tag_bits    = atoi(optarg); break;
+        case 'T': cfg.btb_target_bits = atoi(optarg); break;
+        case 'y': cfg.yags_index_bits = atoi(optarg); break;
+        case 'g': cfg.yags_tag_bits   = atoi(optarg); break;
+        case 'e': cfg.tage_index_bits = atoi(optarg); break;
+        case 'r': cfg.ras_depth       = atoi(optarg); break;
+        case 'i': cfg.itc_index_bits  = atoi(optarg); break;
+        case 'N': cfg.predecode       = false; break;
+        case 'H': cfg.pd_checkpoint   = false; break;
+        case 'c': cfg.rvc             = true; break;
+        case 'd': delay               = atoi(optarg); break;
+        case 'p': penalty             = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+
+    if (argc > optind + 1)
+        usage(argv[0]);
+
+    FILE *f = trace_open(optind < argc ? argv[optind] : "-");
+
+    yarvi_bp            bp(cfg);
+    std::deque<pending> writes;
+    ctl_stats           stats[C_N] = {};
+    uint64_t            seq = 0, insns = 0, restarts = 0, redirects = 0;
+    uint64_t            yags_used = 0, yags_wrong = 0;
+    uint64_t            first_cycle = 0, last_cycle = 0;
+
+    // The last five retired instructions, most recent first, and how
+    // many were fetched since the last restart (for load-use stalls)
+    retired  hist[5];
+    unsigned run = 0;
+
+    // With RVC, the word S0 fetched last, its prediction, whether an
+    // instruction took that, and whether the next instruction starts
+    // a new fetch (after a taken branch or a restart)
+    uint32_t      word = 0;
+    bp_prediction w = {};
+    bool          claimed = false, new_fetch = true, hold = false;
+
+    retired cur, next;
+    bool    have_cur  = trace_read(f, cur);
+    bool    have_next = have_cur && trace_read(f, next);
+
+    if (have_cur) {
+        first_cycle = cur.cycle;
+        bp.restart(0, cur.pc); // Reset is a restart
+    }
+
+    // An S0 cycle for the word at pc, after S2 redirected for the last
+    // one if no instruction took its taken prediction
+    auto fetch = [&](uint32_t pc) {
+        if (!new_fetch && w.type != BTB_TYPE_BR_W_N && !claimed) {
+            bp.realign(bp.s0(w.npc).npc, w);
+            ++redirects;
+        }
+        while (!writes.empty() && writes.front().seq + delay <= seq) {
+            bp.write(writes.front().u);
+            writes.pop_front();
+        }
+        if (hold)
+            bp.s0(pc, true);
+        hold      = false;
+        w         = bp.s0(pc);
+        word      = pc & ~3;
+        claimed   = false;
+        new_fetch = false;
+        ++seq;
+    };
+
+    while (have_cur) {
+        if (cur.len == 2 && !cfg.rvc)
+            errx(1, "the trace has RVC instructions, use -c");
+
+        /*
+         * A load-use stall holds an instruction in S3 while S0 holds
+         * the one three behind it.  The S0 registers are then reread
+         * for the same pc, which changes the YAGS entry it uses.
+         */
+        if (3 <= run) {
+            uint32_t s3 = hist[2].insn;
+            bool     use_rs1, use_rs2, unused;
+            unsigned rd;
+            bool     stall = false;
+
+            insn_reg_usage(s3, use_rs1, use_rs2, rd);
+            for (unsigned d = 3; d <= 4 && d < run; ++d)
+                if (insn_opcode(hist[d].insn) == LOAD) {
+                    insn_reg_usage(hist[d].insn, unused, unused, rd);
+                    stall |= (use_rs1 && insn_rs1(s3) == rd) ||
+                             (use_rs2 && insn_rs2(s3) == rd);
+                }
+
+            if (stall && cfg.rvc)
+                hold = true;
+            else if (stall)
+                bp.s0(cur.pc, true);
+        }
+
+        bp_prediction p;
+        if (cfg.rvc) {
+            uint32_t end = cur.pc + cur.len - 2;
+
+            if (new_fetch || (cur.pc & ~3) != word)
+                fetch(new_fetch ? cur.pc : cur.pc & ~3);
+            if ((end & ~3) != word)
+                fetch(end & ~3);
+
+            bool mine = w.btb_hit && !claimed && (end >> 1 & 1) >= w.btb_half;
+            claimed |= mine;
+            p = bp.align(w, cur.pc, cur.len, mine);
+
+            // S2 holds while this goes to S3 if another RVC instruction
+            // follows in the word
+            if (!(end & 2) && !(mine && w.type != BTB_TYPE_BR_W_N) &&
+                have_next && next.pc == cur.pc + 2 && next.len == 2)
+                hold = true;
+        } else {
+            while (!writes.empty() && writes.front().seq + delay <= seq) {
+                bp.write(writes.front().u);
+                writes.pop_front();
+            }
+
+            p = bp.s0(cur.pc);
+            ++seq;
+
+            // S0 has fetched two more behind it by the time it's in S2
+            if (bp.predecode_taken(p, cur.insn)) {
+                uint32_t pc = bp.s0(p.npc).npc;
+                bp.s2(pc, p, cur.insn);
+                ++redirects;
+            }
+        }
+
+        // What the instruction should do, as opposed to what the trace
+        // says happened next, which includes traps and interrupts
+        unsigned opcode   = insn_opcode(cur.insn);
+        uint32_t fallthru = cur.pc + cur.len;
+        uint32_t expected = fallthru;
+        uint32_t actual   = have_next ? next.pc : fallthru;
+        int      c        = C_OTHER;
+
+        switch (opcode) {
+        case BRANCH:
+            if (actual == cur.pc + insn_sb_imm(cur.insn))
+                expected = actual;
+            c = C_BRANCH;
+
+            // The branches whose direction came from YAGS (or TAGE)
+            if (p.btb_hit && p.btb_type < 4 && p.yags_hit) {
+                yags_used++;
+                yags_wrong += (p.yags_dir >> 1) != (expected != fallthru);
+            }
+            break;
+        case JAL:
+            expected = cur.pc + insn_uj_imm(cur.insn);
+            c = is_link(insn_rd(cur.insn)) ? C_CALL : C_JUMP;
+            break;
+        case JALR:
+            expected = actual;
+            c = is_link(insn_rd(cur.insn)) ? C_CALL :
+                is_link(insn_rs1(cur.insn)) ? C_RETURN : C_INDIRECT;
+            break;
+        }
+
+        bp_update u;
+        bool restart = bp.s5(p, cur.insn, expected, u);
+        writes.push_back({seq, u});
+
+        if (restart || actual != expected) {
+            uint32_t pc = p.npc;
+            for (int i = 0; i < WRONG_PATH_DEPTH; ++i)
+                pc = bp.s0(pc).npc;
+            bp.restart(pc, actual);
+            for (; !writes.empty(); writes.pop_front())
+                bp.write(writes.front().u);
+            run       = 0;
+            new_fetch = true;
+        } else {
+            ++run;
+            new_fetch |= actual != fallthru;
+        }
+
+        restarts += restart || actual != expected;
+        ++insns;
+        last_cycle = cur.cycle;
+        stats[c].n++;
+        stats[c].taken += expected != fallthru;
+        stats[c].mispredicted += p.npc != expected;
+
+        for (int i = 4; 0 < i; --i)
+            hist[i] = hist[i - 1];
+        hist[0] = cur;
+        cur = next;
+        have_cur = have_next;
+        if (have_cur)
+            have_next = trace_read(f, next);
+    }
+
+    uint64_t mispredicts = 0;
+    for (int c = 0; c < C_N; ++c)
+        mispredicts += stats[c].mispredicted;
+
+    printf("Predictor:           %s, BTB %d/%d/%d %d-way %s%s, YAGS %d/%d, TAGE %d, RAS %d, ITC %d, %lu Kib\n",
+           cfg.algo == BP_YAGS ? "yags" : cfg.algo == BP_BIMODAL ? "bimodal" :
+           cfg.algo == BP_GSHARE ? "gshare" : cfg.algo == BP_TAGE ? "tage" : "static",
+           1 << cfg.btb_index_bits, cfg.btb_tag_bits, cfg.btb_target_bits, 1 << cfg.btb_ways_lg2,
+           cfg.btb_target == BTB_LOW ? "low" : cfg.btb_target == BTB_DELTA ? "delta" : "full",
+           cfg.btb_random ? " random" : "",
+           1 << cfg.yags_index_bits, cfg.yags_tag_bits, 1 << cfg.tage_index_bits,
+           cfg.ras_depth, cfg.itc_index_bits ? 1 << cfg.itc_index_bits : 0, bp.bits() / 1024);
+    printf("Instructions:        %" PRIu64 "\n", insns);
+    printf("Trace cycles:        %" PRIu64 "\n", last_cycle - first_cycle);
+    printf("%-10s %12s %12s %12s %8s\n", "class", "count", "taken", "mispredicts", "rate");
+    for (int c = 0; c < C_N; ++c)
+        printf("%-10s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %7.2f%%\n",
+               class_name[c], stats[c].n, stats[c].taken, stats[c].mispredicted,
+               stats[c].n ? 100.0 * stats[c].mispredicted / stats[c].n : 0.0);
+    printf("Mispredicts:         %" PRIu64 "\n", mispredicts);
+    printf("MPKI:                %.3f\n", insns ? 1000.0 * mispredicts / insns : 0.0);
+    printf("YAGS directions:     %" PRIu64 " (%.2f%% wrong)\n", yags_used,
+           yags_used ? 100.0 * yags_wrong / yags_used : 0.0);
+    printf("Other restarts:      %" PRIu64 "\n", restarts - mispredicts);
+    printf("Predecode redirects: %" PRIu64 " (%" PRIu64 " cycles)\n", redirects, 2 * redirects);
+    printf("Mispredict cycles:   %" PRIu64 " (%.3f CPI)\n", mispredicts * penalty,
+           insns ? (double) mispredicts * penalty / insns : 0.0);
+
+    return 0;
+}
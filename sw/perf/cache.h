@@ -0,0 +1,160 @@
+// -----------------------------------------------------------------------
+//
+// A set associative cache model for the YARVI performance tools
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * Only tags are modeled.  Geometry is given as "SIZE[:WAYS[:LINE]]" in
+ * bytes, with k/K and m/M suffixes, eg. "32k:1:16" which is the
+ * default D$ of rtl/yarvi.h (DC_WORDS_LG2 = 13, DC_LINE_WORDS_LG2 = 2).
+ */
+
+#ifndef YARVI_CACHE_H
+#define YARVI_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+#include "trace.h"
+
+enum cache_repl { REPL_LRU, REPL_FIFO, REPL_RANDOM };
+
+struct cache_config {
+    unsigned   size  = 32 * 1024;
+    unsigned   ways  = 1;
+    unsigned   line  = 16;
+    cache_repl repl  = REPL_LRU;
+    bool       write_allocate = true; // and write-back, otherwise write-through
+};
+
+static inline unsigned
+parse_size(const char *s, char **end)
+{
+    unsigned long v = strtoul(s, end, 0);
+
+    if (**end == 'k' || **end == 'K')
+        v <<= 10, ++*end;
+    else if (**end == 'm' || **end == 'M')
+        v <<= 20, ++*end;
+    return v;
+}
+
+static inline void
+cache_parse(const char *s, cache_config &c)
+{
+    char *p;
+
+    c.size = parse_size(s, &p);
+    if (*p == ':')
+        c.ways = strtoul(p + 1, &p, 0);
+    if (*p == ':')
+        c.line = parse_size(p + 1, &p);
+
+    if (*p || !c.ways || !c.line || c.size % (c.ways * c.line) ||
+        (c.line & (c.line - 1)) || ((c.size / c.ways / c.line) & (c.size / c.ways / c.line - 1)))
+        errx(1, "bad cache geometry \"%s\" (SIZE[:WAYS[:LINE]], powers of two)", s);
+}
+
+class cache {
+public:
+    explicit cache(const cache_config &c)
+        : cfg(c),
+          sets(c.size / c.ways / c.line),
+          tags(c.size / c.line),
+          stamp(c.size / c.line, 0),
+          valid(c.size / c.line, false),
+          dirty(c.size / c.line, false)
+    {
+        for (line_lg2 = 0; (1u << line_lg2) < c.line; ++line_lg2)
+            ;
+    }
+
+    // Returns true on a hit.  On a miss the line is filled (unless
+    // it's a write to a no-write-allocate cache) possibly evicting a
+    // dirty line which is then counted as a writeback.
+    bool access(uint32_t addr, bool write)
+    {
+        uint32_t block = addr >> line_lg2;
+        unsigned set   = block & (sets - 1);
+        unsigned base  = set * cfg.ways;
+
+        ++accesses[write];
+        ++now;
+
+        for (unsigned w = 0; w < cfg.ways; ++w)
+            if (valid[base + w] && tags[base + w] == block) {
+                if (cfg.repl == REPL_LRU)
+                    stamp[base + w] = now;
+                if (write)
+                    dirty[base + w] = cfg.write_allocate;
+                return true;
+            }
+
+        ++misses[write];
+        if (write && !cfg.write_allocate)
+            return false;
+
+        unsigned victim = base;
+        for (unsigned w = 0; w < cfg.ways; ++w) {
+            if (!valid[base + w]) {
+                victim = base + w;
+                break;
+            }
+            if (stamp[base + w] < stamp[victim])
+                victim = base + w;
+        }
+        if (cfg.repl == REPL_RANDOM && valid[victim])
+            victim = base + (rng = rng * 1103515245 + 12345) % cfg.ways;
+
+        writebacks += valid[victim] && dirty[victim];
+        valid[victim] = true;
+        dirty[victim] = write;
+        tags[victim]  = block;
+        stamp[victim] = now;
+
+        return false;
+    }
+
+    // Storage in bits: data plus tag, valid, and (if write-back) dirty
+    unsigned long bits() const
+    {
+        unsigned tag_bits = 32 - line_lg2;
+
+        for (unsigned s = sets; 1 < s; s >>= 1)
+            --tag_bits;
+        return (unsigned long) (cfg.size / cfg.line) *
+            (cfg.line * 8 + tag_bits + 1 + cfg.write_allocate);
+    }
+
+    const cache_config cfg;
+
+    uint64_t accesses[2] = {}; // reads, writes
+    uint64_t misses[2]   = {};
+    uint64_t writebacks  = 0;
+
+private:
+    const unsigned        sets;
+    unsigned              line_lg2;
+    std::vector<uint32_t> tags;
+    std::vector<uint64_t> stamp; // last use (LRU) or fill (FIFO)
+    std::vector<bool>     valid, dirty;
+    uint64_t              now = 0;
+    uint32_t              rng = 1;
+};
+
+#endif
@@ -0,0 +1,141 @@
+// -----------------------------------------------------------------------
+//
+// Trace driven instruction and data cache simulator
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * Replays the fetches and the loads/stores of a retirement trace
+ * through an I$ and a D$ and estimates the CPI if every miss blocked
+ * the pipeline for the miss latency, on top of the base CPI measured
+ * from the trace (ie. with the current on-chip memories).
+ *
+ * Only the committed path is seen; wrong-path fetches would add I$
+ * traffic.  Accesses outside memory (eg. MMIO at 0x4000_0000) bypass
+ * the caches.
+ */
+
+#include <unistd.h>
+#include "trace.h"
+#include "cache.h"
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [TRACE]\n"
+            "  -i GEOM   I$ SIZE[:WAYS[:LINE]] (32k:1:16)\n"
+            "  -d GEOM   D$ SIZE[:WAYS[:LINE]] (32k:1:16)\n"
+            "  -r REPL   lru (default), fifo, or random\n"
+            "  -t        write-through, no-write-allocate D$ (default is write-back)\n"
+            "  -l N      miss latency in cycles (20)\n"
+            "  -w N      additional cycles per dirty writeback (0, ie. buffered)\n"
+            "TRACE defaults to stdin\n", prog);
+    exit(1);
+}
+
+static void
+report(const char *name, const cache &c)
+{
+    uint64_t a = c.accesses[0] + c.accesses[1];
+    uint64_t m = c.misses[0] + c.misses[1];
+
+    printf("%s %uk %u-way %uB lines, %.1f Kib (data+tags)\n", name,
+           c.cfg.size / 1024, c.cfg.ways, c.cfg.line, c.bits() / 1024.0);
+    printf("  reads  %12" PRIu64 "  misses %10" PRIu64 "  %6.2f%%\n",
+           c.accesses[0], c.misses[0], c.accesses[0] ? 100.0 * c.misses[0] / c.accesses[0] : 0.0);
+    if (c.accesses[1])
+        printf("  writes %12" PRIu64 "  misses %10" PRIu64 "  %6.2f%%  writebacks %" PRIu64 "\n",
+               c.accesses[1], c.misses[1], 100.0 * c.misses[1] / c.accesses[1], c.writebacks);
+    printf("  total  %12" PRIu64 "  misses %10" PRIu64 "  %6.2f%%\n",
+           a, m, a ? 100.0 * m / a : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+    cache_config icfg, dcfg;
+    unsigned     latency = 20, wb_cost = 0;
+    cache_repl   repl = REPL_LRU;
+    int          opt;
+
+    while ((opt = getopt(argc, argv, "i:d:r:tl:w:h")) != -1)
+        switch (opt) {
+        case 'i': cache_parse(optarg, icfg); break;
+        case 'd': cache_parse(optarg, dcfg); break;
+        case 'r':
+            if      (strcmp(optarg, "lru") == 0)    repl = REPL_LRU;
+            else if (strcmp(optarg, "fifo") == 0)   repl = REPL_FIFO;
+            else if (strcmp(optarg, "random") == 0) repl = REPL_RANDOM;
+            else usage(argv[0]);
+            break;
+        case 't': dcfg.write_allocate = false; break;
+        case 'l': latency = atoi(optarg); break;
+        case 'w': wb_cost = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+
+    if (argc > optind + 1)
+        usage(argv[0]);
+
+    icfg.repl = dcfg.repl = repl;
+    icfg.write_allocate = false; // never written
+
+    FILE    *f = trace_open(optind < argc ? argv[optind] : "-");
+    cache    ic(icfg), dc(dcfg);
+    retired  r;
+    uint64_t insns = 0, first_cycle = 0, last_cycle = 0;
+
+    while (trace_read(f, r)) {
+        if (insns++ == 0)
+            first_cycle = r.cycle;
+        last_cycle = r.cycle;
+
+        ic.access(r.pc, false);
+        // With RVC, a 32-bit instruction can straddle two lines
+        if ((r.pc ^ (r.pc + r.len - 1)) & ~(icfg.line - 1))
+            ic.access(r.pc + 2, false);
+
+        unsigned opcode = insn_opcode(r.insn);
+        if ((opcode == LOAD || opcode == STORE) && (r.addr & 0xC0000000) == 0x80000000)
+            dc.access(r.addr, opcode == STORE);
+    }
+
+    if (!insns)
+        errx(1, "empty trace");
+
+    uint64_t cycles = last_cycle - first_cycle + 1;
+    uint64_t imiss  = ic.misses[0];
+    uint64_t dmiss  = dc.misses[0] + (dcfg.write_allocate ? dc.misses[1] : 0);
+    uint64_t stall  = (imiss + dmiss) * latency + dc.writebacks * wb_cost;
+    double   base   = (double) cycles / insns;
+
+    printf("Instructions:   %" PRIu64 "\n", insns);
+    report("I$", ic);
+    report("D$", dc);
+    printf("I$ MPKI:        %.3f\n", 1000.0 * imiss / insns);
+    printf("D$ MPKI:        %.3f\n", 1000.0 * dmiss / insns);
+    printf("Base CPI:       %.3f (%" PRIu64 " cycles)\n", base, cycles);
+    printf("Miss CPI:       %.3f (I$ %.3f, D$ %.3f) at %u cycles/miss\n",
+           (double) stall / insns, (double) imiss * latency / insns,
+           (double) (stall - imiss * latency) / insns, latency);
+    printf("Estimated CPI:  %.3f (IPC %.3f)\n",
+           base + (double) stall / insns, 1 / (base + (double) stall / insns));
+
+    return 0;
+}
@@ -0,0 +1,876 @@
+// -----------------------------------------------------------------------
+//
+// Trace driven cycle model of the YARVI2 pipeline
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * Clocks the stages of rtl/yarvi.v, s0 .. s8, one cycle at a time with
+ * the instructions of a retirement trace:
+ *
+ * - S0 is the yarvi_bp model, called every cycle exactly like the RTL
+ *   (including stalls, wrong-path fetches, and the update latency).
+ *   Wrong-path instructions are taken from the trace where their pc
+ *   was seen, otherwise they are NOPs.
+ *
+ * - S2 redirects S0 on a predecode static prediction (a BTB miss on a
+ *   backward branch, a JAL, or a return), dropping S1 and S0.
+ *
+ * - S3 stalls when it uses the result of a load (or an AMO or RV32M
+ *   instruction) in S4 or S5, or is a memory access behind an AMO in
+ *   S4-S6, holding s0-s3 and inserting a bubble in S4.  All other
+ *   results forward.
+ *
+ * - S3 fuses with S4 (unless -n, as NO_FUSION=1) when it completes
+ *   the instruction there: LUI+ADDI, AUIPC+ADDI/JALR/load, and
+ *   SLLI+SRLI by the same amount.  The first leaves S4 as a bubble
+ *   that still commits, so a pair takes the cycles it did unfused;
+ *   the model counts them and keeps the pairing through the restarts.
+ *
+ * - S5 decides restarts (mispredicts, SYSTEM, and FENCE.I) which take
+ *   effect with the instruction in S6, flushing s1-s5 and refetching
+ *   from the restart pc in the following cycle.  Stores forward to
+ *   loads.
+ *
+ * - A trace discontinuity is a trap (or interrupt) taken by the
+ *   instruction after, which isn't in the trace.  It goes down the
+ *   fall-through path to S6 without committing, and as the RTL decides
+ *   traps there, the restart follows a cycle later.
+ *
+ * - A divide commits in S6 and runs in the divider for as many cycles
+ *   as yarvi_div takes with its operands (rebuilt from the trace's
+ *   results), then writes its register when S7 doesn't.  A consumer
+ *   reaching S4 before that replays from S5, and a divide finding the
+ *   divider busy replays from S6, restarting a cycle later.
+ *
+ * - A store (or SC) in S6 alongside a load (or AMO) in S5 writes the
+ *   memory through fetch's port, so S0 waits a cycle and S1 is empty
+ *   (ram_a_busy).
+ *
+ * - With -c (RVC=1) S0-S2 carry words and S2 is the aligner, handing
+ *   S3 an instruction a cycle.  A 32-bit instruction in the high half
+ *   waits there for the next word, and after one in the low half, an
+ *   RVC instruction in the high half holds S0-S2 for a cycle.  A
+ *   32-bit instruction starting in the high half of the word jumped
+ *   to leaves S3 empty, and a word predicted taken that no instruction
+ *   takes the prediction of redirects to the next word.  Wrong-path
+ *   words are made of the instructions the trace shows there.
+ *
+ * Every cycle without a commit from S6 is charged to the reason the
+ * slot is empty, so the breakdown adds up to the total.  As the trace
+ * carries the RTL's own retirement cycles, every run also reports the
+ * model's error against the RTL (which models the default
+ * configuration, or RVC with -c: not the caches, MMU, or FTQ).
+ *
+ * What-if knobs: -m shortens the restart penalty (by letting the
+ * refetched instructions skip front-end stages), -l shortens the
+ * load-use window, and -L brings back the load-hit-store restart
+ * (loads hitting a store in S6/S7) that preceded store forwarding.
+ */
+
+#include <deque>
+#include <unordered_map>
+#include <unistd.h>
+#include "trace.h"
+#include "yarvi_bp.h"
+
+#define STAGES 9
+
+enum cause {
+    CA_STARTUP,
+    CA_LOAD_USE,
+    CA_BRANCH,
+    CA_JUMP,
+    CA_CALL,
+    CA_RETURN,
+    CA_INDIRECT,
+    CA_NON_CTL,   // non control-flow instruction predicted taken
+    CA_PREDECODE, // S2 redirect on a BTB miss
+    CA_LHS,       // load-hit-store
+    CA_SYSTEM,    // SYSTEM and FENCE.I
+    CA_TRAP,      // traps and interrupts
+    CA_PORT,      // fetch waiting for its memory port
+    CA_DIVIDE,    // replays waiting for the divider
+    CA_ALIGN,     // 32-bit instruction in the high half of a new word
+    CA_N
+};
+
+static const char *cause_name[CA_N] = {
+    "startup", "load-use", "branch", "jump", "call", "return",
+    "indirect", "non-ctl", "predecode", "load-hit-store", "system", "trap",
+    "fetch-port", "divide", "align",
+};
+
+struct slot {
+    bool          valid;      // holds an instruction
+    int64_t       idx;        // its trace index, -1 if on the wrong path
+    uint32_t      pc, insn;
+    unsigned      len;        // 2 or 4 bytes
+    uint32_t      addr;       // of loads and stores
+    bp_prediction p;
+    bool          fused;      // the second of a fused pair
+    bool          first;      // the first, which writes no register
+    bool          restart;    // set in S5
+    bool          flush;      // don't commit (load-hit-store, trap)
+    bool          replay;     // restart from itself in S5 (divide result)
+    bool          trap;       // traps in S6
+    uint32_t      restart_pc;
+    int64_t       restart_idx;
+    int           cause;      // why empty, or why restarting
+};
+
+// A window on the trace, indexed from the start
+class trace_window {
+public:
+    explicit trace_window(FILE *f) : f(f) {}
+
+    // Returns nullptr past the end of the trace
+    const retired *at(int64_t i)
+    {
+        while (base + (int64_t) win.size() <= i) {
+            retired r;
+            if (!trace_read(f, r))
+                return nullptr;
+            win.push_back(r);
+            seen[r.pc] = {r.insn, r.len};
+        }
+        return &win[i - base];
+    }
+
+    void retire_upto(int64_t i)
+    {
+        for (; base <= i; ++base)
+            win.pop_front();
+    }
+
+    // The instruction at pc, if it has ever been seen as one of len
+    // bytes, otherwise a NOP
+    uint32_t insn_at(uint32_t pc, unsigned len = 4) const
+    {
+        auto it = seen.find(pc);
+        return it == seen.end() || it->second.len != len ? 0x00000013 : it->second.insn;
+    }
+
+    // Whether the halfword at pc looks like an RVC instruction, going
+    // by what the trace has shown is there (a NOP if nothing)
+    bool rvc_at(uint32_t pc) const
+    {
+        auto it = seen.find(pc);
+        if (it != seen.end())
+            return it->second.len == 2;
+        it = seen.find(pc - 2);
+        return it != seen.end() && it->second.len == 4 && (it->second.insn >> 16 & 3) != 3;
+    }
+
+private:
+    struct insn {
+        uint32_t insn;
+        unsigned len;
+    };
+
+    FILE                                   *f;
+    std::deque<retired>                     win;
+    int64_t                                 base = 0;
+    std::unordered_map<uint32_t, insn>      seen;
+};
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [TRACE]\n"
+            "  -m N     restart penalty in cycles, 4..7 (7)\n"
+            "  -L       restart loads that hit a store in S6/S7 (no forwarding)\n"
+            "  -l N     load-use stall window, 0..2 (2)\n"
+            "  -n       no fusion (as NO_FUSION=1)\n"
+            "  -s NAME  print a one line summary for NAME instead\n"
+            "  -a ALGO  yags (default), tage, bimodal, gshare, or static\n"
+            "  -b N     BTB index bits (10)\n"
+            "  -t N     BTB tag bits (5)\n"
+            "  -T N     BTB target bits (15)\n"
+            "  -F FMT   BTB targets: low (default), delta, or full\n"
+            "  -w N     BTB ways log2 (0)\n"
+            "  -R       BTB replaces randomly instead of NRU\n"
+            "  -y N     YAGS index/history bits (12)\n"
+            "  -g N     YAGS tag bits (6)\n"
+            "  -e N     TAGE table index bits (9)\n"
+            "  -r N     RAS depth (16)\n"
+            "  -i N     ITC index bits, 0 for none (8)\n"
+            "  -N       no predecode static prediction on BTB misses\n"
+            "  -H       no history checkpoint for the predecode redirect\n"
+            "  -c       RVC, as RVC=1 (the trace may have 16-bit instructions)\n"
+            "TRACE defaults to stdin\n", prog);
+    exit(1);
+}
+
+// Fill in an S0 slot fetching pc, on the committed path if idx >= 0.
+// With RVC, S0 fetches a word from pc and this is also the instruction
+// of len bytes the aligner hands S3.
+static void
+fetch(slot &s, trace_window &tw, int64_t idx, uint32_t pc, int cause, unsigned len = 4)
+{
+    const retired *r = idx >= 0 ? tw.at(idx) : nullptr;
+
+    s = slot{};
+    s.cause = cause;
+    s.valid = true;
+    s.pc    = pc;
+    s.len   = len;
+    if (r && r->pc == pc) {
+        s.idx  = idx;
+        s.insn = r->insn;
+        s.addr = r->addr;
+    } else {
+        s.idx  = -1;
+        s.insn = tw.insn_at(pc, len);
+    }
+}
+
+// The aligner (al_* in rtl/yarvi.v), which with RVC splits the words
+// in S2 into instructions
+struct aligner {
+    bool     valid;  // pc starts a 32-bit instruction ending in the S2 word
+    uint32_t pc;
+    bool     skip;   // the low half of the S2 word went to S3
+    int64_t  next;   // the trace index due in S3 next, -1 on the wrong path
+
+    // What S2 does this cycle
+    bool     emit;   // an instruction goes to S3
+    bool     hold;   // and S0-S2 wait as another follows in the word
+    bool     buf;    // the high half starts a 32-bit instruction
+    bool     taken;  // the word was predicted taken
+};
+
+// The aligner's decisions for the word in s2, with the instruction it
+// hands S3 in out
+static void
+align(aligner &al, const slot &s2, trace_window &tw, const yarvi_bp &bp, slot &out)
+{
+    uint32_t word = s2.pc & ~3;
+    unsigned i    = (s2.pc >> 1 & 1) | al.skip;
+    uint32_t pc   = word + i * 2;
+    unsigned len  = 4, k = 1;
+
+    // Read the trace as far as what the word holds on the committed path
+    if (al.next >= 0)
+        tw.at(al.next + 1);
+
+    al.emit = true;
+    if (al.valid)
+        pc = al.pc, k = 0;
+    else if (tw.rvc_at(pc))
+        len = 2, k = i;
+    else if (i)
+        al.emit = false;
+
+    bool mine = s2.p.btb_hit && (al.skip ? s2.p.btb_half : k >= s2.p.btb_half);
+    bool rest = !(mine && s2.p.type != BTB_TYPE_BR_W_N) && !k;
+
+    al.taken = s2.p.type != BTB_TYPE_BR_W_N;
+    al.hold  = s2.valid && rest && tw.rvc_at(word + 2);
+    al.buf   = s2.valid && ((rest && !tw.rvc_at(word + 2)) || !al.emit);
+
+    if (!s2.valid || !al.emit) {
+        out       = slot{};
+        out.cause = s2.valid ? CA_ALIGN : s2.cause;
+        return;
+    }
+
+    const retired *r = al.next >= 0 ? tw.at(al.next) : nullptr;
+    fetch(out, tw, r && r->pc == pc ? al.next : -1, pc, s2.cause, len);
+    out.p = bp.align(s2.p, pc, len, mine);
+}
+
+// S2 moves on (when S3 does), out going to S3
+static void
+align_clock(aligner &al, const slot &s2, const slot &out)
+{
+    if (!s2.valid)
+        return;
+    if (out.valid)
+        al.next = out.idx >= 0 ? out.idx + 1 : -1;
+    al.valid = al.buf;
+    al.pc    = (s2.pc & ~3) + 2;
+    al.skip  = al.hold;
+}
+
+static int
+ctl_cause(uint32_t insn)
+{
+    switch (insn_opcode(insn)) {
+    case BRANCH: return CA_BRANCH;
+    case JAL:    return is_link(insn_rd(insn)) ? CA_CALL : CA_JUMP;
+    case JALR:   return is_link(insn_rd(insn)) ? CA_CALL :
+                        is_link(insn_rs1(insn)) ? CA_RETURN : CA_INDIRECT;
+    case SYSTEM: return CA_SYSTEM;
+    case MISC_MEM: return CA_SYSTEM;
+    default:     return CA_NON_CTL;
+    }
+}
+
+static bool
+uses(const slot &consumer, const slot &producer)
+{
+    bool     use_rs1, use_rs2, unused;
+    unsigned rd, consumer_rd;
+
+    if (!consumer.valid || !producer.valid)
+        return false;
+    if (insn_opcode(producer.insn) != LOAD && insn_opcode(producer.insn) != AMO &&
+        !(insn_opcode(producer.insn) == OP && insn_funct7(producer.insn) == 1))
+        return false;
+    insn_reg_usage(producer.insn, unused, unused, rd);
+    insn_reg_usage(consumer.insn, use_rs1, use_rs2, consumer_rd);
+    return rd && ((use_rs1 && insn_rs1(consumer.insn) == rd) ||
+                  (use_rs2 && insn_rs2(consumer.insn) == rd));
+}
+
+// S3 completes S4 as one operation, as s3_fuse in rtl/yarvi.v
+static bool
+fuses(const slot &s3, const slot &s4)
+{
+    unsigned op3 = insn_opcode(s3.insn), op4 = insn_opcode(s4.insn);
+    unsigned rd  = insn_rd(s4.insn);
+    bool     addi = op3 == OP_IMM && insn_funct3(s3.insn) == 0;
+    bool     zext = (op4 == OP_IMM && insn_funct3(s4.insn) == 1 && insn_funct7(s4.insn) == 0 &&
+                     op3 == OP_IMM && insn_funct3(s3.insn) == 5 && insn_funct7(s3.insn) == 0 &&
+                     insn_rs2(s3.insn) == insn_rs2(s4.insn));
+
+    return s3.valid && s4.valid &&
+        rd != 0 && insn_rs1(s3.insn) == rd && insn_rd(s3.insn) == rd &&
+        s4.pc + s4.len == s3.pc &&
+        ((op4 == LUI && addi) ||
+         (op4 == AUIPC && (addi || op3 == JALR || op3 == LOAD)) ||
+         zext);
+}
+
+// The store in S6 takes fetch's port of the memory from the load in S5
+static bool
+port_busy(const slot &s6, const slot &s5)
+{
+    unsigned opcode = insn_opcode(s5.insn);
+
+    return s6.valid && !s6.flush && s5.valid &&
+        (insn_opcode(s6.insn) == STORE || (insn_opcode(s6.insn) == AMO && s6.insn >> 27 == 3)) &&
+        (opcode == LOAD || opcode == AMO);
+}
+
+static bool
+is_div(uint32_t insn)
+{
+    return insn_opcode(insn) == OP && insn_funct7(insn) == 1 && insn_funct3(insn) >= 4;
+}
+
+// The cycles yarvi_div is busy dividing a by b: one per significant
+// bit of |a|, and one more
+static int
+div_busy(uint32_t insn, uint32_t a, uint32_t b)
+{
+    uint32_t ua = !(insn_funct3(insn) & 1) && (int32_t) a < 0 ? -a : a;
+
+    return 1 + (b == 0 || ua == 0 ? 0 : 32 - __builtin_clz(ua));
+}
+
+static uint32_t
+div_result(uint32_t insn, uint32_t a, uint32_t b)
+{
+    int32_t sa = a, sb = b;
+
+    switch (insn_funct3(insn)) {
+    case 4:  return b == 0 ? ~0u : sa == INT32_MIN && sb == -1 ? a : (uint32_t) (sa / sb);
+    case 5:  return b == 0 ? ~0u : a / b;
+    case 6:  return b == 0 ? a : sa == INT32_MIN && sb == -1 ? 0 : (uint32_t) (sa % sb);
+    default: return b == 0 ? a : a % b;
+    }
+}
+
+// consumer reads register r
+static bool
+reads(const slot &consumer, unsigned r)
+{
+    bool     use_rs1, use_rs2;
+    unsigned rd;
+
+    if (!consumer.valid)
+        return false;
+    insn_reg_usage(consumer.insn, use_rs1, use_rs2, rd);
+    return r && ((use_rs1 && insn_rs1(consumer.insn) == r) ||
+                 (use_rs2 && insn_rs2(consumer.insn) == r));
+}
+
+// A memory access behind an AMO other than LR/SC waits in S3 until the
+// AMO is in S7, as the AMO writes memory from S8
+static bool
+amo_blocks(const slot &consumer, const slot &producer)
+{
+    unsigned opcode = insn_opcode(consumer.insn);
+    unsigned funct5 = producer.insn >> 27;
+
+    return consumer.valid && producer.valid &&
+        (opcode == LOAD || opcode == STORE || opcode == AMO) &&
+        insn_opcode(producer.insn) == AMO && funct5 != 2 && funct5 != 3;
+}
+
+int
+main(int argc, char **argv)
+{
+    bp_config cfg;
+    int       penalty = 7, load_window = 2;
+    bool      lhs_restart = false, fusion = true;
+    const char *summary = nullptr;
+    int       opt;
+
+    while ((opt = getopt(argc, argv, "m:Ll:ns:a:b:w:RF:t:T:y:g:e:r:i:NHch")) != -1)
+        switch (opt) {
+        case 'm': penalty = atoi(optarg); break;
+        case 'L': lhs_restart = true; break;
+        case 'l': load_window = atoi(optarg); break;
+        case 'n': fusion = false; break;
+        case 's': summary = optarg; break;
+        case 'a':
+            if      (strcmp(optarg, "yags") == 0)    cfg.algo = BP_YAGS;
+            else if (strcmp(optarg, "bimodal") == 0) cfg.algo = BP_BIMODAL;
+            else if (strcmp(optarg, "gshare") == 0)  cfg.algo = BP_GSHARE;
+            else if (strcmp(optarg, "static") == 0)  cfg.algo = BP_STATIC;
+            else if (strcmp(optarg, "tage") == 0)    cfg.algo = BP_TAGE;
+            else usage(argv[0]);
+            break;
+        case 'b': cfg.btb_index_bits  = atoi(optarg); break;
+        case 'w': cfg.btb_ways_lg2    = atoi(optarg); break;
+        case 'R': cfg.btb_random      = true; break;
+        case 'F':
+            if (strcmp(optarg, "low") == 0)        cfg.btb_target = BTB_LOW;
+            else if (strcmp(optarg, "delta") == 0) cfg.btb_target = BTB_DELTA;
+            else if (strcmp(optarg, "full") == 0)  cfg.btb_target = BTB_FULL;
+            else usage(argv[0]);
+            break;
+        case 't': cfg.btb_tag_bits    = atoi(optarg); break;
+        case 'T': cfg.btb_target_bits = atoi(optarg); break;
+        case 'y': cfg.yags_index_bits = atoi(optarg); break;
+        case 'g': cfg.yags_tag_bits   = atoi(optarg); break;
+        case 'e': cfg.tage_index_bits = atoi(optarg); break;
+        case 'r': cfg.ras_depth       = atoi(optarg); break;
+        case 'i': cfg.itc_index_bits  = atoi(optarg); break;
+        case 'N': cfg.predecode       = false; break;
+        case 'H': cfg.pd_checkpoint   = false; break;
+        case 'c': cfg.rvc             = true; break;
+        default:  usage(argv[0]);
+        }
+
+    if (argc > optind + 1 || penalty < 4 || 7 < penalty || load_window < 0 || 2 < load_window)
+        usage(argv[0]);
+
+    trace_window tw(trace_open(optind < argc ? argv[optind] : "-"));
+    yarvi_bp     bp(cfg);
+
+    const retired *first = tw.at(0);
+    if (!first)
+        errx(1, "empty trace");
+
+    uint64_t first_trace_cycle = first->cycle, last_trace_cycle = first->cycle;
+    uint64_t cycles = 0, insns = 0, fused = 0, lost[CA_N] = {}, events[CA_N] = {};
+    bool     started = false, stalled = false;
+
+    slot st[STAGES] = {};
+    for (int s = 0; s < STAGES; ++s)
+        st[s].cause = CA_STARTUP;
+
+    // Reset is a restart to the first instruction
+    aligner al = {};
+    bp.restart(0, first->pc);
+    fetch(st[0], tw, 0, first->pc, CA_STARTUP);
+
+    bp_update upd;
+    bool      upd_pending = false;
+
+    // The divider (md_state in rtl/yarvi.v), and the architectural
+    // registers for its operands, initialized as the RTL does
+    enum { MD_IDLE, MD_DIV, MD_REG, MD_DONE } md_state = MD_IDLE;
+    int       md_busy = 0;
+    bool      md_pending = false, md_cancel = false;
+    unsigned  md_rd = 0;
+    bool      late_restart = false;    // decided in S6, so a cycle later
+    uint32_t  late_pc = 0;
+    int64_t   late_idx = 0;
+    int       late_cause = 0;
+    bool      trap_pending = false;    // the fall-through traps
+    uint32_t  trap_pc = 0, trap_to_pc = 0;
+    int64_t   trap_to_idx = 0;
+    uint32_t  regs[32];
+    for (int r = 0; r < 32; ++r)
+        regs[r] = r;
+
+    for (;;) {
+        slot &s6 = st[6];
+
+        // The restart of a trap or a divide replayed from S6 the
+        // cycle before
+        if (late_restart) {
+            s6 = slot{};
+            s6.valid       = true;
+            s6.flush       = true;
+            s6.restart     = true;
+            s6.restart_pc  = late_pc;
+            s6.restart_idx = late_idx;
+            s6.cause       = late_cause;
+            late_restart   = false;
+        } else if (s6.valid && s6.trap) {
+            late_restart = true;
+            late_pc      = trap_to_pc;
+            late_idx     = trap_to_idx;
+            late_cause   = CA_TRAP;
+        }
+
+        // A divide in S6 starts the divider, or replays if it's busy
+        bool md_start = false;
+        if (s6.valid && !s6.flush && s6.idx >= 0 && is_div(s6.insn)) {
+            md_start = md_state == MD_IDLE;
+            if (!md_start) {
+                s6.flush      = true;
+                s6.restart    = false;
+                s6.cause      = CA_DIVIDE;
+                late_restart  = true;
+                late_pc       = s6.pc;
+                late_idx      = s6.idx;
+                late_cause    = CA_DIVIDE;
+            }
+        }
+
+        bool restart = s6.valid && s6.restart;
+
+        // Accounting for this cycle, from the first commit on
+        if (s6.valid && !s6.flush && s6.idx >= 0) {
+            const retired *r = tw.at(s6.idx);
+            bool     use_rs1, use_rs2;
+            unsigned rd;
+            started = true;
+            ++insns;
+            fused += s6.fused;
+            last_trace_cycle = r->cycle;
+            insn_reg_usage(r->insn, use_rs1, use_rs2, rd);
+            if (md_start) {
+                uint32_t a = regs[insn_rs1(r->insn)], b = regs[insn_rs2(r->insn)];
+                md_busy = div_busy(r->insn, a, b);
+                if (rd)
+                    regs[rd] = div_result(r->insn, a, b);
+            } else if (rd)
+                regs[rd] = r->wb_val;
+            tw.retire_upto(s6.idx - 1); // a fused pair can restart from it
+
+        } else if (started)
+            ++lost[s6.cause];
+        if (started)
+            ++cycles;
+        if (restart)
+            ++events[s6.cause];
+
+        if (s6.valid && s6.idx >= 0 && !s6.flush && !tw.at(s6.idx + 1))
+            break;
+
+        // S3 stall on a load, AMO, or RV32M result in S4 or S5, or
+        // an access behind an AMO in S4-S6
+        bool stall = !restart &&
+            ((1 <= load_window && uses(st[3], st[4])) ||
+             (2 <= load_window && uses(st[3], st[5])) ||
+             amo_blocks(st[3], st[4]) || amo_blocks(st[3], st[5]) ||
+             amo_blocks(st[3], st[6]));
+        events[CA_LOAD_USE] += stall && !stalled;
+        stalled = stall;
+
+        // S3 fusing with S4, which RTL only does when S3 doesn't stall
+        bool fuse = fusion && !restart && !stall && fuses(st[3], st[4]);
+
+        // A consumer of the divide's result in S4 replays from S5.  The
+        // second of a fused pair reads what the first did (the SLLI's
+        // rs1) and replays the pair, and the first can't replay alone.
+        const slot &reader = st[4].fused ? st[5] : st[4];
+        if (!fuse && ((md_pending && reads(reader, md_rd)) ||
+                      (md_start && reads(reader, insn_rd(s6.insn)))))
+            st[4].replay = true;
+
+        // The divider, which S7 has priority over for the register write
+        bool s7_write = (st[7].valid && !st[7].first && insn_rd(st[7].insn) &&
+                         !is_div(st[7].insn));
+        switch (md_state) {
+        case MD_IDLE: break;
+        case MD_DIV:  if (md_busy == 0) md_state = MD_REG; else --md_busy; break;
+        case MD_REG:  if (md_cancel || !s7_write) md_state = MD_DONE; break;
+        case MD_DONE: md_pending = false; md_state = MD_IDLE; break;
+        }
+        if (s7_write && insn_rd(st[7].insn) == md_rd) {
+            md_pending = false;
+            md_cancel  = true;
+        }
+        if (md_start) {
+            md_state   = MD_DIV;
+            md_pending = insn_rd(s6.insn) != 0;
+            md_cancel  = insn_rd(s6.insn) == 0;
+            md_rd      = insn_rd(s6.insn);
+        }
+
+        // With RVC, the instruction the aligner has for S3, and S0-S2
+        // waiting while it takes the first of two in a word
+        slot aligned;
+        if (cfg.rvc)
+            align(al, st[2], tw, bp, aligned);
+        bool al_hold = cfg.rvc && !restart && al.hold;
+        events[CA_ALIGN] += cfg.rvc && !restart && !stall && st[2].valid && !al.emit;
+
+        // S2 redirect, in place of the S0 prediction, or with RVC for a
+        // word predicted taken where the aligner waits for the rest of
+        // an instruction
+        bool redirect = !restart && !stall && st[2].valid &&
+            (cfg.rvc ? al.buf && al.taken : bp.predecode_taken(st[2].p, st[2].insn));
+        events[CA_PREDECODE] += redirect;
+
+        // S0 waiting for the memory port
+        bool hold = !restart && !stall && !al_hold && !redirect && port_busy(st[6], st[5]);
+        events[CA_PORT] += hold;
+
+        // S0
+        bp_prediction p = restart || redirect ? bp_prediction{} :
+            bp.s0(st[0].pc, stall || al_hold || hold);
+        if (restart)
+            bp.restart(st[0].pc, s6.restart_pc);
+        else if (redirect && cfg.rvc)
+            bp.realign(st[0].pc, st[2].p);
+        else if (redirect)
+            bp.s2(st[0].pc, st[2].p, st[2].insn);
+        else if (!stall && !al_hold && !hold)
+            st[0].p = p;
+
+        // The table write registered by the previous S5
+        if (upd_pending)
+            bp.write(upd);
+        upd_pending = false;
+
+        // S5 (for the instruction moving to S6), squashed by a restart
+        // or a restart decided in S6
+        slot &s5 = st[5];
+        if (!restart && !late_restart && s5.valid && s5.idx < 0 && trap_pending &&
+            s5.pc == trap_pc) {
+            // The instruction that traps, which doesn't commit
+            s5.trap      = true;
+            s5.flush     = true;
+            s5.restart   = false;
+            s5.cause     = CA_TRAP;
+            trap_pending = false;
+        } else if (!restart && !late_restart && s5.valid && s5.idx >= 0 && s5.replay) {
+            s5.restart     = true;
+            s5.flush       = true;
+            s5.restart_pc  = s5.pc;
+            s5.restart_idx = s5.idx;
+            s5.cause       = CA_DIVIDE;
+            if (s5.fused) {
+                // The first, in S6 now, goes back too
+                s5.restart_pc  = s6.pc;
+                s5.restart_idx = s6.idx;
+                --insns;
+                ++lost[CA_DIVIDE];
+            }
+        } else if (!restart && !late_restart && s5.valid && s5.idx >= 0) {
+            const retired *r    = tw.at(s5.idx);
+            const retired *next = tw.at(s5.idx + 1);
+            uint32_t fallthru   = r->pc + r->len;
+            uint32_t actual     = next ? next->pc : fallthru;
+            uint32_t expected   = fallthru;
+            unsigned opcode     = insn_opcode(r->insn);
+
+            if (r->len == 2 && !cfg.rvc)
+                errx(1, "the trace has RVC instructions, use -c");
+
+            switch (opcode) {
+            case BRANCH:
+                if (actual == r->pc + insn_sb_imm(r->insn))
+                    expected = actual;
+                break;
+            case JAL:
+                expected = r->pc + insn_uj_imm(r->insn);
+                break;
+            case JALR: case SYSTEM:
+                expected = actual;
+                break;
+            }
+
+            s5.restart     = bp.s5(s5.p, r->insn, expected, upd);
+            s5.flush       = false;
+            s5.restart_pc  = actual;
+            s5.restart_idx = s5.idx + 1;
+            s5.cause       = ctl_cause(r->insn);
+            upd_pending    = true;
+
+            // The instruction after this one traps (or is interrupted)
+            // when it gets to S6, but it isn't in the trace
+            if (actual != expected) {
+                s5.restart_pc  = expected;
+                trap_pending   = true;
+                trap_pc        = expected;
+                trap_to_pc     = actual;
+                trap_to_idx    = s5.idx + 1;
+            }
+
+            if (opcode == LOAD && lhs_restart)
+                for (int s = 6; s <= 7; ++s)
+                    if (st[s].valid && st[s].idx >= 0 && insn_opcode(st[s].insn) == STORE &&
+                        st[s].addr >> 2 == r->addr >> 2) {
+                        s5.restart     = true;
+                        s5.flush       = true;
+                        s5.restart_pc  = r->pc;
+                        s5.restart_idx = s5.idx;
+                        s5.cause       = CA_LHS;
+                    }
+        }
+
+        // Clock
+        st[8] = st[7];
+        st[7] = st[6];
+        st[7].valid &= !st[7].flush;
+
+        if (restart) {
+            int     c   = s6.cause;
+            int64_t idx = s6.restart_idx;
+            uint32_t pc = s6.restart_pc;
+
+            for (int s = 6; 0 < s; --s)
+                st[s] = slot{}, st[s].cause = c;
+
+            // The restarted fetch; a shorter penalty lets it skip stages
+            fetch(st[0], tw, idx, pc, c);
+            al      = aligner{};
+            al.next = idx;
+            for (int k = 0; k < 7 - penalty; ++k) {
+                if (cfg.rvc) {
+                    uint32_t word     = st[2].pc & ~3;
+                    align(al, st[2], tw, bp, st[3]);
+                    bool     redirect = st[2].valid && al.buf && al.taken;
+                    if (redirect)
+                        bp.realign(st[0].pc, st[2].p);
+                    else if (al.hold)
+                        bp.s0(st[0].pc, true);
+                    else
+                        st[0].p = bp.s0(st[0].pc);
+                    align_clock(al, st[2], st[3]);
+                    if (redirect) {
+                        for (int s = 2; 0 < s; --s)
+                            st[s] = slot{}, st[s].cause = CA_PREDECODE;
+                        fetch(st[0], tw, -1, word + 4, CA_PREDECODE);
+                    } else if (!al.hold) {
+                        st[2] = st[1];
+                        st[1] = st[0];
+                        fetch(st[0], tw, -1, st[1].p.npc, c);
+                    }
+                    continue;
+                }
+                st[0].p = bp.s0(st[0].pc);
+                for (int s = 3; 0 < s; --s)
+                    st[s] = st[s - 1];
+                fetch(st[0], tw, st[1].idx >= 0 ? st[1].idx + 1 : -1, st[1].p.npc, c);
+            }
+            continue;
+        }
+
+        st[6] = st[5];
+        st[5] = st[4];
+
+        if (stall) {
+            st[4] = slot{};
+            st[4].cause = CA_LOAD_USE;
+            continue;
+        }
+
+        st[3].fused = fuse;
+        st[5].first = fuse;
+        if (cfg.rvc) {
+            st[4] = st[3];
+            st[3] = aligned;
+            align_clock(al, st[2], aligned);
+            if (al_hold)
+                continue;
+
+            uint32_t word = st[2].pc & ~3;
+            if (redirect) {
+                for (int s = 2; 0 < s; --s)
+                    st[s] = slot{}, st[s].cause = CA_PREDECODE;
+                fetch(st[0], tw, -1, word + 4, CA_PREDECODE);
+            } else if (hold) {
+                st[2] = st[1];
+                st[1] = slot{};
+                st[1].cause = CA_PORT;
+            } else {
+                st[2] = st[1];
+                st[1] = st[0];
+                fetch(st[0], tw, -1, p.npc, CA_STARTUP);
+            }
+            continue;
+        }
+        for (int s = 4; 0 < s; --s)
+            st[s] = st[s - 1];
+
+        if (redirect) {
+            for (int s = 2; 0 < s; --s)
+                st[s] = slot{}, st[s].cause = CA_PREDECODE;
+            fetch(st[0], tw, st[3].idx >= 0 ? st[3].idx + 1 : -1, st[3].p.npc, CA_PREDECODE);
+            continue;
+        }
+
+        // S0 fetches again
+        if (hold) {
+            st[1] = slot{};
+            st[1].cause = CA_PORT;
+            continue;
+        }
+
+        // The next S0 is on the committed path only if this one was
+        // and was predicted correctly
+        fetch(st[0], tw, st[1].idx >= 0 ? st[1].idx + 1 : -1, p.npc, CA_STARTUP);
+    }
+
+    uint64_t trace_cycles = last_trace_cycle - first_trace_cycle + 1;
+
+    /*
+     * The summary is what target/verisim's bench records: the RTL's
+     * cycles and CPI, and the model's breakdown of the lost cycles.
+     */
+    if (summary) {
+        uint64_t mispredict = 0;
+        for (int c = CA_BRANCH; c <= CA_PREDECODE; ++c)
+            mispredict += lost[c];
+        printf("%-10s %10" PRIu64 " %10" PRIu64 " %7.4f %7.4f %7.4f %7.4f %7.4f\n",
+               summary, trace_cycles, insns, (double) trace_cycles / insns,
+               (double) lost[CA_LOAD_USE] / insns, (double) mispredict / insns,
+               (double) lost[CA_LHS] / insns,
+               (double) (lost[CA_STARTUP] + lost[CA_SYSTEM] + lost[CA_TRAP] + lost[CA_PORT] +
+                         lost[CA_DIVIDE]) / insns);
+        return 0;
+    }
+
+    printf("Instructions:     %" PRIu64 "\n", insns);
+    printf("Cycles:           %" PRIu64 " (CPI %.3f, IPC %.3f)\n", cycles,
+           (double) cycles / insns, (double) insns / cycles);
+    printf("Trace cycles:     %" PRIu64 " (IPC %.3f), model error %+.2f%%\n", trace_cycles,
+           (double) insns / trace_cycles, 100.0 * ((double) cycles - trace_cycles) / trace_cycles);
+    printf("Fused pairs:      %" PRIu64 " (%.1f%% of the instructions)\n", fused,
+           100.0 * 2 * fused / insns);
+    printf("%-16s %10s %12s %8s\n", "lost to", "events", "cycles", "CPI");
+    for (int c = 0; c < CA_N; ++c)
+        if (lost[c] || events[c])
+            printf("%-16s %10" PRIu64 " %12" PRIu64 " %8.3f\n", cause_name[c], events[c],
+                   lost[c], (double) lost[c] / insns);
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+// -----------------------------------------------------------------------
+//
+// Retirement trace reader and RV32 field helpers for the YARVI
+// performance tools
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * The trace is what target/verisim writes with +retire=FILE, one line
+ * per retired instruction:
+ *
+ *   <cycle> <pc> <insn> <wb_val> <addr> <len>
+ *
+ * cycle and len are decimal, the rest are hex.  addr is the effective
+ * address of loads and stores (and meaningless otherwise).  len is the
+ * instruction's size in bytes, 2 for an RVC instruction, whose insn is
+ * the expanded one; older traces without it are all 4.
+ */
+
+#ifndef YARVI_TRACE_H
+#define YARVI_TRACE_H
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct retired {
+    uint64_t cycle;
+    uint32_t pc;
+    uint32_t insn;
+    uint32_t wb_val;
+    uint32_t addr;
+    unsigned len;
+};
+
+static inline FILE *
+trace_open(const char *name)
+{
+    if (strcmp(name, "-") == 0)
+        return stdin;
+
+    FILE *f = fopen(name, "r");
+    if (!f)
+        err(1, "%s", name);
+    return f;
+}
+
+// Returns false at end of trace.  Lines that don't parse (eg. the
+// simulator's own output if the trace went to stdout) are skipped.
+static inline bool
+trace_read(FILE *f, retired &r)
+{
+    char line[256];
+
+    while (fgets(line, sizeof line, f)) {
+        char *p = line, *q;
+
+        r.cycle = strtoull(p, &q, 10);
+        if (q == p || *q != ' ')
+            continue;
+        r.pc = strtoul(p = q, &q, 16);
+        if (q == p)
+            continue;
+        r.insn = strtoul(p = q, &q, 16);
+        if (q == p)
+            continue;
+        r.wb_val = strtoul(p = q, &q, 16);
+        if (q == p)
+            continue;
+        r.addr = strtoul(p = q, &q, 16);
+        if (q == p)
+            continue;
+        r.len = strtoul(p = q, &q, 10);
+        if (q == p)
+            r.len = 4;
+        else if (r.len != 2 && r.len != 4)
+            continue;
+        return true;
+    }
+
+    return false;
+}
+
+/* Major opcodes, insn[6:2], as in rtl/riscv.h */
+enum {
+    LOAD      =  0,
+    MISC_MEM  =  3,
+    OP_IMM    =  4,
+    AUIPC     =  5,
+    STORE     =  8,
+    AMO       = 11,
+    OP        = 12,
+    LUI       = 13,
+    BRANCH    = 24,
+    JALR      = 25,
+    JAL       = 27,
+    SYSTEM    = 28,
+};
+
+#define FENCE_I 1 // MISC_MEM funct3
+
+static inline unsigned insn_opcode(uint32_t insn) { return (insn >>  2) & 31; }
+static inline unsigned insn_rd(uint32_t insn)     { return (insn >>  7) & 31; }
+static inline unsigned insn_funct3(uint32_t insn) { return (insn >> 12) &  7; }
+static inline unsigned insn_rs1(uint32_t insn)    { return (insn >> 15) & 31; }
+static inline unsigned insn_rs2(uint32_t insn)    { return (insn >> 20) & 31; }
+static inline unsigned insn_funct7(uint32_t insn) { return  insn >> 25;       }
+
+static inline uint32_t insn_i_imm(uint32_t insn)  { return (int32_t) insn >> 20; }
+
+static inline uint32_t
+insn_sb_imm(uint32_t insn)
+{
+    return ((uint32_t) ((int32_t) insn >> 31) << 12)
+        | ((insn << 4) & 0x800)
+        | ((insn >> 20) & 0x7e0)
+        | ((insn >> 7) & 0x1e);
+}
+
+static inline uint32_t
+insn_uj_imm(uint32_t insn)
+{
+    return ((uint32_t) ((int32_t) insn >> 31) << 20)
+        | (insn & 0xff000)
+        | ((insn >> 9) & 0x800)
+        | ((insn >> 20) & 0x7fe);
+}
+
+// r1 and r5 are the link registers
+static inline bool is_link(unsigned r) { return r == 1 || r == 5; }
+
+/*
+ * Register usage, mirroring rtl/yarvi_dec_reg_usage.v (r0 is never
+ * considered used nor defined).
+ */
+static inline void
+insn_reg_usage(uint32_t insn, bool &use_rs1, bool &use_rs2, unsigned &rd)
+{
+    use_rs1 = use_rs2 = false;
+    rd = 0;
+
+    switch (insn_opcode(insn)) {
+    case BRANCH: case STORE:
+        use_rs1 = use_rs2 = true;
+        break;
+    case OP: case AMO:
+        use_rs1 = use_rs2 = true;
+        rd = insn_rd(insn);
+        break;
+    case OP_IMM: case JALR: case LOAD:
+        use_rs1 = true;
+        rd = insn_rd(insn);
+        break;
+    case SYSTEM:
+        if (insn_funct3(insn) != 0) {
+            use_rs1 = insn_funct3(insn) < 4;
+            rd = insn_rd(insn);
+        }
+        break;
+    case AUIPC: case LUI: case JAL:
+        rd = insn_rd(insn);
+        break;
+    }
+
+    if (insn_rs1(insn) == 0) use_rs1 = false;
+    if (insn_rs2(insn) == 0) use_rs2 = false;
+}
+
+#endif
@@ -0,0 +1,244 @@
+// -----------------------------------------------------------------------
+//
+// Workload characterization from a retirement trace
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * Reports what a workload looks like to the pipeline, independent of
+ * the microarchitecture: the instruction mix, how far results are
+ * consumed from where they are produced (load->use and ALU->use), how
+ * far loads are from the last store to the same word, branch
+ * behavior, and with RVC how many instructions are 16-bit and how many
+ * 32-bit ones straddle two words.
+ *
+ * Distances are in dynamic instructions, 1 meaning back-to-back.  The
+ * hazard estimate applies the current pipeline's costs to them:
+ *
+ *   load-use        2 stall cycles at distance 1, 1 at distance 2
+ *   load-hit-store  a restart (-p, 7 cycles) at distance 1 or 2, as
+ *                   S5 compared the load with the stores in S6 and S7
+ *                   before store-to-load forwarding, now free
+ *
+ * which ignores that stalls and restarts themselves change distances;
+ * pipesim has the exact numbers.
+ */
+
+#include <unordered_map>
+#include <unistd.h>
+#include "trace.h"
+
+#define HIST_MAX 8 // buckets 1 .. HIST_MAX-1, and HIST_MAX and beyond
+
+enum { K_ALU, K_LOAD, K_STORE, K_BRANCH, K_JAL, K_JALR, K_SYSTEM, K_FENCE, K_OTHER, K_N };
+static const char *kind_name[K_N] = {
+    "alu", "load", "store", "branch", "jal", "jalr", "system", "fence", "other"
+};
+
+static int
+kind(uint32_t insn)
+{
+    switch (insn_opcode(insn)) {
+    case OP: case OP_IMM: case LUI: case AUIPC: return K_ALU;
+    case LOAD:     return K_LOAD;
+    case STORE:    return K_STORE;
+    case BRANCH:   return K_BRANCH;
+    case JAL:      return K_JAL;
+    case JALR:     return K_JALR;
+    case SYSTEM:   return K_SYSTEM;
+    case MISC_MEM: return K_FENCE;
+    default:       return K_OTHER;
+    }
+}
+
+struct histogram {
+    uint64_t bucket[HIST_MAX + 1] = {}; // [0] unused
+    uint64_t n = 0;
+
+    void add(uint64_t d)
+    {
+        ++bucket[d < HIST_MAX ? d : HIST_MAX];
+        ++n;
+    }
+
+    void print(const char *name, uint64_t of) const
+    {
+        printf("%-16s %10" PRIu64 " (%5.1f%%)", name, n, of ? 100.0 * n / of : 0.0);
+        for (int d = 1; d <= HIST_MAX; ++d)
+            printf(" %5.1f", n ? 100.0 * bucket[d] / n : 0.0);
+        printf("\n");
+    }
+};
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [TRACE]\n"
+            "  -p N     restart penalty in cycles (7)\n"
+            "TRACE defaults to stdin\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned penalty = 7;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "p:h")) != -1)
+        switch (opt) {
+        case 'p': penalty = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+
+    if (argc > optind + 1)
+        usage(argv[0]);
+
+    FILE    *f = trace_open(optind < argc ? argv[optind] : "-");
+    retired  r, next;
+    bool     have = trace_read(f, r);
+    uint64_t insns = 0, mix[K_N] = {}, compressed = 0, straddling = 0;
+    uint64_t first_cycle = have ? r.cycle : 0, last_cycle = first_cycle;
+
+    // The producer of each register: sequence number and kind
+    uint64_t def_seq[32] = {};
+    int      def_kind[32];
+    for (int i = 0; i < 32; ++i)
+        def_kind[i] = K_OTHER;
+
+    histogram load_use, alu_use, store_load;
+    uint64_t  load_use_cycles = 0, lhs_events = 0;
+    uint64_t  loads_no_store = 0;
+    std::unordered_map<uint32_t, uint64_t> last_store; // word -> seq
+
+    uint64_t br_n[2] = {}, br_taken[2] = {}; // forward, backward
+    uint64_t transitions = 0, br_seen = 0;
+    std::unordered_map<uint32_t, bool> last_dir;
+
+    while (have) {
+        bool have_next = trace_read(f, next);
+        uint64_t seq = ++insns;
+        int      k   = kind(r.insn);
+
+        ++mix[k];
+        compressed += r.len == 2;
+        straddling += r.len == 4 && (r.pc & 2);
+        last_cycle = r.cycle;
+
+        bool     use_rs1, use_rs2;
+        unsigned rd;
+        insn_reg_usage(r.insn, use_rs1, use_rs2, rd);
+
+        // Dependencies, each source operand counted once
+        unsigned stall = 0;
+        for (int o = 0; o < 2; ++o) {
+            unsigned rs = o ? insn_rs2(r.insn) : insn_rs1(r.insn);
+            if (!(o ? use_rs2 : use_rs1) || !def_seq[rs] || (o && rs == insn_rs1(r.insn) && use_rs1))
+                continue;
+            uint64_t d = seq - def_seq[rs];
+            if (def_kind[rs] == K_LOAD) {
+                load_use.add(d);
+                if (d <= 2 && stall < 3 - d)
+                    stall = 3 - d;
+            } else if (def_kind[rs] == K_ALU)
+                alu_use.add(d);
+        }
+        load_use_cycles += stall;
+
+        if (rd) {
+            def_seq[rd]  = seq;
+            def_kind[rd] = k;
+        }
+
+        // Store -> load to the same word
+        if (k == K_STORE)
+            last_store[r.addr >> 2] = seq;
+        else if (k == K_LOAD) {
+            auto it = last_store.find(r.addr >> 2);
+            if (it == last_store.end())
+                ++loads_no_store;
+            else {
+                uint64_t d = seq - it->second;
+                store_load.add(d);
+                lhs_events += d <= 2;
+            }
+        }
+
+        // Branches, by direction
+        if (k == K_BRANCH) {
+            int32_t  off      = insn_sb_imm(r.insn);
+            bool     backward = off < 0;
+            bool     taken    = have_next && next.pc == r.pc + off;
+
+            ++br_n[backward];
+            br_taken[backward] += taken;
+
+            auto it = last_dir.find(r.pc);
+            if (it != last_dir.end()) {
+                ++br_seen;
+                transitions += it->second != taken;
+            }
+            last_dir[r.pc] = taken;
+        }
+
+        r = next;
+        have = have_next;
+    }
+
+    if (!insns)
+        errx(1, "empty trace");
+
+    uint64_t cycles = last_cycle - first_cycle + 1;
+    uint64_t lhs_cycles = lhs_events * penalty;
+
+    printf("Instructions:     %" PRIu64 " in %" PRIu64 " cycles (IPC %.3f)\n",
+           insns, cycles, (double) insns / cycles);
+    if (compressed || straddling)
+        printf("Compressed:       %" PRIu64 " (%.1f%%), %" PRIu64 " 32-bit straddling words (%.1f%%)\n",
+               compressed, 100.0 * compressed / insns, straddling, 100.0 * straddling / insns);
+
+    printf("\nInstruction mix\n");
+    for (int k = 0; k < K_N; ++k)
+        if (mix[k])
+            printf("  %-8s %12" PRIu64 "  %5.1f%%\n", kind_name[k], mix[k], 100.0 * mix[k] / insns);
+
+    printf("\nDistance to use, %% at 1 .. %d, %d+\n", HIST_MAX - 1, HIST_MAX);
+    load_use.print("  load->use", mix[K_LOAD]);
+    alu_use.print("  alu->use", mix[K_ALU]);
+
+    printf("\nStore->load to the same word, %% at 1 .. %d, %d+\n", HIST_MAX - 1, HIST_MAX);
+    store_load.print("  store->load", mix[K_LOAD]);
+    printf("  loads never preceded by a store to their word: %" PRIu64 "\n", loads_no_store);
+
+    printf("\nBranches\n");
+    for (int b = 0; b < 2; ++b)
+        printf("  %-8s %12" PRIu64 "  taken %5.1f%%\n", b ? "backward" : "forward",
+               br_n[b], br_n[b] ? 100.0 * br_taken[b] / br_n[b] : 0.0);
+    printf("  direction changes from the previous execution: %.1f%%\n",
+           br_seen ? 100.0 * transitions / br_seen : 0.0);
+
+    printf("\nEstimated hazard cost with the current pipeline\n");
+    printf("  load-use        %12" PRIu64 " cycles  %.3f CPI\n",
+           load_use_cycles, (double) load_use_cycles / insns);
+    printf("  load-hit-store  %12" PRIu64 " cycles  %.3f CPI (%" PRIu64 " restarts without forwarding)\n",
+           lhs_cycles, (double) lhs_cycles / insns, lhs_events);
+    printf("  (see bpsim for mispredictions)\n");
+
+    return 0;
+}
@@ -0,0 +1,903 @@
+// -----------------------------------------------------------------------
+//
+// A C++ model of the YARVI2 branch predictor (BTB + bimodal, YAGS or TAGE, RAS)
+//
+// ISC License
+//
+// Copyright (C) 2014 - 2022  Tommy Thorn <tommy-github2@thorn.ws>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+// -----------------------------------------------------------------------
+
+/*
+ * This mirrors S0 and the S5 predictor update of rtl/yarvi.v, including
+ * the awkward parts:
+ *
+ * - S0 predicts from values registered the cycle before: the BTB is
+ *   read with s0_npc (so it matches s0_pc), but YAGS is read with
+ *   s0_pc ^ br_history, thus the YAGS entry used for a prediction was
+ *   indexed by the _previous_ S0 pc (or the same pc after a stall).
+ *
+ * - the indirect target cache (ITC) is read like YAGS, with
+ *   s0_pc ^ path_history, and overrides the BTB target of jumps and
+ *   calls on a hit.
+ *
+ * - br_history, path_history and the RAS are updated speculatively in
+ *   S0 on BTB hits.  On restart, the histories are restored from
+ *   rbr_history and rpath_history and the RAS
+ *   from the pointer and top carried with the S5 (or S6) instruction,
+ *   which leaves any entries below the top that the wrong path
+ *   overwrote.
+ *
+ * - the BTB ways are all read with s0_npc and the hit picked by the tag
+ *   compare in S0.  A BTB miss in S5 allocates the victim way of the
+ *   set then, and the NRU bits are updated with the table writes.
+ *
+ * - on a BTB miss, S2 predicts backward branches, JALs and returns
+ *   taken from the predecode bits (s2()).  S0 is redirected while it
+ *   holds the second instruction behind, the RAS is repaired from the
+ *   S2 instruction and the histories from the checkpoint S0 took for
+ *   it, plus its own branch or jump.
+ *
+ * - the BTB/YAGS writes are registered in S5 and land a cycle later.
+ *   Non-control-flow instructions that were predicted taken rewrite
+ *   the BTB entry with whatever tag/target was last registered.
+ *
+ * - with RVC (cfg.rvc), S0 still predicts a word at a time.  A BTB
+ *   entry records the halfword of the word its instruction ends in,
+ *   the pc the tables know an instruction by (its "bp pc"), and only
+ *   hits if that isn't before the halfword S0 fetched from.  Targets
+ *   are kept to the halfword, sequential fetch goes on with the next
+ *   word, and predecode doesn't predict.  The aligner in S2 gives the
+ *   word's prediction to the first instruction ending at or after the
+ *   entry's halfword (align()), and S5 is then called with that
+ *   instruction's pc and length.
+ *
+ * The model is driven one S0 cycle at a time (s0()), and the caller
+ * decides when S5 outcomes (s5()) are written (write()), which is how
+ * bpsim approximates the pipeline and how a cycle model can be exact.
+ *
+ * The table geometry, RAS depth, and the direction predictor are
+ * configurable.  The default configuration is the RTL; BP_TAGE is
+ * rtl/yarvi_tage.v, read at the same point as YAGS.  Its loop
+ * predictor's retired iteration counts are updated in s5() rather
+ * than with the table writes.
+ */
+
+#ifndef YARVI_BP_H
+#define YARVI_BP_H
+
+#include <stdint.h>
+#include <vector>
+#include "trace.h"
+
+#define BTB_TYPE_BR_S_N 0
+#define BTB_TYPE_BR_W_N 1
+#define BTB_TYPE_BR_W_T 2
+#define BTB_TYPE_BR_S_T 3
+#define BTB_TYPE_RETURN 4
+#define BTB_TYPE_JUMP   6
+#define BTB_TYPE_CALL   7
+
+#define BP_MAX_RAS 64
+#define BP_MAX_BTB_WAYS 16
+
+#define TAGE_TABLES    4
+#define TAGE_TAG_BITS  8
+#define LOOP_ENTRIES   8
+
+#define ITC_TAG_BITS   8
+
+static const int tage_hist_len[TAGE_TABLES] = {5, 12, 27, 64};
+
+enum bp_algo {
+    BP_YAGS,    // BTB bimodal + YAGS corrector (the RTL)
+    BP_BIMODAL, // BTB bimodal only
+    BP_GSHARE,  // the YAGS table as untagged gshare counters
+    BP_STATIC,  // backward taken, forward not taken on BTB hits
+    BP_TAGE,    // BTB bimodal + TAGE and loop predictor (TAGE in the RTL)
+};
+
+enum btb_target_fmt {
+    BTB_LOW,    // the low bits, the rest from the pc (the RTL default)
+    BTB_DELTA,  // a signed distance from the pc (BTB_DELTA_TARGET)
+    BTB_FULL,   // all of it (BTB_FULL_TARGET)
+};
+
+struct bp_config {
+    int     btb_index_bits  = 10;  // BTB_INDEX_MSB + 1
+    int     btb_tag_bits    = 5;   // BTB_TAG_MSB + 1
+    int     btb_target_bits = 15;  // BTB_TARGET_MSB + 1, unless BTB_FULL
+    int     btb_ways_lg2    = 0;   // BTB_WAYS_LG2
+    bool    btb_random      = false; // BTB_REPLACE_RANDOM
+    btb_target_fmt btb_target = BTB_LOW;
+    int     yags_index_bits = 12;  // YAGS_INDEX_MSB + 1
+    int     yags_tag_bits   = 6;   // YAGS_TAG_MSB + 1
+    int     tage_index_bits = 9;   // TAGE_LG2
+    int     ras_depth       = 16;  // 2 << RAS_INDEX_MSB
+    int     itc_index_bits  = 8;   // ITC_INDEX_MSB + 1, 0 for none
+    bool    predecode       = true; // the S2 static prediction
+    bool    pd_checkpoint   = true; // which restores the histories
+    bool    rvc             = false; // RVC
+    bp_algo algo            = BP_YAGS;
+};
+
+// What a TAGE lookup found, carried in place of the YAGS index
+struct tage_meta {
+    uint32_t idx[TAGE_TABLES];
+    unsigned tag[TAGE_TABLES];
+    bool     u[TAGE_TABLES];
+    unsigned prov, prov_ctr;  // provider 0 is none, else table prov - 1
+    bool     alt_hit, alt_taken;
+    bool     loop_hit, loop_taken;
+};
+
+// What S0 sends down the pipeline along with the instruction
+struct bp_prediction {
+    uint32_t pc;       // s0_pc, with RVC the instruction's after align()
+    unsigned len;      // of the instruction, 2 or 4 bytes
+    uint32_t npc;
+    unsigned type;     // s0_prediction
+    unsigned btb_type;
+    bool     btb_hit;
+    unsigned btb_way;
+    unsigned btb_half; // with RVC, the halfword the entry's instruction ends in
+    uint32_t yags_idx;
+    bool     yags_hit;
+    unsigned yags_dir;
+    unsigned ras_tos;  // the RAS checkpoint
+    uint32_t ras_top;
+    tage_meta tage;
+    uint32_t itc_idx;
+    bool     itc_hit;
+    unsigned itc_conf;
+    uint64_t br_history;   // the history checkpoints
+    uint32_t path_history;
+};
+
+// The registered btb_update* and yags_update*
+struct bp_update {
+    bool     btb;
+    bool     btb_touch;
+    uint32_t btb_idx;  // way and set
+    unsigned btb_type;
+    unsigned btb_tag;
+    uint32_t btb_target;
+    unsigned btb_half;
+
+    bool     yags;
+    uint32_t yags_idx;
+    unsigned yags_tag;
+    unsigned yags_dir;
+
+    bool      tage;
+    tage_meta tage_m;
+    bool      tage_taken;
+    bool      tage_base;
+
+    bool      itc;
+    bool      itc_replace;
+    uint32_t  itc_idx;
+    unsigned  itc_tag;
+    uint32_t  itc_target;
+    unsigned  itc_conf;
+};
+
+class yarvi_bp {
+public:
+    explicit yarvi_bp(const bp_config &c)
+        : cfg(c),
+          btb_mask((1u << c.btb_index_bits) - 1),
+          btb_tag_mask((1u << c.btb_tag_bits) - 1),
+          btb_target_mask(c.btb_target == BTB_FULL ? (c.rvc ? 0x7fffffff : 0x3fffffff)
+                                                    : (1u << c.btb_target_bits) - 1),
+          yags_mask((1u << c.yags_index_bits) - 1),
+          yags_tag_mask((1u << c.yags_tag_bits) - 1),
+          btb_type((btb_mask + 1) << c.btb_ways_lg2, 0),
+          btb_tag((btb_mask + 1) << c.btb_ways_lg2, btb_tag_mask),
+          btb_target((btb_mask + 1) << c.btb_ways_lg2, 0),
+          btb_half((btb_mask + 1) << c.btb_ways_lg2, 0),
+          btb_nru(btb_mask + 1, 0),
+          yags_tag(yags_mask + 1, yags_tag_mask),
+          yags_direction(yags_mask + 1, 1),
+          tage_mask((1u << c.tage_index_bits) - 1),
+          itc_mask((1u << c.itc_index_bits) - 1),
+          itc_tag(itc_mask + 1, (1u << ITC_TAG_BITS) - 1),
+          itc_target(itc_mask + 1, 0),
+          itc_conf(itc_mask + 1, 0)
+    {
+        for (int t = 0; t < TAGE_TABLES; ++t) {
+            tage_tag[t].assign(tage_mask + 1, 0);
+            tage_ctr[t].assign(tage_mask + 1, 3);
+            tage_u[t].assign(tage_mask + 1, 0);
+        }
+
+        if (cfg.btb_ways_lg2 < 0 || BP_MAX_BTB_WAYS < 1 << cfg.btb_ways_lg2)
+            errx(1, "BTB ways must be between 1 and %d", BP_MAX_BTB_WAYS);
+
+        if (cfg.ras_depth < 1 || BP_MAX_RAS < cfg.ras_depth)
+            errx(1, "RAS depth must be between 1 and %d", BP_MAX_RAS);
+
+        for (int w = 0; w < BP_MAX_BTB_WAYS; ++w)
+            s0_btb_tag[w] = ~0u;
+
+        for (int i = 0; i < cfg.ras_depth; ++i)
+            ras[i] = 0;
+        ras[0] = 0x110;
+    }
+
+    // One S0 cycle with pc in s0_pc.  stall is s3_stall, in which case
+    // the returned prediction is discarded by the pipeline.
+    bp_prediction s0(uint32_t pc, bool stall = false)
+    {
+        bp_prediction p;
+        p.pc       = pc;
+        p.len      = 4;
+        p.btb_hit  = false;
+        p.btb_way  = 0;
+        for (int w = 0; w < 1 << cfg.btb_ways_lg2; ++w)
+            if (s0_btb_tag[w] == btb_tag_of(pc) &&
+                (!cfg.rvc || s0_btb_half[w] >= (pc >> 1 & 1))) {
+                p.btb_hit = true;
+                p.btb_way = w;
+            }
+        p.btb_type = s0_btb_type[p.btb_way];
+        p.btb_half = s0_btb_half[p.btb_way];
+
+        uint32_t target = target_of(pc, s0_btb_target[p.btb_way]);
+        p.yags_idx = s0_yags_idx;
+        p.yags_hit = s0_yags_tag == yags_tag_of(pc);
+        p.yags_dir = s0_yags_dir;
+        p.ras_tos  = ras_tos;
+        p.ras_top  = ras[ras_tos];
+        p.itc_idx  = s0_itc_idx;
+        p.itc_hit  = cfg.itc_index_bits > 0 && s0_itc_tag == itc_tag_of(pc);
+        p.itc_conf = s0_itc_conf;
+        p.br_history   = br_history;
+        p.path_history = path_history;
+
+        if (cfg.algo == BP_TAGE)
+            tage_predict(pc, p);
+
+        switch (cfg.algo) {
+        case BP_YAGS:    break;
+        case BP_TAGE:    break;
+        case BP_BIMODAL: p.yags_hit = false; break;
+        case BP_GSHARE:  p.yags_hit = true; break;
+        case BP_STATIC:  p.yags_hit = true; p.yags_dir = target < pc ? 2 : 1; break;
+        }
+
+        if (p.btb_hit && p.btb_type == BTB_TYPE_RETURN) {
+            p.type = BTB_TYPE_RETURN;
+            p.npc  = ras[ras_tos];
+        } else if (p.btb_hit && p.btb_type == BTB_TYPE_JUMP) {
+            p.type = BTB_TYPE_JUMP;
+            p.npc  = p.itc_hit ? s0_itc_target : target;
+        } else if (p.btb_hit && p.btb_type == BTB_TYPE_CALL) {
+            p.type = BTB_TYPE_CALL;
+            p.npc  = p.itc_hit ? s0_itc_target : target;
+        } else if (p.btb_hit && (p.btb_type == BTB_TYPE_BR_S_T || p.btb_type == BTB_TYPE_BR_W_T) &&
+                   !p.yags_hit) {
+            p.type = BTB_TYPE_BR_W_T;
+            p.npc  = target;
+        } else if (p.btb_hit && p.btb_type < 4 && p.yags_hit && (p.yags_dir & 2)) {
+            p.type = BTB_TYPE_BR_W_T;
+            p.npc  = target;
+        } else {
+            p.type = BTB_TYPE_BR_W_N;
+            p.npc  = (cfg.rvc ? pc & ~3 : pc) + 4;
+        }
+
+        read_dir(pc);
+        read_btb(stall ? pc : p.npc);
+
+        if (stall || !p.btb_hit)
+            return p;
+
+        if (cfg.algo == BP_TAGE && p.btb_type < 4)
+            loop_advance(pc, p.type == BTB_TYPE_BR_W_T);
+
+        switch (p.type) {
+        case BTB_TYPE_CALL:
+            ras_tos = (ras_tos + 1) % cfg.ras_depth;
+            ras[ras_tos] = cfg.rvc ? (pc & ~3) + p.btb_half * 2 + 2 : pc + 4;
+            path_history = (path_history << 2 ^ p.npc >> 2) & itc_mask;
+            break;
+        case BTB_TYPE_JUMP:
+            path_history = (path_history << 2 ^ p.npc >> 2) & itc_mask;
+            break;
+        case BTB_TYPE_RETURN:
+            ras_tos = (ras_tos + cfg.ras_depth - 1) % cfg.ras_depth;
+            break;
+        case BTB_TYPE_BR_W_T:
+            br_history = (br_history << 1 | 1) & history_mask();
+            break;
+        case BTB_TYPE_BR_W_N:
+            br_history = (br_history << 1) & history_mask();
+            break;
+        }
+
+        return p;
+    }
+
+    // Whether S2 will redirect for the instruction p predicted, that
+    // is, a BTB miss on a backward branch, a JAL, or a return
+    bool predecode_taken(const bp_prediction &p, uint32_t insn) const
+    {
+        unsigned opcode = insn_opcode(insn);
+
+        return cfg.predecode && !cfg.rvc && !p.btb_hit &&
+            ((opcode == BRANCH && (insn >> 31)) || opcode == JAL ||
+             (opcode == JALR && is_link(insn_rs1(insn)) && !is_link(insn_rd(insn))));
+    }
+
+    // The S2 redirect for a predecode_taken() instruction, with s0_pc
+    // in S0.  p.npc becomes the static prediction.  Without
+    // pd_checkpoint the histories keep what the dropped fetches did to
+    // them, as before the checkpoint.
+    void s2(uint32_t s0_pc, bp_prediction &p, uint32_t insn)
+    {
+        unsigned opcode = insn_opcode(insn);
+        uint32_t target = opcode == BRANCH ? p.pc + insn_sb_imm(insn)
+                        : opcode == JAL    ? p.pc + insn_uj_imm(insn)
+                        :                    p.ras_top;
+
+        p.npc = target;
+
+        if (cfg.pd_checkpoint) {
+            br_history   = p.br_history;
+            path_history = p.path_history;
+            if (opcode == BRANCH)
+                br_history = (br_history << 1 | 1) & history_mask();
+            if (opcode == JAL)
+                path_history = (path_history << 2 ^ target >> 2) & itc_mask;
+        }
+
+        if (opcode == JAL && is_link(insn_rd(insn))) {
+            ras_tos = (p.ras_tos + 1) % cfg.ras_depth;
+            ras[ras_tos] = p.pc + 4;
+        } else if (opcode == JALR) {
+            ras_tos = (p.ras_tos + cfg.ras_depth - 1) % cfg.ras_depth;
+        } else {
+            ras_tos = p.ras_tos;
+            ras[ras_tos] = p.ras_top;
+        }
+
+        read_dir(s0_pc);
+        read_btb(target);
+    }
+
+    // With RVC, the prediction S2 gives the instruction at pc of len
+    // bytes from the word's w: the BTB hit if it's the instruction the
+    // entry is for (al_mine), and then a taken prediction's target,
+    // otherwise what follows the instruction.
+    bp_prediction align(const bp_prediction &w, uint32_t pc, unsigned len, bool mine) const
+    {
+        bp_prediction p = w;
+
+        p.pc      = pc;
+        p.len     = len;
+        p.btb_hit = mine;
+        if (!mine || w.type == BTB_TYPE_BR_W_N)
+            p.npc = pc + len;
+        return p;
+    }
+
+    // With RVC, the S2 redirect for a word predicted taken where no
+    // instruction ends at the entry's halfword but one starts there:
+    // fetch goes on with the next word, and the histories and the RAS
+    // go back to the checkpoint S0 took for the word.
+    void realign(uint32_t s0_pc, bp_prediction &p)
+    {
+        p.npc = (p.pc & ~3) + 4;
+
+        br_history   = p.br_history;
+        path_history = p.path_history;
+        ras_tos      = p.ras_tos;
+        ras[ras_tos] = p.ras_top;
+
+        read_dir(s0_pc);
+        read_btb(p.npc);
+    }
+
+    // The cycle where restart is asserted; pc is what S0 held then
+    void restart(uint32_t pc, uint32_t restart_pc)
+    {
+        read_dir(pc);
+        read_btb(restart_pc);
+
+        for (int e = 0; e < LOOP_ENTRIES; ++e)
+            loop[e].spec = loop[e].iter;
+
+        br_history = rbr_history;
+        path_history = rpath_history;
+        ras_tos = rras_tos;
+        if (rras_we)
+            ras[ras_tos] = rras_top;
+    }
+
+    // S5 for a valid instruction predicted by p whose architectural
+    // successor is next_pc (for branches, next_pc decides taken).
+    // Updates the retirement history and the RAS restart state, returns
+    // in u what should
+    // be written to the tables, and returns true if this restarts the
+    // pipeline.  The tables know the instruction by its last halfword
+    // (s5_bp_pc), which without RVC is just its pc.
+    bool s5(const bp_prediction &p, uint32_t insn, uint32_t next_pc, bp_update &u)
+    {
+        uint32_t pc          = cfg.rvc ? p.pc + p.len - 2 : p.pc;
+        uint32_t seq_pc      = p.pc + p.len;
+        unsigned opcode      = insn_opcode(insn);
+        uint32_t insn_target = opcode == JAL ? p.pc + insn_uj_imm(insn) : seq_pc;
+        bool     insn_miss   = insn_target != p.npc;
+        bool     restart     = insn_miss;
+
+        rras_tos = p.ras_tos;
+        rras_top = p.ras_top;
+        rras_we  = true;
+
+        u.btb      = insn_miss;
+        u.btb_touch = p.btb_hit;
+        u.btb_idx  = ((pc >> 2) & btb_mask) |
+            (p.btb_hit ? p.btb_way : victim((pc >> 2) & btb_mask)) << cfg.btb_index_bits;
+        u.btb_type = BTB_TYPE_BR_W_N;
+        u.btb_half = pc >> 1 & 1;
+        u.yags     = false;
+        u.tage     = false;
+        u.itc      = false;
+
+        switch (opcode) {
+        case BRANCH: {
+            uint32_t br_target = p.pc + insn_sb_imm(insn);
+            bool     taken     = next_pc == br_target;
+
+            rbr_history = (rbr_history << 1 | taken) & history_mask();
+            if (taken) {
+                if (br_target != p.npc)
+                    restart = true;
+                else
+                    u.btb = restart = false;
+            }
+
+            last_btb_tag    = btb_tag_of(pc);
+            last_btb_target = encode(pc, br_target);
+
+            unsigned dir = p.yags_hit
+                ? (taken
+                   ? (p.yags_dir == BTB_TYPE_BR_S_T ? BTB_TYPE_BR_S_T : p.yags_dir + 1)
+                   : (p.yags_dir == BTB_TYPE_BR_S_N ? BTB_TYPE_BR_S_N : p.yags_dir - 1))
+                : (taken ? BTB_TYPE_BR_W_T : BTB_TYPE_BR_W_N);
+
+            u.yags     = cfg.algo == BP_YAGS || cfg.algo == BP_GSHARE;
+            u.yags_idx = p.yags_idx;
+            u.yags_tag = yags_tag_of(pc);
+            u.yags_dir = dir;
+
+            u.tage       = cfg.algo == BP_TAGE;
+            u.tage_m     = p.tage;
+            u.tage_taken = taken;
+            u.tage_base  = p.btb_hit && p.btb_type < 4 && (p.btb_type & 2);
+            if (u.tage)
+                loop_update(pc, p.tage, taken, u.tage_base);
+
+            if (!(p.btb_hit && p.yags_hit)) {
+                if (taken && (p.btb_type != BTB_TYPE_BR_S_T || !p.btb_hit)) {
+                    u.btb = true;
+                    u.btb_type = p.btb_type <= BTB_TYPE_BR_S_T && p.btb_hit
+                        ? p.btb_type + 1 : BTB_TYPE_BR_W_T;
+                }
+
+                if (!taken && (p.btb_type != BTB_TYPE_BR_S_N || !p.btb_hit)) {
+                    u.btb = true;
+                    u.btb_type = p.btb_type <= BTB_TYPE_BR_S_T && p.btb_hit
+                        ? p.btb_type - 1 : BTB_TYPE_BR_W_N;
+                }
+            }
+            break;
+        }
+
+        case JALR: {
+            unsigned link = is_link(insn_rd(insn)) << 1 | is_link(insn_rs1(insn));
+
+            if (next_pc != p.npc) {
+                restart         = true;
+                u.btb           = true;
+                last_btb_tag    = btb_tag_of(pc);
+                u.btb_type      = link == 0 ? BTB_TYPE_JUMP : link == 1 ? BTB_TYPE_RETURN : BTB_TYPE_CALL;
+                last_btb_target = encode(pc, next_pc);
+            } else {
+                // A return predicted by predecode still goes in the BTB
+                restart = false;
+                u.btb   = !p.btb_hit;
+                if (u.btb) {
+                    last_btb_tag    = btb_tag_of(pc);
+                    u.btb_type      = link == 0 ? BTB_TYPE_JUMP : link == 1 ? BTB_TYPE_RETURN : BTB_TYPE_CALL;
+                    last_btb_target = encode(pc, next_pc);
+                }
+            }
+
+            // The ITC predicts all but returns
+            if (link != 1 && cfg.itc_index_bits > 0) {
+                u.itc_idx    = p.itc_idx;
+                u.itc_tag    = itc_tag_of(pc);
+                u.itc_target = next_pc;
+                if (restart) {
+                    u.itc         = true;
+                    u.itc_replace = !p.itc_hit || p.itc_conf == 0;
+                    u.itc_conf    = u.itc_replace ? 1 : p.itc_conf - 1;
+                } else if (p.itc_hit && p.itc_conf != 3) {
+                    u.itc         = true;
+                    u.itc_replace = false;
+                    u.itc_conf    = p.itc_conf + 1;
+                }
+                rpath_history = (rpath_history << 2 ^ next_pc >> 2) & itc_mask;
+            }
+
+            if (link == 1)
+                rras_pop(p);
+            else if (link >= 2)
+                rras_push(p, seq_pc);
+            break;
+        }
+
+        case JAL:
+            // A JAL predicted by predecode still goes in the BTB
+            if (insn_miss || !p.btb_hit) {
+                u.btb           = true;
+                last_btb_tag    = btb_tag_of(pc);
+                u.btb_type      = is_link(insn_rd(insn)) ? BTB_TYPE_CALL : BTB_TYPE_JUMP;
+                last_btb_target = encode(pc, insn_target);
+            }
+            rpath_history = (rpath_history << 2 ^ insn_target >> 2) & itc_mask;
+            if (is_link(insn_rd(insn)))
+                rras_push(p, seq_pc);
+            break;
+
+        case SYSTEM:
+            restart = true;
+            break;
+
+        case MISC_MEM:
+            if (insn_funct3(insn) == FENCE_I)
+                restart = true;
+            break;
+        }
+
+        u.btb_tag    = last_btb_tag;
+        u.btb_target = last_btb_target;
+
+        return restart;
+    }
+
+    // The table writes, a cycle after S5
+    void write(const bp_update &u)
+    {
+        if (u.tage)
+            tage_update(u);
+
+        if (u.yags) {
+            yags_tag[u.yags_idx]       = u.yags_tag;
+            yags_direction[u.yags_idx] = u.yags_dir;
+        }
+
+        if (u.itc) {
+            if (u.itc_replace) {
+                itc_tag[u.itc_idx]    = u.itc_tag;
+                itc_target[u.itc_idx] = u.itc_target;
+            }
+            itc_conf[u.itc_idx] = u.itc_conf;
+        }
+
+        if (cfg.btb_random)
+            btb_lfsr = (btb_lfsr << 1 | ((btb_lfsr >> 7 ^ btb_lfsr >> 5 ^ btb_lfsr >> 4 ^ btb_lfsr >> 3) & 1)) & 255;
+        else if (u.btb || u.btb_touch) {
+            // Mark the way used, and once all are, start over with just it
+            uint32_t set = u.btb_idx & btb_mask;
+            unsigned bit = 1u << (u.btb_idx >> cfg.btb_index_bits);
+            unsigned all = (1u << (1 << cfg.btb_ways_lg2)) - 1;
+            btb_nru[set] = (btb_nru[set] | bit) == all ? bit : btb_nru[set] | bit;
+        }
+
+        if (u.btb) {
+            btb_type[u.btb_idx]   = u.btb_type;
+            btb_tag[u.btb_idx]    = u.btb_tag;
+            btb_target[u.btb_idx] = u.btb_target;
+            btb_half[u.btb_idx]   = u.btb_half;
+        }
+    }
+
+    // Table budget in bits, for comparing configurations
+    unsigned long bits() const
+    {
+        int target_bits = cfg.btb_target == BTB_FULL ? (cfg.rvc ? 31 : 30) : cfg.btb_target_bits;
+        unsigned long b = ((btb_mask + 1ul) << cfg.btb_ways_lg2) *
+            (3 + cfg.btb_tag_bits + target_bits + cfg.rvc);
+
+        if (cfg.btb_ways_lg2 > 0 && !cfg.btb_random)
+            b += (btb_mask + 1ul) << cfg.btb_ways_lg2;
+
+        if (cfg.algo == BP_YAGS)
+            b += (yags_mask + 1ul) * (2 + cfg.yags_tag_bits);
+        else if (cfg.algo == BP_GSHARE)
+            b += (yags_mask + 1ul) * 2;
+        else if (cfg.algo == BP_TAGE)
+            b += TAGE_TABLES * (tage_mask + 1ul) * (TAGE_TAG_BITS + 3 + 1) +
+                LOOP_ENTRIES * (1 + 14 + 3 * 10 + 2);
+        if (cfg.itc_index_bits > 0)
+            b += (itc_mask + 1ul) * (ITC_TAG_BITS + 30 + 2);
+        return b;
+    }
+
+    const bp_config cfg;
+
+private:
+    unsigned btb_tag_of(uint32_t pc) const
+    {
+        return (pc >> (cfg.btb_index_bits + 2)) & btb_tag_mask;
+    }
+
+    // The BTB target field t of the branch at pc as an address and back.
+    // Targets are in instructions (INSN_LSB), halfwords with RVC, and
+    // a distance is from the word.
+    uint32_t target_of(uint32_t pc, uint32_t t) const
+    {
+        int lsb = cfg.rvc ? 1 : 2;
+
+        switch (cfg.btb_target) {
+        case BTB_DELTA:
+            return (pc & ~3) + ((t ^ (btb_target_mask + 1) / 2) - (btb_target_mask + 1) / 2) * (1 << lsb);
+        case BTB_FULL:
+            return t << lsb;
+        default:
+            return (pc & ~((btb_target_mask << lsb) | ((1 << lsb) - 1))) | t << lsb;
+        }
+    }
+
+    uint32_t encode(uint32_t pc, uint32_t a) const
+    {
+        int lsb = cfg.rvc ? 1 : 2;
+
+        return (cfg.btb_target == BTB_DELTA ? (a - (pc & ~3)) >> lsb : a >> lsb) & btb_target_mask;
+    }
+
+    // The way a BTB miss in set allocates
+    unsigned victim(uint32_t set) const
+    {
+        if (cfg.btb_random)
+            return btb_lfsr & ((1u << cfg.btb_ways_lg2) - 1);
+
+        for (int w = 0; w < 1 << cfg.btb_ways_lg2; ++w)
+            if (!(btb_nru[set] >> w & 1))
+                return w;
+        return 0;
+    }
+
+    unsigned yags_tag_of(uint32_t pc) const
+    {
+        return (pc >> (cfg.yags_index_bits + 2)) & yags_tag_mask;
+    }
+
+    unsigned itc_tag_of(uint32_t pc) const
+    {
+        return (pc >> (cfg.itc_index_bits + 2) ^ pc >> 2) & ((1u << ITC_TAG_BITS) - 1);
+    }
+
+    uint64_t history_mask() const
+    {
+        return cfg.algo == BP_TAGE ? ~0ull : yags_mask;
+    }
+
+    static uint32_t fold(uint64_t h, int len, int width)
+    {
+        uint32_t f = 0;
+        for (int i = 0; i < len; ++i)
+            f ^= (h >> i & 1) << (i % width);
+        return f;
+    }
+
+    // The direction predictor read, at the clock edge with S0's pc
+    void read_dir(uint32_t pc)
+    {
+        uint32_t yi = (pc >> 2 ^ br_history) & yags_mask;
+        s0_yags_idx = yi;
+        s0_yags_tag = yags_tag[yi];
+        s0_yags_dir = yags_direction[yi];
+
+        uint32_t ii = (pc >> 2 ^ path_history) & itc_mask;
+        s0_itc_idx    = ii;
+        s0_itc_tag    = itc_tag[ii];
+        s0_itc_target = itc_target[ii];
+        s0_itc_conf   = itc_conf[ii];
+
+        if (cfg.algo != BP_TAGE)
+            return;
+
+        for (int t = 0; t < TAGE_TABLES; ++t) {
+            uint32_t i = (pc >> 2 ^ pc >> (cfg.tage_index_bits + 2) ^
+                          fold(br_history, tage_hist_len[t], cfg.tage_index_bits)) & tage_mask;
+            s0_tage_idx[t]  = i;
+            s0_tage_fold[t] = fold(br_history, tage_hist_len[t], TAGE_TAG_BITS);
+            s0_tage_tag[t]  = tage_tag[t][i];
+            s0_tage_ctr[t]  = tage_ctr[t][i];
+            s0_tage_u[t]    = tage_u[t][i];
+        }
+    }
+
+    int loop_find(uint32_t pc) const
+    {
+        int e = -1;
+        for (int i = 0; i < LOOP_ENTRIES; ++i)
+            if (loop[i].valid && loop[i].tag == (pc >> 2 & 0x3fff))
+                e = i;
+        return e;
+    }
+
+    // The tag compare in the cycle after the read, with pc in S0
+    void tage_predict(uint32_t pc, bp_prediction &p) const
+    {
+        tage_meta &m = p.tage;
+
+        m.prov = m.prov_ctr = 0;
+        m.alt_hit = m.alt_taken = false;
+        for (int t = 0; t < TAGE_TABLES; ++t) {
+            m.idx[t] = s0_tage_idx[t];
+            m.tag[t] = (pc >> (cfg.tage_index_bits + 2) ^ s0_tage_fold[t]) & ((1u << TAGE_TAG_BITS) - 1);
+            m.u[t]   = s0_tage_u[t];
+            if (s0_tage_tag[t] == m.tag[t]) {
+                m.alt_hit   = m.prov != 0;
+                m.alt_taken = m.prov_ctr >> 2;
+                m.prov      = t + 1;
+                m.prov_ctr  = s0_tage_ctr[t];
+            }
+        }
+
+        int e = loop_find(pc);
+        m.loop_hit   = e >= 0 && loop[e].conf == 3;
+        m.loop_taken = e >= 0 && loop[e].spec != loop[e].trip;
+
+        p.yags_hit = m.loop_hit || m.prov;
+        p.yags_dir = m.loop_hit ? (m.loop_taken ? 3 : 0) : m.prov_ctr >> 1;
+    }
+
+    void loop_advance(uint32_t pc, bool taken)
+    {
+        int e = loop_find(pc);
+        if (e >= 0)
+            loop[e].spec = taken ? (loop[e].spec + 1) & 0x3ff : 0;
+    }
+
+    void loop_update(uint32_t pc, const tage_meta &m, bool taken, bool base)
+    {
+        int e = loop_find(pc);
+
+        if (e >= 0) {
+            if (!taken) {
+                if (loop[e].iter == loop[e].trip)
+                    loop[e].conf += loop[e].conf < 3;
+                else {
+                    loop[e].trip = loop[e].iter;
+                    loop[e].conf = 0;
+                }
+            }
+            if (taken && loop[e].iter == 0x3ff)
+                loop[e].valid = false; // Too long for us
+            loop[e].iter = taken ? (loop[e].iter + 1) & 0x3ff : 0;
+        } else if (!taken && (m.loop_hit ? m.loop_taken : m.prov ? m.prov_ctr >> 2 : base)) {
+            loop[loop_next] = {true, pc >> 2 & 0x3fff, 0, 0, 0, 0};
+            loop_next = (loop_next + 1) % LOOP_ENTRIES;
+        }
+    }
+
+    void tage_update(const bp_update &u)
+    {
+        const tage_meta &m = u.tage_m;
+        bool pred  = m.prov ? m.prov_ctr >> 2 : u.tage_base;
+        bool alt   = m.alt_hit ? m.alt_taken : u.tage_base;
+        bool wrong = pred != u.tage_taken;
+        bool allocated = false;
+
+        for (unsigned t = 0; t < TAGE_TABLES; ++t)
+            if (m.prov == t + 1) {
+                unsigned c = m.prov_ctr;
+                tage_ctr[t][m.idx[t]] = u.tage_taken ? c + (c < 7) : c - (0 < c);
+                if (pred != alt)
+                    tage_u[t][m.idx[t]] = pred == u.tage_taken;
+            } else if (wrong && m.prov < t + 1 && !allocated && !m.u[t]) {
+                tage_tag[t][m.idx[t]] = m.tag[t];
+                tage_ctr[t][m.idx[t]] = u.tage_taken ? 4 : 3;
+                tage_u[t][m.idx[t]]   = 0;
+                allocated = true;
+            }
+
+        if (wrong && m.prov < TAGE_TABLES && !allocated)
+            for (unsigned t = m.prov; t < TAGE_TABLES; ++t)
+                tage_u[t][m.idx[t]] = 0;
+    }
+
+    void read_btb(uint32_t pc)
+    {
+        for (int w = 0; w < 1 << cfg.btb_ways_lg2; ++w) {
+            uint32_t i = ((pc >> 2) & btb_mask) | w << cfg.btb_index_bits;
+            s0_btb_type[w]   = btb_type[i];
+            s0_btb_tag[w]    = btb_tag[i];
+            s0_btb_target[w] = btb_target[i];
+            s0_btb_half[w]   = btb_half[i];
+        }
+    }
+
+    void rras_push(const bp_prediction &p, uint32_t a)
+    {
+        rras_tos = (p.ras_tos + 1) % cfg.ras_depth;
+        rras_top = a;
+    }
+
+    void rras_pop(const bp_prediction &p)
+    {
+        rras_tos = (p.ras_tos + cfg.ras_depth - 1) % cfg.ras_depth;
+        rras_we  = false;
+    }
+
+    const uint32_t btb_mask, btb_tag_mask, btb_target_mask;
+    const uint32_t yags_mask, yags_tag_mask;
+
+    std::vector<uint8_t>  btb_type;
+    std::vector<uint32_t> btb_tag;
+    std::vector<uint32_t> btb_target;
+    std::vector<uint8_t>  btb_half;
+    std::vector<uint16_t> btb_nru;  // a bit per way
+    unsigned              btb_lfsr = 1;
+    std::vector<uint32_t> yags_tag;
+    std::vector<uint8_t>  yags_direction;
+
+    const uint32_t        tage_mask;
+    std::vector<uint8_t>  tage_tag[TAGE_TABLES];
+    std::vector<uint8_t>  tage_ctr[TAGE_TABLES];
+    std::vector<uint8_t>  tage_u[TAGE_TABLES];
+
+    const uint32_t        itc_mask;
+    std::vector<uint32_t> itc_tag;
+    std::vector<uint32_t> itc_target;
+    std::vector<uint8_t>  itc_conf;
+
+    struct loop_entry {
+        bool     valid;
+        unsigned tag, trip, iter, spec, conf;
+    } loop[LOOP_ENTRIES] = {};
+    unsigned loop_next = 0;
+
+    uint32_t ras[BP_MAX_RAS];
+    unsigned ras_tos = 0, rras_tos = 0;
+    uint32_t rras_top = 0;
+    bool     rras_we = false;
+    uint64_t br_history = 0, rbr_history = 0;
+    uint32_t path_history = 0, rpath_history = 0;
+
+    // The S0 registers
+    unsigned s0_btb_type[BP_MAX_BTB_WAYS] = {};
+    unsigned s0_btb_tag[BP_MAX_BTB_WAYS];
+    uint32_t s0_btb_target[BP_MAX_BTB_WAYS] = {};
+    unsigned s0_btb_half[BP_MAX_BTB_WAYS] = {};
+    uint32_t s0_yags_idx = 0;
+    unsigned s0_yags_tag = ~0u, s0_yags_dir = 1;
+    uint32_t s0_tage_idx[TAGE_TABLES] = {}, s0_tage_fold[TAGE_TABLES] = {};
+    unsigned s0_tage_tag[TAGE_TABLES] = {}, s0_tage_ctr[TAGE_TABLES] = {};
+    bool     s0_tage_u[TAGE_TABLES] = {};
+    uint32_t s0_itc_idx = 0, s0_itc_target = 0;
+    unsigned s0_itc_tag = ~0u, s0_itc_conf = 0;
+
+    // btb_update_tag/target keep their value when not assigned
+    unsigned last_btb_tag = 0;
+    uint32_t last_btb_target = 0;
+};
+
+#endif
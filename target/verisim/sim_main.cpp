@@ -1,3 +1,6 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include "Vyarvi.h"
 #include "verilated.h"
 
@@ -8,6 +11,99 @@
 vluint64_t main_time = 0;
 double sc_time_stamp() {return main_time;}
 
+#if defined(ICACHE) || defined(DCACHE)
+#include <vector>
+
+/*
+ * The external memory behind the cache refill port (make ICACHE=1
+ * and/or DCACHE=1).  It serves one AXI4 read burst at a time: the
+ * first beat comes +dram_latency=N cycles (20) after the address is
+ * accepted and the rest one every +dram_beat=N cycles (1), that is, a
+ * bandwidth of 4/N bytes per cycle.  Write bursts (D$ write-backs, or
+ * stores written through without the D$) are taken at the same rate,
+ * independently, and acknowledged the cycle after the last beat.  It holds the same image as the on-chip memory
+ * (+INIT0..3) at 0x8000_0000, mirrored every 16 MiB.
+ */
+struct dram {
+    std::vector<uint32_t> mem = std::vector<uint32_t>(1 << 22, 0);
+    unsigned latency = 20, beat = 1;
+    bool     busy    = false;
+    uint32_t addr    = 0;
+    unsigned beats   = 0;
+    uint64_t next    = 0; // cycle the next beat is available
+    uint64_t bursts  = 0;
+    bool     wbusy   = false;
+    bool     bvalid  = false;
+    uint32_t waddr   = 0;
+    uint64_t wnext   = 0; // cycle the next write beat is taken
+    uint64_t wbursts = 0;
+
+    uint32_t& at(uint32_t a) { return mem[(a >> 2) & (mem.size() - 1)]; }
+
+    void load(int lane, const char* file) {
+        FILE* f = fopen(file, "r");
+        unsigned v;
+
+        if (!f) {
+            perror(file);
+            exit(1);
+        }
+        for (size_t i = 0; i < mem.size() && fscanf(f, "%x", &v) == 1; ++i)
+            mem[i] |= (v & 255) << 8 * lane;
+        fclose(f);
+    }
+
+    // At the rising edge ending cycle n, before it's evaluated
+    void edge(Vyarvi* top, uint64_t n) {
+        if (top->mem_rvalid && top->mem_rready) {
+            addr += 4;
+            busy = --beats != 0;
+            next = n + beat;
+        }
+        if (top->mem_arvalid && top->mem_arready) {
+            busy  = true;
+            addr  = top->mem_araddr;
+            beats = top->mem_arlen + 1;
+            next  = n + latency;
+            ++bursts;
+        }
+        if (bvalid && top->mem_bready)
+            bvalid = false;
+        if (top->mem_wvalid && top->mem_wready) {
+            uint32_t& w = at(waddr);
+            for (int lane = 0; lane < 4; ++lane)
+                if (top->mem_wstrb & 1 << lane)
+                    w = (w & ~(255u << 8 * lane)) | (top->mem_wdata & 255u << 8 * lane);
+            waddr += 4;
+            wnext  = n + beat;
+            if (top->mem_wlast) {
+                wbusy  = false;
+                bvalid = true;
+            }
+        }
+        if (top->mem_awvalid && top->mem_awready) {
+            wbusy = true;
+            waddr = top->mem_awaddr;
+            wnext = n + 1;
+            ++wbursts;
+        }
+    }
+
+    // The responses for cycle n + 1
+    void drive(Vyarvi* top, uint64_t n) {
+        top->mem_arready = !busy;
+        top->mem_rvalid  = busy && next <= n + 1;
+        top->mem_rdata   = at(addr);
+        top->mem_rresp   = 0;
+        top->mem_rlast   = beats == 1;
+        top->mem_awready = !wbusy && !bvalid;
+        top->mem_wready  = wbusy && wnext <= n + 1;
+        top->mem_bvalid  = bvalid;
+        top->mem_bresp   = 0;
+    }
+};
+#endif
+
 int main(int argc, char** argv, char** env) {
     Verilated::commandArgs(argc, argv);
     Verilated::debug(0);
@@ -27,10 +123,57 @@ int main(int argc, char** argv, char** env) {
     }
 #endif
 
+    /*
+     * +retire=FILE writes a retirement trace, one line per retired
+     * instruction: "cycle pc insn wb_val addr len" (cycle and len, 2 or
+     * 4 bytes, in decimal, the rest in hex).  With RVC, insn is the
+     * expanded instruction.  This is the input to the tools in sw/perf.
+     */
+    FILE* rfp = NULL;
+    const char* retire = Verilated::commandArgsPlusMatch("retire=");
+    if (retire && strncmp(retire, "+retire=", 8) == 0) {
+        rfp = strcmp(retire + 8, "-") == 0 ? stdout : fopen(retire + 8, "w");
+        if (!rfp) {
+            perror(retire + 8);
+            exit(1);
+        }
+    }
+
+    /* +cycles=N stops the simulation after N cycles */
+    uint64_t max_cycles = 0;
+    const char* cycles = Verilated::commandArgsPlusMatch("cycles=");
+    if (cycles && strncmp(cycles, "+cycles=", 8) == 0)
+        max_cycles = strtoull(cycles + 8, NULL, 0);
+
+    /*
+     * +halt stops the simulation when the program is done, that is,
+     * parks itself in `j .` or traps with no handler (mtvec = 0).
+     */
+    bool halt = Verilated::commandArgsPlusMatch("halt")[0] != 0;
+    bool halted = false;
+
+#if defined(ICACHE) || defined(DCACHE)
+    dram dmem;
+    const char* arg = Verilated::commandArgsPlusMatch("dram_latency=");
+    if (arg && strncmp(arg, "+dram_latency=", 14) == 0)
+        dmem.latency = atoi(arg + 14) < 1 ? 1 : atoi(arg + 14);
+    arg = Verilated::commandArgsPlusMatch("dram_beat=");
+    if (arg && strncmp(arg, "+dram_beat=", 11) == 0)
+        dmem.beat = atoi(arg + 11) < 1 ? 1 : atoi(arg + 11);
+    for (int lane = 0; lane < 4; ++lane) {
+        char plus[8], name[32];
+        snprintf(plus, sizeof plus, "INIT%d=", lane);
+        snprintf(name, sizeof name, "init_mem.%d.hex", lane);
+        arg = Verilated::commandArgsPlusMatch(plus);
+        dmem.load(lane, arg && arg[0] ? arg + 7 : name);
+    }
+    dmem.drive(top, 0);
+#endif
+
     top->clock = 0;
     top->reset = 1;
 
-    while (!Verilated::gotFinish()) {
+    while (!Verilated::gotFinish() && !halted && (!max_cycles || main_time / 2 < max_cycles)) {
       main_time++;
       top->clock ^= 1;
 
@@ -42,7 +185,24 @@ int main(int argc, char** argv, char** env) {
 
       //      VL_PRINTF("[%" VL_PRI64 "d] clk=%x rstl=%x  -> counter=%d\n",
       //                main_time, top->clock, top->reset, top->counter);
+#if defined(ICACHE) || defined(DCACHE)
+      if (top->clock)
+          dmem.edge(top, main_time / 2);
+#endif
       top->eval();
+#if defined(ICACHE) || defined(DCACHE)
+      if (top->clock)
+          dmem.drive(top, main_time / 2);
+#endif
+
+      if (rfp && top->clock && top->retire_valid)
+          fprintf(rfp, "%" PRIu64 " %08x %08x %08x %08x %d\n",
+                  (uint64_t) main_time / 2, top->retire_pc, top->retire_insn,
+                  top->retire_wb_val, top->retire_addr, top->retire_rvc ? 2 : 4);
+
+      if (halt && top->clock && top->retire_valid &&
+          (top->retire_insn == 0x0000006f || top->retire_pc == 0))
+          halted = true;
 
 #if VM_TRACE
         // Dump trace data for this cycle
@@ -52,6 +212,14 @@ int main(int argc, char** argv, char** env) {
 
     top->final();
 
+#if defined(ICACHE) || defined(DCACHE)
+    fprintf(stderr, "Refills: %" PRIu64 "\n", dmem.bursts);
+    fprintf(stderr, "Writebacks: %" PRIu64 "\n", dmem.wbursts);
+#endif
+
+    if (rfp && rfp != stdout)
+        fclose(rfp);
+
 #if VM_TRACE
     if (tfp) { tfp->close(); tfp = NULL; }
 #endif